@@ -0,0 +1,160 @@
+/******************************************************************************
+ * File: ThreadPoolBenchmark.cpp
+ * Description: Compares the work-stealing ThreadPool with the original
+ *              single-queue pool on a synthetic directory tree. Every task
+ *              "reads" one directory by doing a little work and then enqueues
+ *              its sub-directories, the same way the scanner uses the pool.
+ * Author: Robert Tetreault
+ *
+ * Usage: ./ThreadPoolBenchmark [threads] [depth] [fanout] [workPerDir]
+ ******************************************************************************/
+
+#include "ThreadPool.h"
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/******************************************************************************
+ * LegacyThreadPool: The pool the scanner used before, one std::queue of
+ *                   std::function behind one mutex. Kept here as the baseline.
+ ******************************************************************************/
+class LegacyThreadPool {
+    public:
+        LegacyThreadPool(size_t numThreads) : activeJobs(0) {
+            for (size_t i = 0; i < numThreads; ++i) {
+                workers.emplace_back(workerThread, this);
+            }
+        }
+
+        ~LegacyThreadPool() {
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                stop = true;
+            }
+            condition.notify_all();
+            for (std::thread &worker : workers) {
+                worker.join();
+            }
+        }
+
+        void enqueue(std::function<void()> task) {
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                tasks.push([&, task]() {
+                    task();
+                    if (--activeJobs == 0) {
+                        everythingDone.notify_all();
+                    }
+                });
+                activeJobs++;
+            }
+            condition.notify_one();
+        }
+
+        void waitForCompletion() {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            everythingDone.wait(lock, [this]() { return activeJobs == 0; });
+        }
+
+        std::atomic<int> activeJobs;
+
+    private:
+        static void workerThread(LegacyThreadPool *pool) {
+            std::function<void()> task;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(pool->queueMutex);
+                    pool->condition.wait(lock, [pool] { return pool->stop || !pool->tasks.empty(); });
+                    if (pool->stop && pool->tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(pool->tasks.front());
+                    pool->tasks.pop();
+                }
+                task();
+            }
+        }
+
+        std::vector<std::thread> workers;
+        std::queue<std::function<void()>> tasks;
+        std::mutex queueMutex;
+        std::condition_variable condition;
+        std::condition_variable everythingDone;
+        bool stop = false;
+};
+
+// The shape of the synthetic tree
+struct TreeShape {
+    size_t depth;           // How many levels of directories there are
+    size_t fanout;          // How many sub-directories every directory has
+    size_t workPerDir;      // How much busy work "reading" a directory costs
+};
+
+// Keeps the busy work from being optimized away
+std::atomic<uint64_t> checksum(0);
+std::atomic<uint64_t> directoriesVisited(0);
+
+/******************************************************************************
+ * visit: "Reads" one synthetic directory and enqueues its children.
+ ******************************************************************************/
+template <typename Pool>
+void visit(Pool &pool, const TreeShape &shape, size_t level, uint64_t id) {
+    uint64_t hash = id;
+    for (size_t i = 0; i < shape.workPerDir; ++i) {
+        hash = hash * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    checksum += hash;
+    directoriesVisited++;
+
+    if (level + 1 >= shape.depth) {
+        return;
+    }
+
+    for (size_t child = 0; child < shape.fanout; ++child) {
+        uint64_t childId = id * shape.fanout + child + 1;
+        pool.enqueue([&pool, &shape, level, childId]() { visit(pool, shape, level + 1, childId); });
+    }
+}
+
+/******************************************************************************
+ * run: Scans the synthetic tree with a pool and returns how long it took.
+ ******************************************************************************/
+template <typename Pool>
+double run(size_t threads, const TreeShape &shape) {
+    directoriesVisited = 0;
+    Pool pool(threads);
+
+    auto start = std::chrono::steady_clock::now();
+    pool.enqueue([&pool, &shape]() { visit(pool, shape, 0, 0); });
+    pool.waitForCompletion();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t threads = argc > 1 ? std::stoul(argv[1]) : 200;
+    TreeShape shape;
+    shape.depth = argc > 2 ? std::stoul(argv[2]) : 7;
+    shape.fanout = argc > 3 ? std::stoul(argv[3]) : 8;
+    shape.workPerDir = argc > 4 ? std::stoul(argv[4]) : 2000;
+
+    std::cout << "Synthetic tree: depth " << shape.depth << ", fanout " << shape.fanout
+              << ", " << shape.workPerDir << " work units per directory, " << threads << " threads" << std::endl;
+
+    double legacyTime = run<LegacyThreadPool>(threads, shape);
+    std::cout << "Single-queue pool:  " << legacyTime << " ms (" << directoriesVisited << " directories)" << std::endl;
+
+    double stealingTime = run<ThreadPool>(threads, shape);
+    std::cout << "Work-stealing pool: " << stealingTime << " ms (" << directoriesVisited << " directories)" << std::endl;
+
+    std::cout << "Speedup: " << legacyTime / stealingTime << "x" << std::endl;
+    return 0;
+}
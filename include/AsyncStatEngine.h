@@ -0,0 +1,82 @@
+/******************************************************************************
+ * File: AsyncStatEngine.h
+ * Description: Stats and opens directory entries in batches through io_uring
+ *              so one thread can keep many metadata requests in flight on
+ *              high-latency filesystems like NFS and FUSE.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef ASYNC_STAT_ENGINE_H
+#define ASYNC_STAT_ENGINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/stat.h>
+
+class AsyncStatEngine {
+    public:
+        // How many requests each thread's ring keeps in flight at most
+        static const unsigned QUEUE_DEPTH = 256;
+
+        ~AsyncStatEngine();
+
+        AsyncStatEngine(const AsyncStatEngine&) = delete;
+        AsyncStatEngine& operator=(const AsyncStatEngine&) = delete;
+
+        // Returns this thread's engine, or nullptr if io_uring isn't available
+        static AsyncStatEngine* forThisThread();
+
+        // What a request's result holds until the ring hands it back
+        static const int NOT_COMPLETED;
+
+        // Stats every name relative to dirFd. errors[i] is 0 or the errno of names[i].
+        void statBatch(int dirFd, const std::vector<const char*>& names, unsigned int mask,
+                       std::vector<struct statx>& results, std::vector<int>& errors);
+
+        // Opens every name relative to dirFd as a directory. fds[i] is the new fd or -errno.
+        void openBatch(int dirFd, const std::vector<const char*>& names, std::vector<int>& fds);
+
+    private:
+        AsyncStatEngine();
+
+        // Sets up the ring, returns false if the kernel won't give us one
+        bool setup();
+
+        // Runs requests 0..count-1, prepare(i, sqe) fills in request i and complete(i, res) gets its result
+        template <typename Prepare, typename Complete>
+        void run(size_t count, Prepare prepare, Complete complete);
+
+        // Hands the completions waiting in the completion queue to complete(i, res), returns how many there were
+        template <typename Complete>
+        size_t reap(Complete& complete);
+
+        int ringFd;                                 // The io_uring file descriptor
+
+        // Submission ring
+        void *sqRing;
+        size_t sqRingSize;
+        std::atomic<unsigned> *sqHead;
+        std::atomic<unsigned> *sqTail;
+        unsigned sqMask;
+        unsigned *sqArray;
+        struct io_uring_sqe *sqes;
+        size_t sqesSize;
+        unsigned sqEntries;
+
+        // Completion ring
+        void *cqRing;
+        size_t cqRingSize;
+        std::atomic<unsigned> *cqHead;
+        std::atomic<unsigned> *cqTail;
+        unsigned cqMask;
+        struct io_uring_cqe *cqes;
+
+        std::vector<bool> reaped;                   // Which requests of the running batch have a result
+        bool broken;                                // Set once io_uring_enter has failed, the ring isn't used again
+
+        static std::atomic<bool> unavailable;       // Set once io_uring fails to set up, so nobody tries again
+};
+
+#endif
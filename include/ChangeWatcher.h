@@ -0,0 +1,83 @@
+/******************************************************************************
+ * File: ChangeWatcher.h
+ * Description: Subscribes to changes below the scanned root after the scan,
+ *              so the tree can be kept current instead of scanned again. It
+ *              uses fanotify where the process is allowed to, which needs one
+ *              mark per filesystem, and falls back to one inotify watch per
+ *              directory. Events are turned into the arena nodes of the
+ *              directories whose entries changed, gathered into batches.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef CHANGE_WATCHER_H
+#define CHANGE_WATCHER_H
+
+#include "PathArena.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+class ChangeWatcher {
+    public:
+        // How events are received
+        enum Backend {
+            NONE,
+            FANOTIFY,       // One mark per filesystem, events name the directory by file handle
+            INOTIFY         // One watch per directory
+        };
+
+        // Once events start coming in, the batch is handed over after this long without any...
+        static constexpr std::chrono::milliseconds QUIET_PERIOD{200};
+
+        // ...or after this long at most, so a steady stream of changes still gets applied
+        static constexpr std::chrono::milliseconds MAX_BATCH{2000};
+
+        ChangeWatcher(const PathArena &arena);
+        ~ChangeWatcher();
+
+        ChangeWatcher(const ChangeWatcher&) = delete;
+        ChangeWatcher& operator=(const ChangeWatcher&) = delete;
+
+        // Sets up fanotify, or inotify if fanotify isn't permitted. Returns false if neither works.
+        bool start();
+
+        // Starts reporting changes to a directory that was read. dev is the device it is on.
+        void watchDirectory(uint32_t node, uint64_t dev);
+
+        // Waits for changes and collects the directories they happened in until the batch is over.
+        // overflowed is set if the kernel dropped events, then any directory may have changed.
+        // Returns false if stopping was set before anything changed.
+        bool waitForChanges(std::unordered_set<uint32_t> &changed, bool &overflowed, const std::atomic<bool> &stopping);
+
+        // Retrieves the name of the backend in use
+        const char* getBackendName() const;
+
+    private:
+        // Sets up inotify, when fanotify can't be used. Returns false if it can't be set up either.
+        bool startInotify();
+
+        // Reads every event that is ready. Returns false on an error.
+        bool readEvents(std::unordered_set<uint32_t> &changed, bool &overflowed);
+
+        // Handles the events in a buffer read from fanotify
+        void parseFanotify(const char *buffer, size_t length, std::unordered_set<uint32_t> &changed, bool &overflowed);
+
+        // Handles the events in a buffer read from inotify
+        void parseInotify(const char *buffer, size_t length, std::unordered_set<uint32_t> &changed, bool &overflowed);
+
+        // Builds the key a fanotify event identifies a directory by, from its filesystem id and file handle
+        static std::string handleKey(const void *fsid, const void *handle);
+
+        const PathArena &arena;                                 // Turns nodes into paths
+        Backend backend;                                        // How events are received
+        int fd;                                                 // The fanotify or inotify descriptor
+        std::unordered_map<uint64_t, std::string> filesystems;  // fanotify: the fsid of each device that has a mark
+        std::unordered_map<std::string, uint32_t> handles;      // fanotify: the node of each directory's file handle
+        std::unordered_map<int, uint32_t> watches;              // inotify: the node of each watch descriptor
+        bool warned;                                            // Whether a directory that can't be watched was reported
+};
+
+#endif
@@ -0,0 +1,88 @@
+/******************************************************************************
+ * File: ConcurrencyController.h
+ * Description: Sizes the thread pool while the scan runs. It works out how
+ *              many threads the machine allows, then keeps moving the number
+ *              of active workers towards whatever reads the most directory
+ *              entries per second.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef CONCURRENCY_CONTROLLER_H
+#define CONCURRENCY_CONTROLLER_H
+
+#include "ThreadPool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// How many threads the scan may use, worked out from the machine and the process limits
+struct ConcurrencyLimits {
+    size_t cpus = 1;                // CPUs we may run on, after affinity and the cgroup quota
+    size_t minThreads = 1;          // Never run fewer workers than this
+    size_t maxThreads = 1;          // Never run more workers than this
+    size_t startThreads = 1;        // Where the controller starts
+};
+
+class ConcurrencyController {
+    public:
+        // How often the entry rate is measured and the number of workers adjusted
+        static constexpr std::chrono::milliseconds SAMPLE_INTERVAL{200};
+
+        // Rate changes smaller than this fraction are treated as noise
+        static constexpr double TOLERANCE = 0.05;
+
+        ConcurrencyController(ThreadPool &pool, const ConcurrencyLimits &limits);
+        ~ConcurrencyController();
+
+        ConcurrencyController(const ConcurrencyController&) = delete;
+        ConcurrencyController& operator=(const ConcurrencyController&) = delete;
+
+        // Works out the limits from sched_getaffinity(), the cgroup CPU quota and RLIMIT_NOFILE
+        static ConcurrencyLimits detectLimits(bool asyncStat);
+
+        // Starts adjusting the pool in the background
+        void start();
+
+        // Stops adjusting the pool, the pool keeps whatever size it had
+        void stop();
+
+        // Counts a finished directory read. Called by the workers.
+        void recordRead(uint64_t entries, std::chrono::nanoseconds latency);
+
+        // Prints where the controller ended up
+        void printSummary() const;
+
+    private:
+        // Measures the last interval and moves the number of active workers
+        void adjust(double seconds);
+
+        // The background thread's loop
+        void run();
+
+        // Reads the CPU quota of the cgroup we are in, 0 if there is none
+        static size_t cgroupCpuLimit();
+
+        ThreadPool &pool;                           // The pool being sized
+        ConcurrencyLimits limits;                   // The range the pool may be sized in
+
+        std::atomic<uint64_t> entries;              // Directory entries read so far
+        std::atomic<uint64_t> reads;                // Directories read so far
+        std::atomic<uint64_t> latencyNanoseconds;   // Time spent in all of those reads
+
+        uint64_t lastEntries;                       // entries at the last sample
+        double lastRate;                            // Entries per second in the last interval
+        double peakRate;                            // The best rate seen
+        size_t peakThreads;                         // The number of workers at the best rate
+        int direction;                              // +1 while adding workers, -1 while removing them
+
+        std::thread thread;                         // Runs the controller
+        std::mutex mutex;                           // Lets stop() wake the controller
+        std::condition_variable wake;               // Signals the controller to stop
+        bool stopping;                              // Set by stop()
+};
+
+#endif
@@ -8,56 +8,170 @@
 #ifndef DIRECTORY_READER_H
 #define DIRECTORY_READER_H
 
-#include "FileAnalyzer.h"
+#include "FileTable.h"
+#include "PathArena.h"
 #include <vector>
 #include <string>
 #include <unordered_set>
+#include <atomic>
+#include <sys/stat.h>
 
 
+class Snapshot;
+class HardLinkSet;
+class PathFilter;
+class MountTable;
+class LargestEntries;
+
+// Identifies one version of a directory. As long as none of it changes, neither does the list of entries.
+struct DirectoryStamp {
+    uint64_t dev = 0;               // The device the directory is on
+    uint64_t ino = 0;               // The directory's inode number
+    int64_t mtimeSec = 0;           // When an entry was last added, removed or renamed
+    uint32_t mtimeNsec = 0;
+    int64_t ctimeSec = 0;           // When the directory's inode last changed
+    uint32_t ctimeNsec = 0;
+
+    bool operator==(const DirectoryStamp &other) const;
+};
+
+// A sub-directory found by a read, with what reading it in turn needs from its parent
+struct ChildDirectory {
+    uint32_t node;                  // The sub-directory's node in the arena
+    int fd;                         // A descriptor opened ahead of time, or -1
+    uint32_t baseline;              // The sub-directory in the baseline snapshot, or PathArena::NO_PARENT if new
+    uint32_t filterState;           // Where the sub-directory is in the filter's globs
+    uint32_t mount;                 // The mount in ScanOptions::mounts the sub-directory is on
+};
+
+// Settings shared by every DirectoryReader taking part in a scan
+struct ScanOptions {
+    // The statx fields requested for each entry. STATX_TYPE is always needed to tell
+    // files from directories, anything else should only be asked for if a report uses it.
+    unsigned int statxMask = STATX_TYPE | STATX_MODE | STATX_SIZE;
+
+    // Classify entries from dirent::d_type and only stat the ones the filesystem
+    // reports as DT_UNKNOWN. Used when the requested reports only need names.
+    bool lazyStat = false;
+
+    // Stat entries and open sub-directories in batches through io_uring instead of one
+    // blocking call at a time. Falls back to the synchronous calls if io_uring is unavailable.
+    bool asyncStat = false;
+
+    // The most sub-directories that may be held open ahead of being read, across the whole scan.
+    // Only used where io_uring is, and should stay well below RLIMIT_NOFILE.
+    unsigned int maxOpenDirectories = 0;
+
+    // Record each directory's DirectoryStamp, needed to save a snapshot or to compare against one
+    bool recordStamps = false;
+
+    // A previous scan of the same tree. Directories whose stamp still matches it aren't read
+    // again, their entries are taken from the snapshot and only their sub-directories are visited.
+    const Snapshot *baseline = nullptr;
+
+    // Counts every file with more than one link once, in the directory DirectoryRegistry::chargeHardLinks()
+    // picks for it. Needs STATX_NLINK and STATX_INO in statxMask. Without it every link adds to the totals.
+    HardLinkSet *hardLinks = nullptr;
+
+    // The include and exclude globs. Sub-directories they leave out are never opened.
+    PathFilter *filter = nullptr;
+
+    // The mounts below the root. Pseudo filesystems among them are skipped, and the rest are
+    // read the way their MountStrategy says. Without it everything is read the same way.
+    const MountTable *mounts = nullptr;
+
+    // Keeps the largest files as they are read. Files with several links are offered once they are charged.
+    LargestEntries *largest = nullptr;
+
+    // Keep a row for every file. Without it only the totals are kept, for reports that don't list files.
+    bool listFiles = true;
+
+    // Only visit sub-directories on the given device, the one the root is on
+    bool oneFileSystem = false;
+    uint64_t device = 0;
+};
+
 class DirectoryReader {
     public:
-        // A list of directories to skip (set to skip /mnt/ by default so if the program is
-        // running on the linux subsystem for windows, it doesn't try to read the windows file system)
-        const std::vector<std::string> SKIP_DIRECTORIES = {"/mnt/"};
+        // The size of the buffer each worker uses to read directory entries in batches
+        static const size_t DIRENT_BUFFER_SIZE = 64 * 1024;
 
         DirectoryReader();
-        DirectoryReader(const std::string &dirPath);
-        DirectoryReader(const std::string &dirPath, const std::string &parent);
+        DirectoryReader(PathArena &pathArena, uint32_t dirNode);
+        DirectoryReader(PathArena &pathArena, const ChildDirectory &found);
+        DirectoryReader(const DirectoryReader &other) = delete;
+        DirectoryReader(DirectoryReader &&other) = default;
         ~DirectoryReader();
 
+        // Sets the options used by every DirectoryReader during a scan.
+        static void setScanOptions(const ScanOptions &options);
+
         // Reads the directory specified in the constructor.
         int readDirectory();
 
-        // Adds to the total size of all files and sub-directories in the directory specified in the constructor.
-        void addToTotalSize(double size);
+        // Takes the sub-directories that were read, in the order of getDirectories(). The caller owns their descriptors.
+        std::vector<ChildDirectory> takeChildren();
 
-        // Adds to the total size of all sub-directories in the directory specified in the constructor.
-        void addToSubDirTotalSize(double size);
+        // Tells the reader the sub-directories it had the last time it was read. The ones still there
+        // keep their nodes, so everything read below them stays attached.
+        void setPreviousDirectories(const std::vector<uint32_t>& previous);
+
+        // Takes the sub-directories that weren't there the last time, when setPreviousDirectories() was used.
+        std::vector<uint32_t> takeAddedDirectories();
+
+        // Stores the rolled-up totals once every sub-directory below this one has been read.
+        void setSubtreeTotals(uint64_t subDirSize, uint64_t subDirAllocated, uint64_t subtreeFileCount,
+                              uint64_t subtreeDirCount);
+
+        // Adds a file with other links to the directory's own totals once it is charged with it, or takes it out.
+        void chargeLinkedFile(uint64_t size, uint64_t allocated, bool charge);
+
+        // Adds a file with other links charged somewhere below the directory to its totals, or takes it out.
+        void chargeSubtree(uint64_t size, uint64_t allocated, bool charge);
+
+        // Drops the rows of the files, keeping the totals and the most common extension. Only the
+        // getters that don't take a file index may be used afterwards.
+        void releaseFiles();
 
         // Checks if the directory specified in the constructor can be read.
         int canReadDirectory() const;
 
-        // Compares two DirectoryReader objects
-        DirectoryReader& operator=(const DirectoryReader& other);
+        // Readers own the descriptors opened ahead of time, so they are moved and never copied
+        DirectoryReader& operator=(const DirectoryReader& other) = delete;
+
+        // Moves one DirectoryReader object into another without copying its files
+        DirectoryReader& operator=(DirectoryReader&& other) = default;
 
         //
         //  Getters
         //
 
         // Retrieves a list of files in the directory specified in the constructor.
-        std::vector<FileAnalyzer> getFiles() const;
+        const FileTable& getFiles() const;
 
-        // Retrieves a list of sub-directories in the directory specified in the constructor.
-        std::vector<std::string> getDirectories() const;
+        // Retrieves the name of one file in the directory specified in the constructor.
+        std::string_view getFileName(size_t index) const;
+
+        // Retrieves the size of one file in the directory specified in the constructor.
+        uint64_t getFileSize(size_t index) const;
+
+        // Retrieves the bytes allocated on disk to one file in the directory specified in the constructor.
+        uint64_t getFileAllocatedSize(size_t index) const;
+
+        // Retrieves the arena nodes of the sub-directories in the directory specified in the constructor.
+        const std::vector<uint32_t>& getDirectories() const;
 
         // Retrieves the path of the directory specified in the constructor.
         std::string getPath() const;
 
-        // Retrieves the path of the parent directory.
-        std::string getParentPath() const;
+        // Retrieves the arena node of the directory specified in the constructor.
+        uint32_t getNode() const;
+
+        // Retrieves the arena node of the parent directory.
+        uint32_t getParentNode() const;
 
         // Retrieves the most common file extension in the directory specified in the constructor.
-        std::string getTopFileExtension() const;
+        std::string_view getTopFileExtension() const;
 
         // Retrieves the average size of all files in the directory specified in the constructor.
         double getAverageFileSize() const;
@@ -65,21 +179,98 @@ class DirectoryReader {
         // Retrieves the average size of all sub-directories in the directory specified in the constructor.
         double getAverageDirectorySize() const;
 
-        // Retrieves the total size of all files in the directory specified in the constructor.
-        double getTotalSize() const;
+        // Retrieves the total size of all files in the directory specified in the constructor and below it.
+        uint64_t getTotalSize() const;
+
+        // Retrieves the size of the files directly in the directory specified in the constructor.
+        uint64_t getFileTotalSize() const;
+
+        // Retrieves the bytes allocated on disk to the directory specified in the constructor and everything below it.
+        uint64_t getAllocatedSize() const;
+
+        // Retrieves the bytes allocated on disk to the files directly in the directory specified in the constructor.
+        uint64_t getFileAllocatedSize() const;
 
         // Retrieves the number of files in the directory specified in the constructor.
         int getNumFiles() const;
 
+        // Retrieves the number of files in the directory specified in the constructor and below it.
+        uint64_t getSubtreeFileCount() const;
+
+        // Retrieves the number of directories below the directory specified in the constructor.
+        uint64_t getSubtreeDirCount() const;
+
+        // Retrieves the stamp of the directory, if the scan records them.
+        const DirectoryStamp& getStamp() const;
+
+        // Retrieves where the directory is in the filter's globs.
+        uint32_t getFilterState() const;
+
+        // Retrieves the mount in scanOptions.mounts the directory is on.
+        uint32_t getMount() const;
+
+        // Checks if the entries were taken from the baseline snapshot instead of being read.
+        bool wasReused() const;
+
     private:
-        std::string path;                       // The path to the current directory to be searched
-        std::string parentPath;                 // The path to the parent directory
-        std::vector<FileAnalyzer> files;        // A list of files in the current directory
-        std::vector<std::string> directories;   // A list of sub-directories in the current directory
-        double totalSize;                       // The size of all files and sub-directories in the current directory
-        double fileTotalSize;                   // The size of all files in the current directory
-        double subDirTotalSize;                 // The size of all sub-directories in the current directory
+        static ScanOptions scanOptions;         // The options shared by every reader in the scan
+
+        PathArena *arena;                       // The arena holding the directory tree
+        uint32_t node;                          // The current directory's node in the arena
+        FileTable files;                        // A table of the files in the current directory
+        std::vector<uint32_t> directories;      // The arena nodes of the sub-directories in the current directory
+        std::vector<ChildDirectory> children;   // What reading each sub-directory needs, until takeChildren()
+        int openFd;                             // A descriptor for the current directory opened ahead of time, or -1
+        uint32_t baselineDir;                   // The current directory in the baseline snapshot, or PathArena::NO_PARENT
+        uint32_t filterState;                   // Where the current directory is in the filter's globs
+        uint32_t mount;                         // The mount the current directory is on
+        const std::vector<uint32_t>* mountsHere;    // Mounts on sub-directories of the current directory, while reading
+        std::vector<uint32_t> previousDirectories;  // The sub-directories from the last read, sorted by name
+        std::vector<uint32_t> addedDirectories;     // The sub-directories that weren't in previousDirectories
+        bool rereading;                         // Whether setPreviousDirectories() was called
+        DirectoryStamp stamp;                   // The current directory's device, inode and times
+        bool reused;                            // Whether the entries came from the baseline snapshot
+        uint64_t totalSize;                     // The size of all files and sub-directories in the current directory
+        uint64_t fileTotalSize;                 // The size of all files in the current directory
+        uint64_t subDirTotalSize;               // The size of all sub-directories in the current directory
+        uint64_t allocatedSize;                 // The bytes allocated to the current directory's files and everything below
+        uint64_t fileAllocatedSize;             // The bytes allocated to the files in the current directory
         int numFiles;                           // The number of files in the current directory
+        uint64_t subtreeFileCount;              // The number of files in the current directory and below it
+        uint64_t subtreeDirCount;               // The number of directories below the current directory
+        uint32_t releasedExtension;             // The most common extension once the files were released, or NO_EXTENSION
+
+        static const uint32_t NO_EXTENSION = UINT32_MAX;    // Stands for "the files weren't released"
+
+        // Builds the full path of an entry inside a directory
+        static std::string childPath(const std::string& path, const char* name);
+
+        // Finds the most common extension among the files' rows
+        uint32_t findTopExtension() const;
+
+        // Returns the node of a sub-directory, the one it had before if it was in previousDirectories
+        uint32_t directoryNode(std::string_view name);
+
+        // Adds a file to the table and, unless it has other links, to the totals
+        void addFile(std::string_view name, mode_t mode, uint64_t size, uint64_t allocated, uint64_t linkedInode,
+                     uint64_t dev);
+
+        // Opens a batch of sub-directories ahead of time, as far as the open directory budget allows
+        void openDirectoriesAhead(int dirFd, const std::vector<const char*>& names, size_t firstDirectory);
+
+        // Closes any sub-directory descriptors that were opened ahead of time and gives them back to the budget
+        void closeDirectoryFds();
+
+        // Fills the directory in from the baseline snapshot instead of reading it
+        void reuseBaseline();
+
+        // Finds the baseline snapshot directory of each sub-directory that was read
+        void matchBaselines();
+
+        // Checks if a sub-directory should be visited, and gives it a node and a child entry if so
+        bool keepDirectory(std::string_view name, uint64_t dev, uint32_t baseline);
+
+        static std::atomic<unsigned int> openDirectories;   // Sub-directories currently held open ahead of being read
 };
 
 #endif
@@ -0,0 +1,133 @@
+/******************************************************************************
+ * File: DirectoryRegistry.h
+ * Description: Holds every directory the scan has finished reading, indexed
+ *              by its node in the PathArena so workers can add results
+ *              without a global lock. It also rolls sizes up the tree: every
+ *              directory counts the children it is still waiting on, and the
+ *              last child to finish folds the directory into its parent.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef DIRECTORY_REGISTRY_H
+#define DIRECTORY_REGISTRY_H
+
+#include "DirectoryReader.h"
+#include "DirectorySource.h"
+#include "PathArena.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+class HardLinkSet;
+class LargestEntries;
+class ScanStream;
+
+class DirectoryRegistry : public DirectorySource {
+    public:
+        DirectoryRegistry(const PathArena &arena);
+        ~DirectoryRegistry();
+
+        DirectoryRegistry(const DirectoryRegistry&) = delete;
+        DirectoryRegistry& operator=(const DirectoryRegistry&) = delete;
+
+        // Moves a read directory into its slot. Only the worker that read the directory may call this,
+        // and it has to call finishDirectory() once it has submitted the sub-directories.
+        void insert(DirectoryReader&& dir);
+
+        // Records a directory that couldn't be read, so its parent isn't left waiting on it
+        void insertFailed(uint32_t node);
+
+        // Drops the directory's hold on its own totals. Whoever brings the waiting count of a
+        // directory to zero folds it into its parent, all the way up to the root.
+        void finishDirectory(uint32_t node);
+
+        // Offers every directory to the largest directories once its totals are final
+        void setLargestEntries(LargestEntries *largestEntries);
+
+        // Writes every directory to the stream once its totals are final, then lets go of it. Only the files'
+        // totals are kept after a directory is inserted, and nothing once it's finished.
+        void setStream(ScanStream *scanStream);
+
+        // Charges the files with several links in hardLinkSet, and keeps it current as directories are replaced or erased
+        void setHardLinks(HardLinkSet *hardLinkSet);
+
+        // Charges every file with several links that changed since the last call to the linking directory with the
+        // smallest path, and adds it to the totals above that directory. Called once the scan and every watch batch is done.
+        void chargeHardLinks();
+
+        //
+        //  Patching a finished scan, used by the watch mode. None of these may run during a scan.
+        //
+
+        // Swaps a directory that was read again into its slot. Its totals are left for refreshTotals().
+        void replace(DirectoryReader&& dir);
+
+        // Takes a directory and everything below it out of the registry
+        void erase(uint32_t node);
+
+        // Recomputes the totals of a directory from its children's, then those of every directory above it
+        void refreshTotals(uint32_t node);
+
+        // Checks if a directory has been inserted
+        bool contains(uint32_t node) const override;
+
+        // Retrieves a directory that has been inserted
+        DirectoryReader& get(uint32_t node);
+        const DirectoryReader& get(uint32_t node) const;
+
+        //
+        //  DirectorySource, answered from the inserted directories
+        //
+
+        std::string getPath(uint32_t node) const override;
+        std::string_view getName(uint32_t node) const override;
+        void appendPath(uint32_t node, std::string &out) const override;
+        DirectoryList getDirectories(uint32_t node) const override;
+        size_t getDirectoryCount(uint32_t node) const override;
+        size_t getFileCount(uint32_t node) const override;
+        std::string_view getFileName(uint32_t node, size_t file) const override;
+        uint64_t getFileSize(uint32_t node, size_t file) const override;
+        uint64_t getFileAllocatedSize(uint32_t node, size_t file) const override;
+        uint64_t getTotalSize(uint32_t node) const override;
+        uint64_t getAllocatedSize(uint32_t node) const override;
+        uint64_t getSubtreeDirCount(uint32_t node) const override;
+        double getAverageDirectorySize(uint32_t node) const override;
+        double getAverageFileSize(uint32_t node) const override;
+        std::string_view getTopFileExtension(uint32_t node) const override;
+
+    private:
+        // One directory, whether it has been filled in yet and the totals of its finished children. The
+        // directory itself lives on the heap, so a slot that was never filled in or was let go stays small.
+        struct Slot {
+            std::unique_ptr<DirectoryReader> dir;       // The finished directory
+            std::atomic<bool> ready{false};             // Set once dir has been moved in
+            std::atomic<uint32_t> pendingChildren{0};   // Children still being scanned, plus one for the directory itself
+            std::atomic<uint64_t> childBytes{0};        // The total size of every finished child's subtree
+            std::atomic<uint64_t> childAllocated{0};    // The bytes allocated to every finished child's subtree
+            std::atomic<uint64_t> childFiles{0};        // The number of files in every finished child's subtree
+            std::atomic<uint64_t> childDirs{0};         // The number of directories in every finished child's subtree
+        };
+
+        static const size_t SLOTS_PER_CHUNK = 16 * 1024;                        // Slots are allocated this many at a time
+        static const size_t MAX_CHUNKS = (size_t(UINT32_MAX) + 1) / SLOTS_PER_CHUNK; // Enough chunks for every arena node
+
+        // Returns the slot for a node, allocating its chunk if needed
+        Slot& slotFor(uint32_t node);
+
+        // Returns the slot for a node, or nullptr if its chunk doesn't exist
+        const Slot* findSlot(uint32_t node) const;
+
+        // Lets go of the links of a directory whose reader is going away, current is the one replacing it, if any
+        void releaseLinks(uint32_t node, const DirectoryReader &old, const DirectoryReader *current);
+
+        // Adds a charged file to a directory and every directory above it, or takes it back out
+        void chargeUp(uint32_t node, uint64_t size, uint64_t allocated, bool charge);
+
+        const PathArena &arena;                         // Knows every directory's parent
+        LargestEntries *largest;                        // Gets every directory's final totals, if set
+        ScanStream *stream;                             // Writes every finished directory, if set
+        HardLinkSet *hardLinks;                         // The files with several links, if they are counted once
+        std::unique_ptr<std::atomic<Slot*>[]> chunks;   // The slot chunks, allocated as they are needed
+};
+
+#endif
@@ -0,0 +1,137 @@
+/******************************************************************************
+ * File: DirectorySource.h
+ * Description: A read-only view of a finished scan. Reports are generated
+ *              from it, so they work the same on directories that were just
+ *              scanned and on directories loaded from a snapshot.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef DIRECTORY_SOURCE_H
+#define DIRECTORY_SOURCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The sub-directories of a directory, read in place instead of copied. A scan keeps them in an
+// array, a snapshot as the first one plus a table saying where each directory's next sibling is.
+// Its iterators point back at it, so they are only good for as long as the list itself.
+class DirectoryList {
+    public:
+        class Iterator {
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = uint32_t;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const uint32_t*;
+                using reference = uint32_t;
+
+                Iterator(const DirectoryList *list, size_t index, uint32_t node) : list(list), index(index), node(node) {}
+
+                uint32_t operator*() const { return node; }
+                Iterator& operator++() { node = list->after(++index, node); return *this; }
+                bool operator==(const Iterator &other) const { return index == other.index; }
+                bool operator!=(const Iterator &other) const { return index != other.index; }
+
+            private:
+                const DirectoryList *list;      // The list being walked
+                size_t index;                   // How many sub-directories came before this one
+                uint32_t node;                  // The current sub-directory
+        };
+
+        // Sub-directories stored one after another
+        DirectoryList(const std::vector<uint32_t> &nodes)
+            : nodes(nodes.data()), count(nodes.size()), first(0), siblings(nullptr), stride(0) {}
+
+        // Sub-directories linked through a table of records stride bytes apart, each one's next sibling
+        // at siblings + node * stride
+        DirectoryList(uint32_t first, size_t count, const char *siblings, size_t stride)
+            : nodes(nullptr), count(count), first(first), siblings(siblings), stride(stride) {}
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        Iterator begin() const { return Iterator(this, 0, after(0, first)); }
+        Iterator end() const { return Iterator(this, count, 0); }
+
+    private:
+        // Returns the sub-directory at index, given the one before it
+        uint32_t after(size_t index, uint32_t previous) const {
+            if (index >= count) {
+                return 0;
+            }
+            if (nodes != nullptr) {
+                return nodes[index];
+            }
+            if (index == 0) {
+                return first;
+            }
+            uint32_t next;
+            std::memcpy(&next, siblings + size_t(previous) * stride, sizeof(next));
+            return next;
+        }
+
+        const uint32_t *nodes;          // The array, or nullptr for a linked list
+        size_t count;                   // The number of sub-directories
+        uint32_t first;                 // The first linked sub-directory
+        const char *siblings;           // Where the first record's next sibling is
+        size_t stride;                  // The size of a record
+};
+
+class DirectorySource {
+    public:
+        virtual ~DirectorySource() = default;
+
+        // Checks if a directory was read and can be reported on
+        virtual bool contains(uint32_t dir) const = 0;
+
+        // Retrieves the full path of a directory
+        virtual std::string getPath(uint32_t dir) const = 0;
+
+        // Retrieves the name of a directory, the full path for the root
+        virtual std::string_view getName(uint32_t dir) const = 0;
+
+        // Appends the full path of a directory to out, so a report can reuse one buffer for every line
+        virtual void appendPath(uint32_t dir, std::string &out) const = 0;
+
+        // Retrieves the sub-directories of a directory, valid until the directory changes
+        virtual DirectoryList getDirectories(uint32_t dir) const = 0;
+
+        // Retrieves the number of sub-directories found in a directory, including ones that couldn't be read
+        virtual size_t getDirectoryCount(uint32_t dir) const = 0;
+
+        // Retrieves the number of files in a directory
+        virtual size_t getFileCount(uint32_t dir) const = 0;
+
+        // Retrieves the name of one of a directory's files
+        virtual std::string_view getFileName(uint32_t dir, size_t file) const = 0;
+
+        // Retrieves the size of one of a directory's files
+        virtual uint64_t getFileSize(uint32_t dir, size_t file) const = 0;
+
+        // Retrieves the bytes allocated on disk to one of a directory's files
+        virtual uint64_t getFileAllocatedSize(uint32_t dir, size_t file) const = 0;
+
+        // Retrieves the total size of a directory and everything below it
+        virtual uint64_t getTotalSize(uint32_t dir) const = 0;
+
+        // Retrieves the bytes allocated on disk to a directory and everything below it
+        virtual uint64_t getAllocatedSize(uint32_t dir) const = 0;
+
+        // Retrieves the number of directories below a directory
+        virtual uint64_t getSubtreeDirCount(uint32_t dir) const = 0;
+
+        // Retrieves the average size of a directory's sub-directories
+        virtual double getAverageDirectorySize(uint32_t dir) const = 0;
+
+        // Retrieves the average size of a directory's files
+        virtual double getAverageFileSize(uint32_t dir) const = 0;
+
+        // Retrieves the most common file extension in a directory
+        virtual std::string_view getTopFileExtension(uint32_t dir) const = 0;
+};
+
+#endif
@@ -8,54 +8,50 @@
 #ifndef FILE_ANALYZER_H
 #define FILE_ANALYZER_H
 
-#include <vector>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <cstdint>
+#include <sys/types.h>
 
+class FileTable;
+
+// A view of one file in a FileTable. The type, permission and extension text
+// is only worked out when something asks for it.
 class FileAnalyzer {
     public:
-        
+
         // Constructors and Destructors
 
-        FileAnalyzer(const std::string &filePath);
-        FileAnalyzer(const std::string &filePath, const std::string &parent);
+        FileAnalyzer(const FileTable &table, size_t index);
         ~FileAnalyzer();
 
 
         // Getters
 
-        std::string getPath() const;
-        std::string getParentPath() const;
-        std::string getFileName() const;
+        std::string_view getFileName() const;
         std::string getFileType() const;
         std::string getFilePermissions() const;
-        std::string getFileExtension() const;
-        double getFileSize() const;
+        std::string_view getFileExtension() const;
+        uint64_t getFileSize() const;
+        uint64_t getAllocatedSize() const;
 
         // Friend function to overload the insertion operator
         friend std::ostream& operator<<(std::ostream& os, const FileAnalyzer& obj);
 
-        // Analyzes the current file
-        void analyzeFile();                         
+        // Finds the extension in a file name
+        static std::string_view extensionOf(std::string_view fileName);
 
     private:
 
         // Variables
 
-        std::string path;                       // The path to the current file to be analyzed
-        std::string parentPath;                 // The path to the parent directory
-        std::string fileName;                   // The name of the current file
-        std::string fileType;                   // The type of the current file
-        std::string filePermissions;            // The permissions of the current file
-        std::string fileExtension;              // The extension of the current file
-        double fileSize;                        // The size of the current file
+        const FileTable *table;                 // The table holding the file
+        size_t index;                           // The file's row in the table
 
 
         // Helper functions
-        void findType(struct stat fileInfo);        // Determines the type of the current file
-        void findPermissions(struct stat fileInfo); // Determines the permissions of the current file
-        void findName();                            // Determines the name of the current file
-        void findExtension();                       // Determines the extension of the current file
+        static std::string findType(mode_t mode);         // Determines the type of a file
+        static std::string findPermissions(mode_t mode);  // Determines the permissions of a file
 
 };
 
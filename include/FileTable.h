@@ -0,0 +1,73 @@
+/******************************************************************************
+ * File: FileTable.h
+ * Description: Stores the files of a directory column by column so each file
+ *              only costs a few integers and its name.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef FILE_TABLE_H
+#define FILE_TABLE_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+#include <sys/types.h>
+
+class FileAnalyzer;
+
+// Gives every distinct file extension a small id that is shared by all directories
+class ExtensionTable {
+    public:
+        // Returns the id of the extension, adding it to the table if it's new
+        static uint32_t intern(std::string_view extension);
+
+        // Returns the extension that belongs to an id
+        static std::string_view lookup(uint32_t id);
+
+    private:
+        static std::deque<std::string> extensions;                          // Every extension seen so far, indexed by id
+        static std::unordered_map<std::string_view, uint32_t> extensionIds; // Maps an extension to its id
+        static std::shared_mutex tableMutex;                                // Guards both containers
+};
+
+class FileTable {
+    public:
+        FileTable();
+        ~FileTable();
+
+        // Adds a file to the table. linkedInode is the inode number if the file has other hard links, 0 otherwise.
+        void addFile(std::string_view name, mode_t mode, uint64_t size, uint64_t allocated = 0, uint64_t linkedInode = 0);
+
+        // Retrieves a view of the file at the given index
+        FileAnalyzer operator[](size_t index) const;
+
+        //
+        //  Getters
+        //
+
+        size_t size() const;
+        bool empty() const;
+        std::string_view getName(size_t index) const;
+        mode_t getMode(size_t index) const;
+        uint64_t getSize(size_t index) const;
+        uint64_t getAllocatedSize(size_t index) const;
+        uint64_t getLinkedInode(size_t index) const;
+        const std::vector<uint64_t>& getLinkedInodes() const;
+        uint32_t getExtensionId(size_t index) const;
+
+    private:
+        std::vector<mode_t> modes;              // The raw mode bits of each file
+        std::vector<uint64_t> sizes;            // The size of each file in bytes
+        std::vector<uint64_t> allocatedSizes;   // The bytes allocated to each file on disk
+        std::vector<uint32_t> linkedRows;       // The rows of files with other hard links, in order
+        std::vector<uint64_t> linkedInodes;     // The inode number of each of those files
+        std::vector<uint32_t> nameOffsets;      // Where each file's name starts in names
+        std::vector<uint32_t> extensionIds;     // The interned extension of each file
+        std::string names;                      // Every file name, each one followed by a '\0'
+};
+
+#endif
@@ -0,0 +1,117 @@
+/******************************************************************************
+ * File: HardLinkSet.h
+ * Description: Remembers every inode with more than one link the scan has
+ *              seen and which directories link to it, so a file reachable
+ *              under several names is only counted once in the totals. The
+ *              set is split into shards with a lock each, so workers adding
+ *              different inodes rarely wait on each other.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef HARD_LINK_SET_H
+#define HARD_LINK_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class HardLinkSet {
+    public:
+        // The number of shards, a power of two
+        static const size_t SHARD_COUNT = 64;
+
+        // The owner of an inode no directory is charged with yet
+        static const uint32_t NO_OWNER = UINT32_MAX;
+
+        // One of the directories linking to an inode
+        struct Link {
+            uint32_t directory;                     // The arena node of the directory
+            std::string name;                       // The link's name, the smallest one if it has several there
+        };
+
+        // An inode with more than one link and the directory whose totals it is counted in
+        struct Inode {
+            uint64_t size;                          // The file's apparent size
+            uint64_t allocated;                     // The bytes allocated to it on disk
+            uint32_t owner;                         // The directory charged with it, or NO_OWNER
+            uint64_t chargedSize;                   // What the owner was charged, size may have changed since
+            uint64_t chargedAllocated;              // What the owner was charged for allocated bytes
+            bool changed;                           // Set when a link or the owner went away, or a link was added
+            std::vector<Link> links;                // Every directory linking to it
+        };
+
+        // With countFirstLink the first directory to add a link counts the inode right away, for a scan
+        // that can't wait for the others. Otherwise DirectoryRegistry::chargeHardLinks() picks the owner.
+        explicit HardLinkSet(bool countFirstLink = false);
+        ~HardLinkSet();
+
+        HardLinkSet(const HardLinkSet&) = delete;
+        HardLinkSet& operator=(const HardLinkSet&) = delete;
+
+        // Records that a directory links to an inode. Returns true if the directory should count the file
+        // now, which only the first link does and only with countFirstLink.
+        bool addLink(uint64_t dev, uint64_t ino, uint32_t directory, std::string_view name, uint64_t size,
+                     uint64_t allocated);
+
+        // Forgets a directory's link to an inode, for a directory that went away or no longer links to it
+        void removeLink(uint64_t dev, uint64_t ino, uint32_t directory);
+
+        // Forgets that a directory was charged with an inode, for a directory whose totals were thrown away
+        void dropCharge(uint64_t dev, uint64_t ino, uint32_t directory);
+
+        // Calls visit with every inode that changed since the last call and clears the flag. Not to be
+        // called while links are being added.
+        template <typename F>
+        void forEachChanged(F &&visit) {
+            for (Shard &shard : shards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (auto it = shard.inodes.begin(); it != shard.inodes.end();) {
+                    Inode &inode = it->second;
+                    if (inode.changed) {
+                        inode.changed = false;
+                        visit(inode);
+                    }
+                    // No directory links to it anymore and nothing is charged with it
+                    if (inode.links.empty() && inode.owner == NO_OWNER) {
+                        it = shard.inodes.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+        }
+
+        // Retrieves the number of inodes seen
+        size_t size() const;
+
+    private:
+        // Identifies one inode on one device
+        struct Key {
+            uint64_t dev;
+            uint64_t ino;
+
+            bool operator==(const Key &other) const { return dev == other.dev && ino == other.ino; }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key &key) const;
+        };
+
+        // One part of the set. Padded to a cache line so neighbouring shards' locks don't share one.
+        struct alignas(64) Shard {
+            mutable std::mutex mutex;                           // Guards inodes
+            std::unordered_map<Key, Inode, KeyHash> inodes;     // Every inode in this shard
+        };
+
+        // Returns the shard an inode belongs to
+        Shard& shardFor(const Key &key);
+
+        bool countFirstLink;                        // Whether the first link counts the inode
+        Shard shards[SHARD_COUNT];
+};
+
+#endif
@@ -0,0 +1,80 @@
+/******************************************************************************
+ * File: LargestEntries.h
+ * Description: Keeps the largest files and directories seen during a scan.
+ *              Every worker thread gets its own pair of bounded heaps, so
+ *              offering an entry never takes a lock shared with the other
+ *              workers, and the heaps are merged once the scan is over.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef LARGEST_ENTRIES_H
+#define LARGEST_ENTRIES_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One file or directory among the largest
+struct LargestEntry {
+    uint64_t size;                  // The apparent size, what entries are ranked by
+    uint64_t allocated;             // The bytes allocated on disk
+    uint32_t dir;                   // The directory itself, or the directory holding the file
+    std::string name;               // The file's name, empty for a directory
+};
+
+class LargestEntries {
+    public:
+        explicit LargestEntries(size_t limit);
+        ~LargestEntries();
+
+        LargestEntries(const LargestEntries&) = delete;
+        LargestEntries& operator=(const LargestEntries&) = delete;
+
+        // Offers a file, kept if it's among the largest this thread has seen
+        void offerFile(uint32_t dir, std::string_view name, uint64_t size, uint64_t allocated);
+
+        // Offers a directory with the total size of everything below it
+        void offerDirectory(uint32_t dir, uint64_t size, uint64_t allocated);
+
+        // Merges every thread's heaps, largest first. Only call once no more entries are offered.
+        std::vector<LargestEntry> getFiles() const;
+        std::vector<LargestEntry> getDirectories() const;
+
+        // Drops the directories offered so far, so they can be offered again with new totals. Only call
+        // once no more entries are offered.
+        void clearDirectories();
+
+        // Retrieves how many files and how many directories are kept
+        size_t getLimit() const;
+
+    private:
+        // One thread's heaps. Padded to a cache line so two threads never write to the same one.
+        struct alignas(64) Heaps {
+            std::vector<LargestEntry> files;        // Min-heap of the largest files
+            std::vector<LargestEntry> directories;  // Min-heap of the largest directories
+        };
+
+        // Returns the calling thread's heaps, adding them the first time
+        Heaps& heapsForThisThread();
+
+        // Adds an entry to a heap if it's larger than the smallest one kept
+        void push(std::vector<LargestEntry> &heap, uint64_t size, uint64_t allocated, uint32_t dir,
+                  std::string_view name) const;
+
+        // Merges one heap from every thread
+        std::vector<LargestEntry> merge(std::vector<LargestEntry> Heaps::*heap) const;
+
+        size_t limit;                               // How many of each are kept
+        uint64_t id;                                // Tells instances apart in the threads' caches
+        mutable std::mutex heapsMutex;              // Guards heaps, only taken once by each thread
+        std::vector<std::unique_ptr<Heaps>> heaps;  // Every thread's heaps
+
+        static std::atomic<uint64_t> nextId;        // The id of the next instance
+};
+
+#endif
@@ -0,0 +1,84 @@
+/******************************************************************************
+ * File: MountTable.h
+ * Description: Reads the mounts below the scanned root from
+ *              /proc/self/mountinfo and picks how each of them is scanned:
+ *              pseudo filesystems like /proc and /sys are skipped, network
+ *              and FUSE filesystems are stat-ed in batches, and d_type is only
+ *              trusted where the filesystem fills it in reliably.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef MOUNT_TABLE_H
+#define MOUNT_TABLE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// How the directories on one mount are read
+struct MountStrategy {
+    bool skip = false;              // Leave the mount out, it holds no files worth counting
+    bool asyncStat = false;         // Stat and open through io_uring even without --async-stat
+    bool trustDType = true;         // In lazy mode, classify entries from d_type instead of stat-ing them
+};
+
+// One line of /proc/self/mountinfo
+struct Mount {
+    std::string path;               // Where it is mounted, as the scan spells it
+    std::string fsType;             // The filesystem type, such as ext4, nfs4 or proc
+    MountStrategy strategy;         // How it is read
+};
+
+class MountTable {
+    public:
+        // Stands for "no mount found"
+        static const uint32_t NO_MOUNT = UINT32_MAX;
+
+        MountTable();
+        ~MountTable();
+
+        MountTable(const MountTable&) = delete;
+        MountTable& operator=(const MountTable&) = delete;
+
+        // Reads the mount table. root is the scanned root as given and realRoot its real path.
+        // Returns false, leaving the table empty, if the mount table can't be read.
+        bool load(const std::string &root, const std::string &realRoot,
+                  const std::string &mountInfo = "/proc/self/mountinfo");
+
+        // Returns the strategy for a filesystem type
+        static MountStrategy strategyFor(const std::string &fsType);
+
+        // Retrieves the mount the root is on, NO_MOUNT if the table is empty
+        uint32_t getRootMount() const;
+
+        // Retrieves a mount
+        const Mount& getMount(uint32_t index) const;
+
+        // Retrieves the strategy of a mount, the default one for NO_MOUNT
+        const MountStrategy& getStrategy(uint32_t index) const;
+
+        // Retrieves the mounts on sub-directories of a directory, nullptr if there are none
+        const std::vector<uint32_t>* mountsIn(const std::string &path) const;
+
+        // Finds the mount on one of those sub-directories by name, NO_MOUNT if it isn't a mount point
+        uint32_t findMount(const std::vector<uint32_t> &candidates, std::string_view name) const;
+
+        // Returns true the first time it's called for a mount, so each skipped mount is reported once
+        bool firstSkip(uint32_t index) const;
+
+    private:
+        // Undoes the octal escapes mountinfo uses for spaces, tabs, newlines and backslashes
+        static std::string unescape(const std::string &field);
+
+        std::vector<Mount> mounts;                                      // Every mount, in mountinfo order
+        std::unordered_map<std::string, std::vector<uint32_t>> children; // The mounts below each directory
+        uint32_t rootMount;                                             // The mount holding the root
+        std::unique_ptr<std::atomic<bool>[]> reported;                  // Whether each mount was reported skipped
+        MountStrategy defaultStrategy;                                  // For directories on no known mount
+};
+
+#endif
@@ -0,0 +1,95 @@
+/******************************************************************************
+ * File: OutputSink.h
+ * Description: Collects report output in large buffers and writes them from a
+ *              thread of its own, so formatting never waits on the disk or
+ *              the terminal and every write is a big one.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+class OutputSink {
+    public:
+        // Output is handed to the writer this many bytes at a time
+        static const size_t BUFFER_SIZE = 1024 * 1024;
+
+        // The buffer being filled plus the ones waiting to be written, the caller waits once they are all in use
+        static const size_t BUFFER_COUNT = 8;
+
+        // Buffers start on a page boundary so they can be written with O_DIRECT
+        static const size_t ALIGNMENT = 4096;
+
+        OutputSink();
+        ~OutputSink();
+
+        OutputSink(const OutputSink&) = delete;
+        OutputSink& operator=(const OutputSink&) = delete;
+
+        // Writes to the console
+        bool openConsole();
+
+        // Writes to a file, replacing it. With directIO set the page cache is bypassed where the filesystem allows it.
+        bool openFile(const std::string &fileName, bool directIO = false);
+
+        // Appends bytes. Only one thread may write to a sink at a time.
+        void write(const char *data, size_t length);
+        void write(std::string_view text);
+        void put(char c);
+
+        // Appends a number, right aligned in width characters if it is shorter
+        void writeNumber(uint64_t value, size_t width = 0);
+
+        // Writes everything that is left and waits for the writer. Returns false if anything couldn't be written.
+        bool close();
+
+        //
+        //  Formatting
+        //
+
+        // Appends a number to a string without going through a stream or a temporary string
+        static void appendNumber(std::string &out, uint64_t value);
+
+        // Appends a double the way an ostream prints it by default, like printf's %g
+        static void appendDouble(std::string &out, double value);
+
+    private:
+        // Allocates the buffers and starts the writer once fd is open
+        bool start();
+
+        // Hands the current buffer to the writer and waits for an empty one
+        void handOver();
+
+        // The writer thread, writes the buffers in the order they were handed over until closed
+        void writeBuffers();
+
+        // Writes a whole buffer to the descriptor. Returns false on an error.
+        bool writeAll(const char *data, size_t length);
+
+        int fd;                                     // Where the output goes, -1 until opened
+        bool ownsFd;                                // Set if fd was opened here and has to be closed
+        bool direct;                                // Set if fd was opened with O_DIRECT
+        char *memory;                               // Every buffer, BUFFER_COUNT of them back to back
+        size_t current;                             // The buffer being filled
+        size_t used;                                // Bytes in the buffer being filled
+        std::thread writer;                         // Writes the full buffers
+
+        std::mutex mutex;                           // Guards everything below
+        std::condition_variable bufferFull;         // Wakes the writer when there is a buffer or it's closing
+        std::condition_variable bufferFree;         // Wakes the caller waiting for an empty buffer
+        std::deque<std::pair<size_t, size_t>> full; // Buffers waiting to be written, with their sizes
+        std::deque<size_t> empty;                   // Buffers that can be filled
+        bool closing;                               // Set by close(), the writer stops once everything is written
+        bool failed;                                // Set if a write failed, later output is dropped
+};
+
+#endif
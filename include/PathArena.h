@@ -0,0 +1,78 @@
+/******************************************************************************
+ * File: PathArena.h
+ * Description: Stores the directory tree as nodes that only know their parent
+ *              and their own name, so full paths are only built when printed.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef PATH_ARENA_H
+#define PATH_ARENA_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class PathArena {
+    public:
+        // The parent index of the root node
+        static const uint32_t NO_PARENT = UINT32_MAX;
+
+        PathArena();
+        ~PathArena();
+
+        PathArena(const PathArena&) = delete;
+        PathArena& operator=(const PathArena&) = delete;
+
+        // Adds a node to the tree and returns its index. Safe to call from any thread.
+        uint32_t addNode(uint32_t parent, std::string_view name);
+
+        //
+        //  Getters
+        //
+
+        // Retrieves the index of a node's parent
+        uint32_t getParent(uint32_t node) const;
+
+        // Retrieves the name of a node
+        std::string_view getName(uint32_t node) const;
+
+        // Rebuilds the full path of a node from its ancestors' names
+        std::string getPath(uint32_t node) const;
+
+        // Appends the full path of a node to out without allocating anything else
+        void appendPath(uint32_t node, std::string &out) const;
+
+        // Retrieves the number of nodes in the tree
+        size_t size() const;
+
+    private:
+        // One directory in the tree
+        struct Node {
+            uint32_t parent;                    // The index of the parent node
+            uint32_t nameLength;                // The length of the name
+            const char *name;                   // The name, stored in the string pool
+        };
+
+        static const size_t NODES_PER_CHUNK = 64 * 1024;    // Nodes are allocated this many at a time
+        static const size_t MAX_CHUNKS = 64 * 1024;         // Enough chunks for every 32 bit index
+        static const size_t POOL_BLOCK_SIZE = 256 * 1024;   // Names are bump allocated from blocks this big
+
+        // Returns the node at an index
+        Node& nodeAt(uint32_t node) const;
+
+        // Copies a name into the string pool and returns where it was put
+        const char* storeName(std::string_view name);
+
+        std::unique_ptr<std::atomic<Node*>[]> chunks;   // The node chunks, allocated as they are needed
+        std::atomic<uint32_t> nodeCount;                // The number of nodes handed out so far
+        uint64_t arenaId;                               // Tells this arena's pool blocks apart from other arenas'
+
+        std::vector<std::unique_ptr<char[]>> poolBlocks;    // Every block the string pool has allocated
+        std::mutex poolMutex;                               // Guards poolBlocks
+};
+
+#endif
@@ -0,0 +1,125 @@
+/******************************************************************************
+ * File: PathFilter.h
+ * Description: Decides which directories and files the scan visits, from
+ *              include and exclude globs. The globs are compiled once into a
+ *              trie of path components, and every directory carries a small
+ *              state id saying where its path is in that trie, so checking an
+ *              entry only ever looks at its own name, never its full path.
+ * Author: Robert Tetreault
+ *
+ * Globs are matched one path component at a time:
+ *      name            A name on its own matches at any depth (node_modules, *.o)
+ *      /a/b            A leading '/' matches from the filesystem root
+ *      a/b             Anything else with a '/' matches from the scanned root
+ *      *, ?, [...]     Match within one component
+ *      **              Matches any number of components, including none
+ ******************************************************************************/
+
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class PathFilter {
+    public:
+        // The state of a directory that must not be visited
+        static const uint32_t SKIP = UINT32_MAX;
+
+        // Excluded by default: the Windows drives under the Linux subsystem for Windows
+        static const std::vector<std::string> DEFAULT_EXCLUDES;
+
+        PathFilter();
+        ~PathFilter();
+
+        PathFilter(const PathFilter&) = delete;
+        PathFilter& operator=(const PathFilter&) = delete;
+
+        // Adds a glob, before the scan starts. Directories and files matching an exclude are skipped. If there are any
+        // includes, only files matching one of them, or below a directory matching one, are kept.
+        // root is the real path of the scanned root, for globs relative to it.
+        void addExclude(const std::string &glob, const std::string &root);
+        void addInclude(const std::string &glob, const std::string &root);
+
+        // Returns the state of the scanned root. Globs can't exclude the root itself.
+        uint32_t rootState(const std::string &root);
+
+        // Returns the state of a sub-directory, or SKIP if it is excluded or nothing below it can be included
+        uint32_t enterDirectory(uint32_t state, std::string_view name);
+
+        // Checks if a file in a directory with the given state is kept
+        bool acceptsFile(uint32_t state, std::string_view name) const;
+
+    private:
+        static const uint32_t NO_NODE = UINT32_MAX;
+        static const uint32_t UNKNOWN = UINT32_MAX - 1;    // A state that hasn't been worked out yet
+        static const uint8_t EXCLUDE = 1;       // An exclude glob ends at the node
+        static const uint8_t INCLUDE = 2;       // An include glob ends at the node
+
+        // A component with wildcards. "*.ext" is common enough to be checked as a plain suffix.
+        struct Glob {
+            std::string pattern;                // The component, for fnmatch()
+            std::string suffix;                 // What follows the '*' if the pattern is "*" and plain text
+            bool suffixOnly;                    // Whether suffix is all there is to check
+            uint32_t child;                     // The node it leads to
+        };
+
+        // One component of one or more globs
+        struct Node {
+            std::unordered_map<std::string, uint32_t> literals;    // Children matching a plain name
+            std::vector<Glob> globs;                                // Children matching a wildcard
+            uint32_t anyDepth = NO_NODE;                            // The "**" child
+            bool repeats = false;                                   // Whether this node is a "**"
+            bool leadsToInclude = false;                            // Whether an include ends here or below
+            uint8_t ends = 0;                                       // The globs that end here
+        };
+
+        // Where a directory's path is in the trie. Never changes once its id is handed out.
+        struct State {
+            std::vector<uint32_t> nodes;        // Sorted, with the "**" nodes reachable from them
+            bool included = false;              // The directory or one above it matched an include
+            mutable std::atomic<uint32_t> otherwise{UNKNOWN};   // The state of a name no glob matches, or SKIP
+        };
+
+        static const size_t STATES_PER_CHUNK = 256;                 // States are allocated this many at a time
+        static const size_t MAX_CHUNKS = 64 * 1024;                 // More states than any set of globs needs
+
+        // Adds a glob to the trie
+        void addGlob(const std::string &glob, const std::string &root, uint8_t kind);
+
+        // Adds the "**" nodes reachable without consuming a component, then sorts
+        void close(std::vector<uint32_t> &reached) const;
+
+        // Moves every node over one path component. Returns true if anything other than a "**" matched it.
+        bool step(const std::vector<uint32_t> &from, std::string_view name, std::vector<uint32_t> &to) const;
+
+        // Checks if any of the nodes ends a glob of the given kind
+        uint8_t endsAt(const std::vector<uint32_t> &reached) const;
+
+        // Returns the id of the state for a set of nodes, adding it if it's new
+        uint32_t intern(std::vector<uint32_t> &&reached, bool included);
+
+        // Returns a state by id
+        const State& getState(uint32_t id) const;
+
+        // Splits a path into its components
+        static std::vector<std::string> components(const std::string &path);
+
+        std::vector<Node> nodes;                // The trie, node 0 is the filesystem root
+        bool hasIncludes;                       // Whether any include glob was added
+
+        std::unique_ptr<std::atomic<State*>[]> chunks;     // The state chunks, allocated as they are needed
+        uint32_t stateCount;                    // The number of states handed out
+        std::map<std::pair<std::vector<uint32_t>, bool>, uint32_t> stateIds;   // Finds a state by its nodes and included flag
+        std::mutex internMutex;                 // Guards stateCount, stateIds and adding chunks
+};
+
+#endif
@@ -0,0 +1,59 @@
+/******************************************************************************
+ * File: PathSorter.h
+ * Description: Puts the directories below a root in byte order of their
+ *              paths without building a single path. The tree already holds
+ *              every path's prefix, so only each directory's own children
+ *              have to be sorted, and those sorts are independent of each
+ *              other and run on a thread pool.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef PATH_SORTER_H
+#define PATH_SORTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+class DirectorySource;
+
+class PathSorter {
+    public:
+        // Trees with fewer directories than this are sorted on the calling thread
+        static const size_t PARALLEL_THRESHOLD = 64 * 1024;
+
+        // The number of directories whose children one task sorts
+        static const size_t CHUNK_SIZE = 16 * 1024;
+
+        explicit PathSorter(const DirectorySource &source);
+        ~PathSorter();
+
+        PathSorter(const PathSorter&) = delete;
+        PathSorter& operator=(const PathSorter&) = delete;
+
+        // Fills sorted with root and every directory below it that was read, in byte order of their paths
+        void sort(uint32_t root, std::vector<uint32_t> &sorted);
+
+    private:
+        // Lists the directories below root depth first, with where each one's subtree ends
+        void collect(uint32_t root);
+
+        // Lists and sorts the children of the directories at positions begin to end
+        void sortChildren(size_t begin, size_t end);
+
+        // Checks if one child's key comes before another's
+        bool before(uint64_t a, uint64_t b) const;
+
+        // Walks the sorted children depth first, adding every directory in order
+        void emit(std::vector<uint32_t> &sorted) const;
+
+        const DirectorySource &source;              // The directories being sorted
+        std::vector<uint32_t> nodes;                // Every directory, depth first
+        std::vector<std::string_view> names;        // Their names, by position in nodes
+        std::vector<uint32_t> ends;                 // The position one past the end of each subtree
+        std::vector<uint64_t> firstItem;            // Where each directory's children start in items
+        std::vector<uint64_t> items;                // Each directory's children, see sortChildren()
+};
+
+#endif
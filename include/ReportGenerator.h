@@ -10,7 +10,11 @@
 #include <vector>
 #include <unordered_map>
 #include <iostream>
-#include "DirectoryReader.h"
+#include "DirectorySource.h"
+
+class LargestEntries;
+class OutputSink;
+class ThreadPool;
 
 
 //  The different types of arguments that can be passed to the program
@@ -27,6 +31,14 @@ enum Argument {
     LEVELS_INFO_TO_FILE,
     LEVELS_TREE,
     LEVELS_TREE_TO_FILE,
+    SIZE_TREE,
+    SIZE_TREE_TO_FILE,
+    LEVELS_SIZE_TREE,
+    LEVELS_SIZE_TREE_TO_FILE,
+    LARGEST,
+    LARGEST_TO_FILE,
+    JSON,
+    JSON_TO_FILE,
     UNKNOWN
 };
 
@@ -36,64 +48,122 @@ class ReportGenerator {
         //
         //  Constructors and destructor
         //
-        ReportGenerator(std::unordered_map<std::string, DirectoryReader> compDir);
+        ReportGenerator(const DirectorySource& compDir);
         ~ReportGenerator();
 
         
-        int generateReport(std::string fileName = "report.txt", std::string root = "/", std::vector<std::string> arguments = {});
+        int generateReport(std::string fileName, uint32_t root, std::vector<std::string> arguments = {});
+
+        //  Returns the statx fields the scan has to collect for the given arguments
+        static unsigned int requiredStatxMask(const std::vector<std::string>& arguments);
+
+        //  Returns the most entries any -top report asks for, 0 if there is none
+        static size_t largestLimit(const std::vector<std::string>& arguments);
+
+        //  Checks if any of the reports needs every file's row, rather than only the totals
+        static bool listsFiles(const std::vector<std::string>& arguments);
+
+        //  Uses the largest files and directories collected during the scan instead of looking through every directory
+        void setLargestEntries(const LargestEntries* largest);
+
+        //  Writes the report files without going through the page cache
+        void setDirectOutput(bool direct);
+
+        //  Renders the trees on a pool that is already running, rather than on this thread alone
+        void setThreadPool(ThreadPool* pool);
+
+        //  Appends the -i record of a directory to out
+        static void appendInfo(const DirectorySource& source, uint32_t dir, std::string& out);
+
+        //  Appends the -j record of a directory to out, a JSON object on one line
+        static void appendJson(const DirectorySource& source, uint32_t dir, std::string& out);
+
+        //  maps a string to an Argument enum
+        static Argument mapArgument(const std::string& arg);
         
 
     private:
-        //  A map of all the directories that have been read
-        std::unordered_map<std::string, DirectoryReader> completedDirectories;
+        //  All the directories that have been read, from a scan or a snapshot
+        const DirectorySource& completedDirectories;
+
+        //  The largest files and directories collected during the scan, if any
+        const LargestEntries* largestEntries;
+
+        //  Set to write the report files with O_DIRECT
+        bool directOutput;
+
+        //  The pool the trees are rendered on, if any
+        ThreadPool* threadPool;
 
-        //  Sorts a vector of DirectoryReader objects by path.
-        void sortDirectories(std::vector<DirectoryReader>& toSort);
+        //  The line being printed, reused so the tree doesn't allocate one per line
+        std::string line;
+
+        //  A file or sub-directory in a tree ordered by size
+        struct SizedEntry {
+            uint64_t size;          // The file's size, or the total size of everything below the directory
+            uint32_t id;            // The directory's node, or the file's index in its directory
+            bool directory;         // Whether it is a sub-directory
+        };
+
+        //  Opens the console or the output file for a report, printing an error if it can't
+        bool openOutput(OutputSink& out, const std::string& fileName, bool toFile);
+
+        //  Waits for a report to be written, printing an error if it couldn't be
+        void closeOutput(OutputSink& out);
 
         //  Recursively collects all the subdirectories of a given directory
-        void collectSubdirectories(std::string root, std::vector<DirectoryReader>& dirs);
+        void collectSubdirectories(uint32_t root, std::vector<uint32_t>& dirs);
 
         //  Recursively collects all the subdirectories of a given directory up to a given level
-        void collectSubdirectoriesLevels(std::string root, std::vector<DirectoryReader>& dirs, size_t level);
-
-        //  recursively prints the directories as a tree
-        void printTree(const DirectoryReader& dir, std::string prefix = "", bool isLast = true,
-                                                bool isRoot = true, std::ostream& outStream = std::cout);
+        void collectSubdirectoriesLevels(uint32_t root, std::vector<uint32_t>& dirs, size_t level);
 
+        //  starts a line of a tree in line with the prefix and branch, and indents the prefix for the entry's children
+        void startTreeLine(std::string& prefix, bool isLast, bool isRoot);
 
-        //  recursively prints the directories as a tree up to a given level
-        void printTreeLevels(const DirectoryReader& dir, std::string prefix, bool isLast,
-                                      bool isRoot, size_t levels, std::ostream& outStream);
+        //  prints the largest entries of every directory as a tree, up to a given level, walking it with a stack of its own
+        void printSizeTree(uint32_t root, size_t levels, size_t entries, OutputSink& out);
 
-        //  Dumps all the paths in the completedDirectories map to a file
+        //  Dumps all the paths in completedDirectories to a file
         //  mode 0 = print all paths
-        //  mode 1 = print all paths sorted by size
+        //  mode 1 = print all paths sorted by path
         //  mode 2 = dump all paths
-        //  mode 3 = dump all paths sorted by size
-        void dumpPaths(std::string fileName, std::string root, size_t mode=0);
+        //  mode 3 = dump all paths sorted by path
+        void dumpPaths(std::string fileName, uint32_t root, size_t mode=0);
 
         //  Prints the directories as a tree
         //  mode 0 = print to console
         //  mode 1 = print to file
-        void treeBuilder(std::string fileName= "treeLevels.txt", std::string rootPath = "", size_t mode=0);
+        void treeBuilder(std::string fileName, uint32_t rootNode, size_t mode=0);
 
         //  Prints the directories as a tree up to a given level
         //  mode 0 = print to console
         //  mode 1 = print to file
-        void treeBuilderLevels(std::string fileName= "treeLevels.txt", std::string root="/" , size_t mode = 0, size_t level = 0);
+        void treeBuilderLevels(std::string fileName, uint32_t rootNode, size_t mode = 0, size_t level = 0);
+
+        //  Prints the directories as a tree with the largest entries first, up to a given level
+        //  mode 0 = print to console
+        //  mode 1 = print to file
+        void sizeTreeBuilder(std::string fileName, uint32_t rootNode, size_t mode, size_t levels, size_t entries);
 
         //  dumps all the information about the subdirectories of a given directory
         //  mode 0 = print to console
         //  mode 1 = print to file
-        void dumpInfo(std::string fileName, std::string root, size_t mode);
+        void dumpInfo(std::string fileName, uint32_t root, size_t mode);
         
         //  dumps all the information about the subdirectories of a given directory up to a given level
         //  mode 0 = print to console
         //  mode 1 = print to file
-        void dumpInfoLevels(std::string fileName, std::string root, size_t mode, size_t level);
+        void dumpInfoLevels(std::string fileName, uint32_t root, size_t mode, size_t level);
         
-        //  maps a string to an Argument enum
-        Argument mapArgument(const std::string& arg);
+        //  prints the largest files and directories below a given directory
+        //  mode 0 = print to console
+        //  mode 1 = print to file
+        void dumpLargest(std::string fileName, uint32_t root, size_t mode, size_t limit);
+
+        //  dumps the information about every directory below a given directory as NDJSON
+        //  mode 0 = print to console
+        //  mode 1 = print to file
+        void dumpJson(std::string fileName, uint32_t root, size_t mode);
 };
 
 #endif
\ No newline at end of file
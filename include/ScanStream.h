@@ -0,0 +1,86 @@
+/******************************************************************************
+ * File: ScanStream.h
+ * Description: Writes a report while the scan is still running. Every
+ *              directory's record is written as soon as its totals are final,
+ *              through an OutputSink with a writer thread of its own, so the
+ *              scan doesn't have to keep the files of the whole tree around
+ *              for a report at the end.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef SCAN_STREAM_H
+#define SCAN_STREAM_H
+
+#include "OutputSink.h"
+#include "ReportGenerator.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class DirectorySource;
+
+class ScanStream {
+    public:
+        // A worker hands its records to the sink once it has gathered this many bytes
+        static const size_t BATCH_SIZE = 64 * 1024;
+
+        ScanStream();
+        ~ScanStream();
+
+        ScanStream(const ScanStream&) = delete;
+        ScanStream& operator=(const ScanStream&) = delete;
+
+        // Picks the report to stream. Returns false if the arguments aren't exactly one -p, -ps, -i, -is, -j or -js.
+        bool configure(const std::vector<std::string> &arguments);
+
+        // Opens the output and starts the writer. Records are built from source as directories finish.
+        // With directIO set a file is written without going through the page cache.
+        bool open(const std::string &fileName, const DirectorySource &source, bool directIO = false);
+
+        // Checks if the report needs the files' rows until a directory is read, for its most common extension
+        bool needsFiles() const;
+
+        // Checks if the records go to the console
+        bool writesToConsole() const;
+
+        // Writes the record of a directory whose totals are final. Called by whichever worker finished it.
+        void directoryFinished(uint32_t node);
+
+        // Writes what the workers still hold and waits for the writer. Only call once the scan is over.
+        // Returns false if anything couldn't be written.
+        bool close();
+
+        // Retrieves the number of records written
+        uint64_t getRecordCount() const;
+
+    private:
+        // One worker's records that haven't been handed over yet. Padded to a cache line so two
+        // workers never write to the same one.
+        struct alignas(64) Buffer {
+            std::string text;
+        };
+
+        // Returns the calling thread's buffer, adding it the first time
+        Buffer& bufferForThisThread();
+
+        // Copies a batch of records into the sink and empties it, waiting if the writer is too far behind
+        void submit(std::string &batch);
+
+        Argument report;                            // The report being streamed
+        const DirectorySource *source;              // Where the records are built from
+        std::atomic<uint64_t> records;              // Records formatted so far
+        uint64_t id;                                // Tells instances apart in the threads' caches
+        bool opened;                                // Set once open() succeeded, until close()
+
+        std::mutex sinkMutex;                       // Guards everything below, the sink takes one writer at a time
+        OutputSink sink;                            // Buffers the records and writes them
+        std::vector<std::unique_ptr<Buffer>> buffers;   // Every worker's buffer, added once by each
+
+        static std::atomic<uint64_t> nextId;        // The id of the next instance
+};
+
+#endif
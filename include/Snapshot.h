@@ -0,0 +1,157 @@
+/******************************************************************************
+ * File: Snapshot.h
+ * Description: Saves the result of a scan to a compact binary file and maps
+ *              it back in, so reports can be generated from it in place
+ *              without scanning the filesystem again.
+ * Author: Robert Tetreault
+ *
+ * File layout, every section 8 byte aligned and in host byte order:
+ *      SnapshotHeader
+ *      SnapshotDirectory[directoryCount]   in depth-first pre-order, the root first
+ *      SnapshotFile[fileCount]             grouped by directory, in the same order
+ *      char strings[stringsSize]           every name, each one followed by a '\0'
+ *
+ * Sub-directories and files are stored sorted by name, so two snapshots of
+ * the same tree are identical and can be walked side by side.
+ ******************************************************************************/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "DirectorySource.h"
+#include "DirectoryRegistry.h"
+#include "PathArena.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The start of every snapshot file
+struct SnapshotHeader {
+    char magic[8];                  // Always SNAPSHOT_MAGIC
+    uint32_t version;               // The layout version, SNAPSHOT_VERSION when written
+    uint32_t byteOrder;             // SNAPSHOT_BYTE_ORDER as written by the machine that saved it
+    uint64_t headerSize;            // sizeof(SnapshotHeader)
+    uint64_t fileSize;              // The size of the whole snapshot, to catch truncated files
+    uint64_t directoryCount;        // The number of directory records
+    uint64_t directoriesOffset;     // Where the directory records start
+    uint64_t fileCount;             // The number of file records
+    uint64_t filesOffset;           // Where the file records start
+    uint64_t stringsSize;           // The size of the string pool
+    uint64_t stringsOffset;         // Where the string pool starts
+};
+
+// One directory that was read
+struct SnapshotDirectory {
+    uint64_t nameOffset;            // The name in the string pool, the full path for the root
+    uint32_t nameLength;            // The length of the name
+    uint32_t parent;                // The index of the parent directory, NO_PARENT for the root
+    uint32_t subtreeEnd;            // One past the index of the last directory below this one
+    uint32_t childCount;            // The number of sub-directories in the snapshot
+    uint32_t foundDirectories;      // The number of sub-directories found, including unreadable ones
+    uint32_t fileCount;             // The number of files
+    uint64_t firstFile;             // The index of the first file record
+    uint64_t totalSize;             // The size of everything in and below the directory
+    uint64_t fileTotalSize;         // The size of the files directly in the directory
+    uint64_t subDirTotalSize;       // The size of everything below the directory
+    uint64_t subtreeFileCount;      // The number of files in and below the directory
+    uint64_t subtreeDirCount;       // The number of directories below the directory
+    uint64_t topExtensionOffset;    // The most common file extension in the string pool
+    uint32_t topExtensionLength;    // The length of the most common extension
+    uint32_t reserved;              // Keeps the record 8 byte aligned
+    uint64_t dev;                   // The device the directory was on
+    uint64_t ino;                   // The directory's inode number
+    int64_t mtimeSec;               // The directory's modification time
+    int64_t ctimeSec;               // The directory's inode change time
+    uint32_t mtimeNsec;
+    uint32_t ctimeNsec;
+    uint64_t allocatedSize;         // The bytes allocated to everything in and below the directory
+    uint64_t fileAllocatedSize;     // The bytes allocated to the files directly in the directory
+};
+
+// One file
+struct SnapshotFile {
+    uint64_t nameOffset;            // The name in the string pool
+    uint32_t nameLength;            // The length of the name
+    uint32_t mode;                  // The raw mode bits
+    uint64_t size;                  // The size in bytes
+    uint64_t allocated;             // The bytes allocated on disk
+    uint64_t linkedInode;           // The inode number if the file has other hard links, 0 otherwise
+};
+
+class Snapshot : public DirectorySource {
+    public:
+        static constexpr char SNAPSHOT_MAGIC[8] = {'L', 'F', 'S', 'A', 'S', 'N', 'A', 'P'};
+        static const uint32_t SNAPSHOT_VERSION = 3;    // 2 added the directory stamps, 3 the allocated sizes
+        static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+        // The index of the root directory
+        static const uint32_t ROOT = 0;
+
+        Snapshot();
+        ~Snapshot();
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        // Writes every directory below root to a snapshot file
+        static bool save(const std::string &fileName, const DirectoryRegistry &directories, const PathArena &arena,
+                         uint32_t root);
+
+        // Maps a snapshot file in. Returns false if it can't be read or isn't a valid snapshot.
+        bool open(const std::string &fileName);
+
+        //
+        //  DirectorySource, answered straight from the mapped file
+        //
+
+        bool contains(uint32_t dir) const override;
+        std::string getPath(uint32_t dir) const override;
+        std::string_view getName(uint32_t dir) const override;
+        void appendPath(uint32_t dir, std::string &out) const override;
+        DirectoryList getDirectories(uint32_t dir) const override;
+        size_t getDirectoryCount(uint32_t dir) const override;
+        size_t getFileCount(uint32_t dir) const override;
+        std::string_view getFileName(uint32_t dir, size_t file) const override;
+        uint64_t getFileSize(uint32_t dir, size_t file) const override;
+        uint64_t getFileAllocatedSize(uint32_t dir, size_t file) const override;
+        uint64_t getTotalSize(uint32_t dir) const override;
+        uint64_t getAllocatedSize(uint32_t dir) const override;
+        uint64_t getSubtreeDirCount(uint32_t dir) const override;
+        double getAverageDirectorySize(uint32_t dir) const override;
+        double getAverageFileSize(uint32_t dir) const override;
+        std::string_view getTopFileExtension(uint32_t dir) const override;
+
+        //
+        //  Snapshot specific getters
+        //
+
+        // Retrieves the device, inode and times a directory had when it was scanned
+        DirectoryStamp getStamp(uint32_t dir) const;
+
+        // Retrieves the record of one of a directory's files
+        const SnapshotFile& getFileRecord(uint32_t dir, size_t file) const;
+
+        // Retrieves the index one past the last directory below a directory
+        uint32_t getSubtreeEnd(uint32_t dir) const;
+
+        // Tells the kernel the snapshot will be read once from front to back, so pages can be dropped behind
+        void adviseSequential() const;
+
+    private:
+        // Checks that every record points inside the snapshot and the directories form a tree
+        bool checkRecords() const;
+
+        // Returns a string from the pool
+        std::string_view getString(uint64_t offset, uint32_t length) const;
+
+        const void *mapping;                    // The mapped file, or nullptr
+        size_t mappingSize;                     // The size of the mapping
+        const SnapshotHeader *header;           // The header at the start of the mapping
+        const SnapshotDirectory *directories;   // The directory records
+        const SnapshotFile *files;              // The file records
+        const char *strings;                    // The string pool
+};
+
+#endif
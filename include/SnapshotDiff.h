@@ -0,0 +1,85 @@
+/******************************************************************************
+ * File: SnapshotDiff.h
+ * Description: Compares two snapshots of the same tree and ranks what was
+ *              added, removed or changed size by how many bytes it moved.
+ *              Both snapshots are walked side by side in a single pass, and
+ *              only the largest changes are kept, so memory stays the same
+ *              however big the trees are.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef SNAPSHOT_DIFF_H
+#define SNAPSHOT_DIFF_H
+
+#include "Snapshot.h"
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// One directory or file that differs between the snapshots
+struct DiffEntry {
+    enum Kind {
+        ADDED,
+        REMOVED,
+        RESIZED
+    };
+
+    Kind kind;                      // What happened to it
+    uint64_t oldSize;               // The size in the old snapshot, 0 if it was added
+    uint64_t newSize;               // The size in the new snapshot, 0 if it was removed
+    std::string path;               // The full path
+
+    // The change in bytes, positive if it grew
+    int64_t getDelta() const;
+};
+
+// The number of directories or files that were added, removed or changed size
+struct DiffCounts {
+    uint64_t added = 0;
+    uint64_t removed = 0;
+    uint64_t resized = 0;
+};
+
+class SnapshotDiff {
+    public:
+        // The number of directories and files listed when no limit is given
+        static const size_t DEFAULT_LIMIT = 20;
+
+        SnapshotDiff(const Snapshot &oldSnapshot, const Snapshot &newSnapshot, size_t limit = DEFAULT_LIMIT);
+
+        // Walks both snapshots and collects the differences
+        void compare();
+
+        // Prints the totals and the largest changes
+        void print(std::ostream &outStream) const;
+
+    private:
+        // Compares two directories that are in both snapshots, and their files
+        void compareDirectory(uint32_t oldDir, uint32_t newDir);
+
+        // Records a subtree that is only in one of the snapshots, along with every file in it
+        void compareSubtree(const Snapshot &snapshot, uint32_t dir, DiffEntry::Kind kind);
+
+        // Keeps a change if it is among the largest seen so far. The path is only built if it is.
+        template <typename PathBuilder>
+        void record(std::vector<DiffEntry> &top, DiffEntry::Kind kind, uint64_t oldSize, uint64_t newSize,
+                    PathBuilder buildPath);
+
+        // Prints one ranked list of changes
+        static void printEntries(std::ostream &outStream, const std::string &title, std::vector<DiffEntry> entries);
+
+        // Builds the full path of a file
+        static std::string filePath(const Snapshot &snapshot, uint32_t dir, size_t file);
+
+        const Snapshot &oldSnapshot;            // The earlier scan
+        const Snapshot &newSnapshot;            // The later scan
+        size_t limit;                           // How many directories and files to keep
+        std::vector<DiffEntry> topDirectories;  // The largest directory changes, kept as a heap
+        std::vector<DiffEntry> topFiles;        // The largest file changes, kept as a heap
+        DiffCounts directoryCounts;             // Every directory change, not just the largest
+        DiffCounts fileCounts;                  // Every file change, not just the largest
+};
+
+#endif
@@ -1,6 +1,8 @@
 /******************************************************************************
  * File: ThreadPool.h
- * Description: A basic thread pool implementation.
+ * Description: A work-stealing thread pool. Every worker has its own deque of
+ *              tasks, works on its newest task first and steals the oldest
+ *              task from another worker when it runs out.
  * Author: Robert Tetreault
  ******************************************************************************/
 
@@ -9,12 +11,106 @@
 
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// A move-only callable that stores small callables inline instead of allocating
+class Task {
+    public:
+        // Callables up to this size are stored without allocating
+        static const size_t INLINE_SIZE = 64;
+
+        Task() noexcept : ops(nullptr) {}
+
+        template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value>>
+        Task(F&& function) {
+            using Callable = std::decay_t<F>;
+            if constexpr (sizeof(Callable) <= INLINE_SIZE && alignof(Callable) <= alignof(std::max_align_t)
+                          && std::is_nothrow_move_constructible<Callable>::value) {
+                new (storage) Callable(std::forward<F>(function));
+                ops = &inlineOps<Callable>;
+            } else {
+                *reinterpret_cast<Callable**>(storage) = new Callable(std::forward<F>(function));
+                ops = &heapOps<Callable>;
+            }
+        }
+
+        Task(Task&& other) noexcept : ops(other.ops) {
+            if (ops != nullptr) {
+                ops->move(storage, other.storage);
+                other.ops = nullptr;
+            }
+        }
+
+        Task& operator=(Task&& other) noexcept {
+            if (this != &other) {
+                reset();
+                ops = other.ops;
+                if (ops != nullptr) {
+                    ops->move(storage, other.storage);
+                    other.ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task() { reset(); }
+
+        // Runs the stored callable
+        void operator()() { ops->invoke(storage); }
+
+        // Checks if the task holds a callable
+        explicit operator bool() const { return ops != nullptr; }
+
+    private:
+        // How to run, move and destroy the stored callable
+        struct Ops {
+            void (*invoke)(void* storage);
+            void (*move)(void* destination, void* source);
+            void (*destroy)(void* storage);
+        };
+
+        template <typename Callable>
+        static constexpr Ops inlineOps = {
+            [](void* storage) { (*static_cast<Callable*>(storage))(); },
+            [](void* destination, void* source) {
+                new (destination) Callable(std::move(*static_cast<Callable*>(source)));
+                static_cast<Callable*>(source)->~Callable();
+            },
+            [](void* storage) { static_cast<Callable*>(storage)->~Callable(); }
+        };
+
+        template <typename Callable>
+        static constexpr Ops heapOps = {
+            [](void* storage) { (**static_cast<Callable**>(storage))(); },
+            [](void* destination, void* source) {
+                *static_cast<Callable**>(destination) = *static_cast<Callable**>(source);
+            },
+            [](void* storage) { delete *static_cast<Callable**>(storage); }
+        };
+
+        void reset() {
+            if (ops != nullptr) {
+                ops->destroy(storage);
+                ops = nullptr;
+            }
+        }
+
+        alignas(std::max_align_t) unsigned char storage[INLINE_SIZE];  // The callable, or a pointer to it
+        const Ops* ops;                                                 // Null when the task is empty
+};
 
 class ThreadPool {
     public:
@@ -22,23 +118,64 @@ class ThreadPool {
         ThreadPool(size_t numThreads);
         ~ThreadPool();
 
-        void enqueue(std::function<void()> task);
+        // Adds a task to the pool. Tasks added from a worker go on that worker's own deque,
+        // anything else goes on a shared queue that idle workers check before stealing.
+        template <typename F>
+        void enqueue(F&& task) {
+            push(Task(std::forward<F>(task)));
+        }
+
         void waitForCompletion();
 
-        std::atomic<int> activeJobs;                // The number of tasks that are currently being processed
+        // Lets only the first n workers take tasks, the rest park until the limit is raised again.
+        // n is clamped to between 1 and the number of threads in the pool.
+        void setActiveThreads(size_t n);
+
+        // The number of workers currently allowed to take tasks
+        size_t getActiveThreads() const;
+
+        // The number of threads in the pool, parked or not
+        size_t size() const;
+
+        // The number of tasks waiting to be picked up
+        size_t getPendingTasks() const;
+
+        std::atomic<int> activeJobs;                // The number of tasks that are queued or being processed
 
     private:
-        static void workerThread(ThreadPool *pool);     
+        // The tasks owned by one worker. The owner uses the back, thieves take from the front.
+        struct alignas(64) WorkerQueue {
+            std::deque<Task> tasks;                 // The worker's tasks
+            std::mutex mutex;                       // Guards tasks
+            std::atomic<size_t> size{0};            // The number of tasks, readable without the lock
+        };
+
+        static void workerThread(ThreadPool *pool, size_t index);
+
+        void push(Task&& task);                     // Puts a task on a worker's deque
+        bool popLocal(size_t index, Task& task);    // Takes the newest task from a worker's own deque
+        bool popInjected(Task& task);               // Takes the oldest task pushed from outside the pool
+        bool steal(size_t thief, Task& task);       // Takes the oldest task from any other worker
+        bool takeOldest(WorkerQueue& queue, Task& task);    // Takes the front task of a locked deque
+        void finishJob();                           // Marks a task as done
 
         std::vector<std::thread> workers;           // A list of threads in the pool
-        std::queue<std::function<void()>> tasks;    // A queue of tasks to be executed
-        
-        std::mutex queueMutex;                      // A mutex to lock the queue
+        std::unique_ptr<WorkerQueue[]> queues;      // One deque of tasks per worker
+        WorkerQueue injected;                       // Tasks pushed from threads outside the pool
+
+        std::atomic<size_t> pendingTasks;           // The number of tasks waiting in the deques
+        std::atomic<size_t> idleWorkers;            // The number of workers asleep waiting for tasks
+        std::atomic<size_t> nextVictim;             // Where the next thief starts looking, to spread thieves out
+
+        std::mutex sleepMutex;                      // Lets idle workers sleep without missing a wake-up
         std::condition_variable condition;          // A condition variable to notify threads when a task is available
+        std::condition_variable parked;             // Wakes workers parked above the active limit
+        std::mutex doneMutex;                       // Guards waiting for the pool to be empty
         std::condition_variable everythingDone;     // A condition variable to notify the main thread when all tasks are complete
 
         size_t numThreads;                          // The number of threads in the pool
-        bool stop = false;                          // A flag to stop the threads
+        std::atomic<size_t> activeThreads;          // Workers with an index at or above this are parked
+        std::atomic<bool> stop;                     // A flag to stop the threads
 };
 
 #endif
@@ -0,0 +1,105 @@
+/******************************************************************************
+ * File: TreeRenderer.h
+ * Description: Prints the -t and -lt trees. Runs of small sub-trees are
+ *              rendered by tasks on a thread pool while large ones are split
+ *              further, and every task's text is written in order, so the
+ *              output is the same as printing the tree on one thread.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#ifndef TREE_RENDERER_H
+#define TREE_RENDERER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+class DirectorySource;
+class OutputSink;
+class ThreadPool;
+
+class TreeRenderer {
+    public:
+        // Sub-trees with fewer directories than this are rendered by tasks, larger ones are split further.
+        // Sibling sub-trees share a task until it holds about this many directories.
+        static const size_t SPLIT_SIZE = 1024;
+
+        // At most this many tasks are rendered ahead of the one being written
+        static const size_t MAX_PENDING = 64;
+
+        // Text rendered on one thread is written once it reaches this size
+        static const size_t FLUSH_SIZE = 1024 * 1024;
+
+        // A task waits once this many of its chunks are waiting to be written, which bounds the memory held
+        static const size_t MAX_CHUNKS = 2;
+
+        // Renders on pool if it has more than one thread, otherwise on the calling thread
+        explicit TreeRenderer(const DirectorySource &source, ThreadPool *pool = nullptr);
+        ~TreeRenderer();
+
+        TreeRenderer(const TreeRenderer&) = delete;
+        TreeRenderer& operator=(const TreeRenderer&) = delete;
+
+        // Prints the tree below root, levels deep counting the root, to out
+        void render(uint32_t root, size_t levels, OutputSink &out);
+
+    private:
+        // What a call to renderSubtree() is for
+        enum Role {
+            WHOLE,                                  // Renders everything on this thread, writing as it goes
+            PLANNER,                                // Renders the large sub-trees' top levels and hands the rest to tasks
+            TASK                                    // Renders a task's sub-trees into its chunks
+        };
+
+        // Sibling sub-trees rendered on the pool, or text the planner rendered between them
+        struct Task {
+            std::vector<std::pair<uint32_t, bool>> roots;   // Each sub-tree's directory and whether it is the last in its parent
+            std::string prefix;                     // The prefix of the sub-trees' first lines
+            size_t levels;                          // The levels left, counting the sub-trees' directories
+            size_t directories;                     // How many directories the sub-trees hold
+            std::deque<std::string> chunks;         // Text ready to be written, guarded by taskMutex
+            std::atomic<bool> started;              // Set by whoever renders the task, a worker or the writer
+            bool done;                              // Set once the last chunk is in, guarded by taskMutex
+        };
+
+        // Renders a sub-tree into text, walking it with a stack of its own instead of recursing
+        void renderSubtree(uint32_t dir, std::string &prefix, bool isLast, bool isRoot, size_t levels,
+                           std::string &text, Role role, Task *task);
+
+        // Renders a task's sub-trees one after another
+        void renderTask(Task &task, Role role);
+
+        // Passes on text that reached FLUSH_SIZE, the way role calls for
+        void flush(std::string &text, Role role, Task *task);
+
+        // Adds a small sub-tree to the batch of siblings being collected for the pool
+        void splitOff(uint32_t dir, const std::string &prefix, bool isLast, size_t levels, std::string &text);
+
+        // Hands the batch of siblings to the pool, if there is one
+        void submitBatch();
+
+        // Queues the planner's text behind the tasks already handed out
+        void queueText(std::string &text);
+
+        // Writes the oldest task as its chunks come in, rendering it here if no worker has started it
+        void writeOldest();
+
+        const DirectorySource &source;              // The tree being printed
+        ThreadPool *pool;                           // Runs the tasks, or nullptr
+        OutputSink *sink;                           // Where it is printed, while render() runs
+        std::shared_ptr<Task> batch;                // The siblings being collected, not handed out yet
+        std::deque<std::shared_ptr<Task>> pending;  // Tasks not written yet, in output order
+
+        std::mutex taskMutex;                       // Guards the tasks' chunks and done flags
+        std::condition_variable chunkReady;         // Wakes the writer when a task adds a chunk or finishes
+        std::condition_variable chunkTaken;         // Wakes the tasks when the writer takes a chunk
+};
+
+#endif
@@ -0,0 +1,319 @@
+/******************************************************************************
+ * File: AsyncStatEngine.cpp
+ * Description: Stats and opens directory entries in batches through io_uring
+ *              so one thread can keep many metadata requests in flight on
+ *              high-latency filesystems like NFS and FUSE.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "AsyncStatEngine.h"                // header file for class definition
+#include <iostream>                         // for printing to console
+#include <memory>                           // for std::unique_ptr
+#include <algorithm>                        // for std::max
+#include <cerrno>                           // For errno
+#include <climits>                          // For INT_MIN
+#include <cstring>                          // For memset() and strerror()
+#include <fcntl.h>                          // For open() flags
+#include <unistd.h>                         // For syscall() and close()
+#include <sys/mman.h>                       // For mapping the rings
+#include <sys/syscall.h>                    // For the io_uring syscall numbers
+#include <linux/io_uring.h>                 // For the io_uring structures
+
+using std::cerr;
+using std::endl;
+
+std::atomic<bool> AsyncStatEngine::unavailable(false);
+
+const int AsyncStatEngine::NOT_COMPLETED = INT_MIN;
+
+//
+//  Constructors and Destructors
+//
+
+AsyncStatEngine::AsyncStatEngine()
+    : ringFd(-1), sqRing(MAP_FAILED), sqRingSize(0), sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), sqesSize(0),
+      cqRing(MAP_FAILED), cqRingSize(0), broken(false) {}
+
+AsyncStatEngine::~AsyncStatEngine() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED && cqRing != sqRing) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED) {
+        munmap(sqRing, sqRingSize);
+    }
+    if (ringFd != -1) {
+        close(ringFd);
+    }
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * forThisThread: Returns the calling thread's engine, setting it up the first
+ *                time. If the kernel refuses to give us a ring (too old,
+ *                blocked by seccomp, disabled by sysctl) every thread falls
+ *                back to synchronous stat calls from then on. A thread
+ *                whose ring stopped working drops it, and no new rings are
+ *                set up after that either.
+ *
+ * @return This thread's engine, or nullptr if io_uring isn't available
+ ******************************************************************************/
+AsyncStatEngine* AsyncStatEngine::forThisThread() {
+    thread_local std::unique_ptr<AsyncStatEngine> engine;
+
+    if (engine && engine->broken) {
+        engine.reset();
+        unavailable.store(true);
+    }
+    if (engine) {
+        return engine.get();
+    }
+    if (unavailable.load(std::memory_order_relaxed)) {
+        return nullptr;
+    }
+
+    std::unique_ptr<AsyncStatEngine> newEngine(new AsyncStatEngine());
+    if (!newEngine->setup()) {
+        int setupError = errno;
+        if (!unavailable.exchange(true)) {
+            cerr << "\033[33mio_uring is unavailable (" << strerror(setupError)
+                 << "), falling back to synchronous stat\033[0m" << endl;
+        }
+        return nullptr;
+    }
+
+    engine = std::move(newEngine);
+    return engine.get();
+}
+
+/******************************************************************************
+ * statBatch: Stats every name relative to a directory, keeping up to
+ *            QUEUE_DEPTH statx requests in flight at once.
+ *
+ * @param dirFd: The directory the names are in
+ * @param names: The entry names to stat
+ * @param mask: The statx fields to request
+ * @param results: Gets one statx result per name
+ * @param errors: Gets 0 or the errno for each name
+ ******************************************************************************/
+void AsyncStatEngine::statBatch(int dirFd, const std::vector<const char*>& names, unsigned int mask,
+                                std::vector<struct statx>& results, std::vector<int>& errors) {
+    const int flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+    results.resize(names.size());
+    errors.assign(names.size(), NOT_COMPLETED);
+
+    run(names.size(),
+        [&](size_t i, io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirFd;
+            sqe->addr = reinterpret_cast<uint64_t>(names[i]);
+            sqe->len = mask;
+            sqe->off = reinterpret_cast<uint64_t>(&results[i]);
+            sqe->statx_flags = flags;
+        },
+        [&](size_t i, int res) {
+            errors[i] = res < 0 ? -res : 0;
+        });
+
+    // Kernels before 5.6 know io_uring but not IORING_OP_STATX, redo those the slow way, and the ones a failed ring lost
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (errors[i] == EINVAL || errors[i] == EOPNOTSUPP || errors[i] == EIO || errors[i] == NOT_COMPLETED) {
+            errors[i] = (statx(dirFd, names[i], flags, mask, &results[i]) == -1) ? errno : 0;
+        }
+    }
+}
+
+/******************************************************************************
+ * openBatch: Opens every name relative to a directory as a directory.
+ *
+ * @param dirFd: The directory the names are in
+ * @param names: The sub-directory names to open
+ * @param fds: Gets the new file descriptor, or -errno, for each name
+ ******************************************************************************/
+void AsyncStatEngine::openBatch(int dirFd, const std::vector<const char*>& names, std::vector<int>& fds) {
+    const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW;
+    fds.assign(names.size(), NOT_COMPLETED);
+
+    run(names.size(),
+        [&](size_t i, io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = dirFd;
+            sqe->addr = reinterpret_cast<uint64_t>(names[i]);
+            sqe->len = 0;
+            sqe->open_flags = flags;
+        },
+        [&](size_t i, int res) {
+            fds[i] = res;
+        });
+
+    // Same fallback as statBatch() for kernels without IORING_OP_OPENAT
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (fds[i] == -EINVAL || fds[i] == -EOPNOTSUPP || fds[i] == -EIO || fds[i] == NOT_COMPLETED) {
+            int fd = openat(dirFd, names[i], flags);
+            fds[i] = (fd == -1) ? -errno : fd;
+        }
+    }
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * setup: Creates the ring and maps its submission and completion queues.
+ *
+ * @return true if the ring is ready to use
+ ******************************************************************************/
+bool AsyncStatEngine::setup() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params));
+    if (ringFd < 0) {
+        ringFd = -1;
+        return false;
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // Newer kernels let both rings share one mapping
+    bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) {
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        return false;
+    }
+
+    if (singleMap) {
+        cqRing = sqRing;
+    } else {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) {
+            return false;
+        }
+    }
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqeMap == MAP_FAILED) {
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqeMap);
+
+    char* sq = static_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<std::atomic<unsigned>*>(sq + params.sq_off.head);
+    sqTail = reinterpret_cast<std::atomic<unsigned>*>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqEntries = params.sq_entries;
+
+    char* cq = static_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<std::atomic<unsigned>*>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<std::atomic<unsigned>*>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+/******************************************************************************
+ * run: Pushes count requests through the ring. The submission queue is kept
+ *      as full as possible and refilled every time completions are reaped,
+ *      so a large batch never has more than sqEntries requests in flight and
+ *      the completion queue (twice that size) can't overflow.
+ *
+ * note:    If io_uring_enter fails for good, the requests the kernel already
+ *          took still point at the caller's buffers, so they are waited for
+ *          before returning. Every request without a result then completes
+ *          with -EIO for the caller to redo synchronously, and the ring is
+ *          marked broken so the thread stops using it.
+ *
+ * @param count: The number of requests
+ * @param prepare: Fills in the submission entry for request i
+ * @param complete: Receives the result of request i
+ ******************************************************************************/
+template <typename Prepare, typename Complete>
+void AsyncStatEngine::run(size_t count, Prepare prepare, Complete complete) {
+    size_t prepared = 0;        // Requests written to the submission queue
+    size_t completed = 0;       // Requests whose results have been reaped
+    unsigned unsubmitted = 0;   // Requests in the queue the kernel hasn't taken yet
+    reaped.assign(count, false);
+
+    while (completed < count) {
+        // Fill the submission queue up to the ring size
+        unsigned tail = sqTail->load(std::memory_order_relaxed);
+        while (prepared < count && prepared - completed < sqEntries) {
+            unsigned index = tail & sqMask;
+            io_uring_sqe* sqe = &sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            prepare(prepared, sqe);
+            sqe->user_data = prepared;
+            sqArray[index] = index;
+
+            tail++;
+            prepared++;
+            unsubmitted++;
+        }
+        sqTail->store(tail, std::memory_order_release);
+
+        // Submit everything and wait for at least one completion
+        long submitted = syscall(__NR_io_uring_enter, ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (submitted >= 0) {
+            unsubmitted -= static_cast<unsigned>(submitted);
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            cerr << "\033[31mio_uring_enter failed: " << strerror(errno) << "\033[0m" << endl;
+            broken = true;
+
+            // Wait for the requests the kernel took, they write into the caller's buffers
+            while (prepared - unsubmitted > completed) {
+                unsigned inFlight = static_cast<unsigned>(prepared - unsubmitted - completed);
+                if (syscall(__NR_io_uring_enter, ringFd, 0, inFlight, IORING_ENTER_GETEVENTS, nullptr, 0) < 0
+                    && errno != EINTR) {
+                    break;
+                }
+                completed += reap(complete);
+            }
+
+            for (size_t i = 0; i < count; ++i) {
+                if (!reaped[i]) {
+                    complete(i, -EIO);
+                }
+            }
+            return;
+        }
+
+        completed += reap(complete);
+    }
+}
+
+/******************************************************************************
+ * reap: Hands every completion waiting in the completion queue to complete.
+ *
+ * @param complete: Receives the result of request i
+ * @return The number of completions reaped
+ ******************************************************************************/
+template <typename Complete>
+size_t AsyncStatEngine::reap(Complete& complete) {
+    size_t count = 0;
+    unsigned head = cqHead->load(std::memory_order_relaxed);
+    unsigned available = cqTail->load(std::memory_order_acquire);
+    while (head != available) {
+        const io_uring_cqe& cqe = cqes[head & cqMask];
+        size_t request = static_cast<size_t>(cqe.user_data);
+        reaped[request] = true;
+        complete(request, cqe.res);
+        head++;
+        count++;
+    }
+    cqHead->store(head, std::memory_order_release);
+    return count;
+}
@@ -0,0 +1,345 @@
+/******************************************************************************
+ * File: ChangeWatcher.cpp
+ * Description: Subscribes to changes below the scanned root after the scan,
+ *              so the tree can be kept current instead of scanned again. It
+ *              uses fanotify where the process is allowed to, which needs one
+ *              mark per filesystem, and falls back to one inotify watch per
+ *              directory. Events are turned into the arena nodes of the
+ *              directories whose entries changed, gathered into batches.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "ChangeWatcher.h"                  // header file for class definition
+#include <iostream>                         // for printing to console
+#include <cerrno>                           // For errno
+#include <cstring>                          // For strerror() and memcpy()
+#include <vector>                           // for the event buffer
+#include <fcntl.h>                          // For name_to_handle_at() and O_RDONLY
+#include <poll.h>                           // For poll()
+#include <unistd.h>                         // For read() and close()
+#include <sys/fanotify.h>                   // For fanotify_init() and fanotify_mark()
+#include <sys/inotify.h>                    // For inotify_init1() and inotify_add_watch()
+#include <sys/statfs.h>                     // For statfs(), to get a filesystem's fsid
+
+using std::string;
+using std::unordered_set;
+
+constexpr std::chrono::milliseconds ChangeWatcher::QUIET_PERIOD;
+constexpr std::chrono::milliseconds ChangeWatcher::MAX_BATCH;
+
+// Anything that adds, removes or renames an entry, or changes a file's size or mode
+static const uint64_t FANOTIFY_EVENTS = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_MODIFY
+                                      | FAN_ATTRIB | FAN_ONDIR;
+static const uint32_t INOTIFY_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB
+                                     | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+// The size of the buffer events are read into, many events fit in one read()
+static const size_t EVENT_BUFFER_SIZE = 256 * 1024;
+
+// The largest file handle name_to_handle_at() hands out
+static const size_t MAX_HANDLE_SIZE = 128;
+
+//
+//  Constructors and Destructors
+//
+
+ChangeWatcher::ChangeWatcher(const PathArena &arena) : arena(arena), backend(NONE), fd(-1), warned(false) {}
+
+ChangeWatcher::~ChangeWatcher() {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * start:   Sets up the event source. fanotify reports the directory an event
+ *          happened in by file handle (FAN_REPORT_DFID_NAME) and covers a
+ *          whole filesystem with one mark, but marking a filesystem needs
+ *          CAP_SYS_ADMIN. Without it inotify is used, which needs a watch on
+ *          every directory and is limited by fs.inotify.max_user_watches.
+ *
+ * @return true if one of them could be set up
+ ******************************************************************************/
+bool ChangeWatcher::start() {
+    fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY);
+    if (fd != -1) {
+        backend = FANOTIFY;
+        return true;
+    }
+
+    return startInotify();
+}
+
+/******************************************************************************
+ * watchDirectory:  Starts reporting changes to a directory. With fanotify the
+ *                  filesystem it is on is marked the first time one of its
+ *                  directories is seen, and the directory's file handle is
+ *                  remembered so events can be traced back to its node. With
+ *                  inotify the directory gets its own watch. A directory that
+ *                  moved keeps its handle and its watch, so either one is
+ *                  simply pointed at the node it has now.
+ *
+ * note:    The first filesystem fanotify can't mark, because the process may
+ *          only use fanotify for inode marks, switches the watcher to inotify
+ *          as long as nothing has been watched yet.
+ *
+ * @param node: The arena node of the directory
+ * @param dev: The device the directory is on
+ ******************************************************************************/
+void ChangeWatcher::watchDirectory(uint32_t node, uint64_t dev) {
+    string path = arena.getPath(node);
+
+    if (backend == FANOTIFY) {
+        auto filesystem = filesystems.find(dev);
+        if (filesystem == filesystems.end()) {
+            struct statfs info;
+            if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, AT_FDCWD, path.c_str()) != 0
+                || statfs(path.c_str(), &info) != 0) {
+                int error = errno;
+                if (handles.empty() && (error == EPERM || error == EACCES)) {
+                    close(fd);
+                    fd = -1;
+                    filesystems.clear();
+                    if (startInotify()) {
+                        watchDirectory(node, dev);
+                    }
+                    return;
+                }
+
+                if (!warned) {
+                    std::cerr << "\033[33mCannot watch the filesystem " << path << " is on: " << strerror(error)
+                              << ". Changes there will be missed.\033[0m" << std::endl;
+                    warned = true;
+                }
+                filesystems.emplace(dev, string());     // Don't try again for every directory on it
+                return;
+            }
+            filesystem = filesystems.emplace(dev, string(reinterpret_cast<const char*>(&info.f_fsid), sizeof(info.f_fsid))).first;
+        }
+
+        // The filesystem couldn't be marked
+        if (filesystem->second.empty()) {
+            return;
+        }
+
+        alignas(struct file_handle) char buffer[sizeof(struct file_handle) + MAX_HANDLE_SIZE];
+        struct file_handle *handle = reinterpret_cast<struct file_handle*>(buffer);
+        handle->handle_bytes = MAX_HANDLE_SIZE;
+        int mountId;
+        if (name_to_handle_at(AT_FDCWD, path.c_str(), handle, &mountId, 0) == 0) {
+            handles[handleKey(filesystem->second.data(), handle)] = node;
+        }
+        return;
+    }
+
+    if (backend == INOTIFY) {
+        int wd = inotify_add_watch(fd, path.c_str(), INOTIFY_EVENTS);
+        if (wd != -1) {
+            watches[wd] = node;
+        } else if (!warned) {
+            int error = errno;
+            std::cerr << "\033[33mCannot watch " << path << ": " << strerror(error);
+            if (error == ENOSPC) {
+                std::cerr << " (raise fs.inotify.max_user_watches)";
+            }
+            std::cerr << ". Changes there will be missed.\033[0m" << std::endl;
+            warned = true;
+        }
+    }
+}
+
+/******************************************************************************
+ * waitForChanges:  Blocks until something changes, then keeps collecting
+ *                  events until none arrived for QUIET_PERIOD or the batch is
+ *                  MAX_BATCH old. A burst like rm -rf or untarring an archive
+ *                  produces thousands of events for a handful of directories,
+ *                  and each of them ends up in changed only once.
+ *
+ * @param changed: Gets the nodes of the directories that changed
+ * @param overflowed: Set if the kernel's event queue overflowed
+ * @param stopping: Checked while waiting, for a clean exit on a signal
+ * @return true if there is a batch to apply
+ ******************************************************************************/
+bool ChangeWatcher::waitForChanges(unordered_set<uint32_t> &changed, bool &overflowed, const std::atomic<bool> &stopping) {
+    struct pollfd pollFd = {fd, POLLIN, 0};
+
+    // Wait for the first event, waking up now and then to check if we should stop
+    while (true) {
+        if (stopping.load()) {
+            return false;
+        }
+        int ready = poll(&pollFd, 1, 500);
+        if (ready > 0) {
+            break;
+        }
+        if (ready == -1 && errno != EINTR) {
+            std::cerr << "\033[31mFailed to wait for changes: " << strerror(errno) << "\033[0m" << std::endl;
+            return false;
+        }
+    }
+
+    // Gather the rest of the burst
+    auto batchStart = std::chrono::steady_clock::now();
+    while (!stopping.load()) {
+        if (!readEvents(changed, overflowed)) {
+            return false;
+        }
+
+        auto remaining = MAX_BATCH - (std::chrono::steady_clock::now() - batchStart);
+        if (remaining <= std::chrono::milliseconds(0)) {
+            break;
+        }
+        auto wait = std::min<std::chrono::milliseconds>(QUIET_PERIOD,
+                        std::chrono::duration_cast<std::chrono::milliseconds>(remaining));
+        if (poll(&pollFd, 1, static_cast<int>(wait.count())) == 0) {
+            break;  // Things have settled down
+        }
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * getBackendName: Returns the name of the backend in use.
+ ******************************************************************************/
+const char* ChangeWatcher::getBackendName() const {
+    switch (backend) {
+        case FANOTIFY: return "fanotify";
+        case INOTIFY: return "inotify";
+        default: return "nothing";
+    }
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * startInotify: Sets up inotify, when fanotify can't be used.
+ *
+ * @return true if it could be set up
+ ******************************************************************************/
+bool ChangeWatcher::startInotify() {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd != -1) {
+        backend = INOTIFY;
+        return true;
+    }
+
+    backend = NONE;
+    std::cerr << "\033[31mCannot watch for changes: " << strerror(errno) << "\033[0m" << std::endl;
+    return false;
+}
+
+/******************************************************************************
+ * readEvents: Reads events until none are left.
+ *
+ * @param changed: Gets the nodes of the directories that changed
+ * @param overflowed: Set if the kernel's event queue overflowed
+ * @return false if reading failed
+ ******************************************************************************/
+bool ChangeWatcher::readEvents(unordered_set<uint32_t> &changed, bool &overflowed) {
+    static thread_local std::vector<char> buffer(EVENT_BUFFER_SIZE);
+
+    while (true) {
+        ssize_t length = read(fd, buffer.data(), buffer.size());
+        if (length == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return true;
+            }
+            std::cerr << "\033[31mFailed to read change events: " << strerror(errno) << "\033[0m" << std::endl;
+            return false;
+        }
+        if (length == 0) {
+            return true;
+        }
+
+        if (backend == FANOTIFY) {
+            parseFanotify(buffer.data(), length, changed, overflowed);
+        } else {
+            parseInotify(buffer.data(), length, changed, overflowed);
+        }
+    }
+}
+
+/******************************************************************************
+ * parseFanotify:   Every event carries an info record with the file handle of
+ *                  the directory the entry is in and the entry's name. The
+ *                  directory is all we need, it will be read again as a whole.
+ ******************************************************************************/
+void ChangeWatcher::parseFanotify(const char *buffer, size_t length, unordered_set<uint32_t> &changed, bool &overflowed) {
+    const struct fanotify_event_metadata *event = reinterpret_cast<const struct fanotify_event_metadata*>(buffer);
+    ssize_t remaining = static_cast<ssize_t>(length);
+
+    for (; FAN_EVENT_OK(event, remaining); event = FAN_EVENT_NEXT(event, remaining)) {
+        if (event->fd >= 0) {
+            close(event->fd);   // Not used with FAN_REPORT_DFID_NAME, but don't leak one if it comes
+        }
+        if (event->mask & FAN_Q_OVERFLOW) {
+            overflowed = true;
+            continue;
+        }
+
+        // The info records follow the metadata
+        const char *info = reinterpret_cast<const char*>(event) + event->metadata_len;
+        const char *end = reinterpret_cast<const char*>(event) + event->event_len;
+        while (info + sizeof(struct fanotify_event_info_header) <= end) {
+            const struct fanotify_event_info_fid *fid = reinterpret_cast<const struct fanotify_event_info_fid*>(info);
+            if (fid->hdr.len == 0) {
+                break;
+            }
+            if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME || fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID) {
+                auto match = handles.find(handleKey(&fid->fsid, fid->handle));
+                if (match != handles.end()) {
+                    changed.insert(match->second);
+                }
+            }
+            info += fid->hdr.len;
+        }
+    }
+}
+
+/******************************************************************************
+ * parseInotify: Every event names the watch of the directory it happened in.
+ ******************************************************************************/
+void ChangeWatcher::parseInotify(const char *buffer, size_t length, unordered_set<uint32_t> &changed, bool &overflowed) {
+    size_t offset = 0;
+
+    while (offset + sizeof(struct inotify_event) <= length) {
+        const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+        offset += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            overflowed = true;
+        } else if (event->mask & IN_IGNORED) {
+            watches.erase(event->wd);   // The directory is gone, or the watch was removed
+        } else {
+            auto match = watches.find(event->wd);
+            if (match != watches.end()) {
+                changed.insert(match->second);
+            }
+        }
+    }
+}
+
+/******************************************************************************
+ * handleKey: Builds a lookup key from a filesystem id and a file handle. File
+ *            handles are only unique within one filesystem.
+ *
+ * @param fsid: The 8 byte filesystem id
+ * @param handle: A struct file_handle
+ * @return The key
+ ******************************************************************************/
+string ChangeWatcher::handleKey(const void *fsid, const void *handle) {
+    struct file_handle header;
+    std::memcpy(&header, handle, sizeof(header));
+
+    string key(static_cast<const char*>(fsid), sizeof(fsid_t));
+    key.append(reinterpret_cast<const char*>(&header.handle_type), sizeof(header.handle_type));
+    key.append(static_cast<const char*>(handle) + sizeof(header), header.handle_bytes);
+    return key;
+}
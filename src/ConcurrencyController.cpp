@@ -0,0 +1,302 @@
+/******************************************************************************
+ * File: ConcurrencyController.cpp
+ * Description: Sizes the thread pool while the scan runs. It works out how
+ *              many threads the machine allows, then keeps moving the number
+ *              of active workers towards whatever reads the most directory
+ *              entries per second.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "ConcurrencyController.h"          // header file for class definition
+#include <iostream>                         // for printing to console
+#include <fstream>                          // for reading the cgroup files
+#include <sstream>                          // for splitting /proc/self/cgroup
+#include <string>                           // for std::string
+#include <vector>                           // for the candidate cgroup directories
+#include <algorithm>                        // for std::min and std::max
+#include <charconv>                         // for std::from_chars
+#include <sched.h>                          // For sched_getaffinity()
+#include <sys/resource.h>                   // For getrlimit()
+
+using std::string;
+using std::vector;
+using std::cout;
+using std::endl;
+
+constexpr std::chrono::milliseconds ConcurrencyController::SAMPLE_INTERVAL;
+constexpr double ConcurrencyController::TOLERANCE;
+
+// Descriptors kept free for the output file, the terminal and anything else the program opens
+static const size_t RESERVED_FDS = 32;
+
+// Without a limit from the system, never run more workers than this
+static const size_t HARD_THREAD_LIMIT = 256;
+
+//
+//  Constructors and Destructors
+//
+
+ConcurrencyController::ConcurrencyController(ThreadPool &pool, const ConcurrencyLimits &limits)
+    : pool(pool), limits(limits), entries(0), reads(0), latencyNanoseconds(0), lastEntries(0), lastRate(0),
+      peakRate(0), peakThreads(limits.startThreads), direction(1), stopping(false) {
+    pool.setActiveThreads(limits.startThreads);
+}
+
+ConcurrencyController::~ConcurrencyController() {
+    stop();
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * detectLimits: Works out how many threads the scan may use. The CPUs come
+ *               from the affinity mask, cut down to the cgroup's CPU quota.
+ *               Reading directories mostly waits on the disk or network, so
+ *               the scan may run many more workers than CPUs, but every
+ *               worker holds a directory open (and a ring with --async-stat)
+ *               so RLIMIT_NOFILE caps them too. Half of the descriptors are
+ *               left for directories opened ahead of time.
+ *
+ * @param asyncStat: Whether the workers use io_uring, which already keeps
+ *                   many requests in flight per worker
+ * @return The limits to run the pool with
+ ******************************************************************************/
+ConcurrencyLimits ConcurrencyController::detectLimits(bool asyncStat) {
+    ConcurrencyLimits limits;
+
+    // The CPUs we are allowed to run on
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0) {
+        limits.cpus = CPU_COUNT(&cpuSet);
+    } else {
+        limits.cpus = std::thread::hardware_concurrency();
+    }
+
+    // A cgroup quota can allow less than that
+    size_t quota = cgroupCpuLimit();
+    if (quota > 0) {
+        limits.cpus = std::min(limits.cpus, quota);
+    }
+    limits.cpus = std::max<size_t>(limits.cpus, 1);
+
+    // Every worker keeps one directory open, plus its ring with io_uring
+    size_t fdThreads = HARD_THREAD_LIMIT;
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur != RLIM_INFINITY) {
+        size_t available = fileLimit.rlim_cur / 2;
+        available = (available > RESERVED_FDS) ? available - RESERVED_FDS : 1;
+        fdThreads = available / (asyncStat ? 2 : 1);
+    }
+
+    // With io_uring a few workers can keep the filesystem busy, without it workers block on every stat
+    size_t perCpu = asyncStat ? 4 : 32;
+    limits.maxThreads = std::max<size_t>(1, std::min({limits.cpus * perCpu, HARD_THREAD_LIMIT, fdThreads}));
+    limits.minThreads = 1;
+    limits.startThreads = std::min(limits.maxThreads, limits.cpus * (asyncStat ? 1 : 4));
+
+    return limits;
+}
+
+/******************************************************************************
+ * start: Starts the background thread that adjusts the pool.
+ ******************************************************************************/
+void ConcurrencyController::start() {
+    stopping = false;
+    thread = std::thread(&ConcurrencyController::run, this);
+}
+
+/******************************************************************************
+ * stop: Stops the background thread. The pool keeps its current size.
+ ******************************************************************************/
+void ConcurrencyController::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+/******************************************************************************
+ * recordRead: Counts a finished directory read.
+ *
+ * @param readEntries: The number of files and sub-directories in it
+ * @param latency: How long reading it took
+ ******************************************************************************/
+void ConcurrencyController::recordRead(uint64_t readEntries, std::chrono::nanoseconds latency) {
+    entries.fetch_add(readEntries, std::memory_order_relaxed);
+    reads.fetch_add(1, std::memory_order_relaxed);
+    latencyNanoseconds.fetch_add(latency.count(), std::memory_order_relaxed);
+}
+
+/******************************************************************************
+ * printSummary: Prints how many workers the scan ended up with, the best
+ *               rate seen and how long a directory read took on average.
+ ******************************************************************************/
+void ConcurrencyController::printSummary() const {
+    uint64_t totalReads = reads.load();
+    double averageLatency = totalReads > 0 ? latencyNanoseconds.load() / 1e6 / totalReads : 0;
+
+    cout << "\033[32mThreads: " << pool.getActiveThreads() << " active at the end (allowed "
+         << limits.minThreads << "-" << limits.maxThreads << " on " << limits.cpus << " CPUs), ";
+
+    // The peak is only known if the controller ran long enough to take a sample
+    if (peakRate > 0) {
+        cout << "peak of " << static_cast<uint64_t>(peakRate) << " entries/s with " << peakThreads << " threads, ";
+    }
+    cout << averageLatency << " ms per directory read.\033[0m" << endl;
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * adjust:  One step of hill climbing. If the last move made the entry rate
+ *          better, keep going the same way, if it made it worse, turn around.
+ *          When nothing changed, fewer threads are tried since they are
+ *          cheaper. The step is a quarter of the current size, so the pool
+ *          gets near the peak quickly and then settles around it.
+ *
+ * note:    When no tasks are waiting the scan is limited by how much of the
+ *          tree is left, not by the number of workers, so the rate says
+ *          nothing about the size and the pool is left alone.
+ *
+ * @param seconds: The length of the interval just measured
+ ******************************************************************************/
+void ConcurrencyController::adjust(double seconds) {
+    uint64_t total = entries.load(std::memory_order_relaxed);
+    double rate = (total - lastEntries) / seconds;
+    lastEntries = total;
+
+    size_t current = pool.getActiveThreads();
+    if (rate > peakRate) {
+        peakRate = rate;
+        peakThreads = current;
+    }
+
+    if (pool.getPendingTasks() == 0) {
+        lastRate = rate;
+        return;
+    }
+
+    if (lastRate > 0) {
+        if (rate < lastRate * (1 - TOLERANCE)) {
+            direction = -direction;     // The last move hurt, go back
+        } else if (rate <= lastRate * (1 + TOLERANCE)) {
+            direction = -1;             // No gain, see if fewer threads do just as well
+        }
+    }
+    lastRate = rate;
+
+    size_t step = std::max<size_t>(1, current / 4);
+    size_t next = (direction > 0) ? current + step : (current > step ? current - step : 1);
+    next = std::max(limits.minThreads, std::min(limits.maxThreads, next));
+
+    pool.setActiveThreads(next);
+}
+
+/******************************************************************************
+ * run: Measures and adjusts every SAMPLE_INTERVAL until stop() is called.
+ ******************************************************************************/
+void ConcurrencyController::run() {
+    auto last = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, SAMPLE_INTERVAL, [this] { return stopping; })) {
+        auto now = std::chrono::steady_clock::now();
+        adjust(std::chrono::duration<double>(now - last).count());
+        last = now;
+    }
+}
+
+/******************************************************************************
+ * cgroupCpuLimit: Reads the CPU quota of the cgroup the process is in, from
+ *                 cpu.max on cgroup v2 or cpu.cfs_quota_us on v1. The quota
+ *                 of every cgroup up to the root counts, the smallest wins.
+ *
+ * @return The quota rounded up to whole CPUs, or 0 if there is none
+ ******************************************************************************/
+size_t ConcurrencyController::cgroupCpuLimit() {
+    vector<string> candidates;      // cgroup directories that may hold a quota
+    std::ifstream cgroupFile("/proc/self/cgroup");
+    string line;
+
+    // Lines look like "0::/path" on v2 and "4:cpu,cpuacct:/path" on v1
+    while (std::getline(cgroupFile, line)) {
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == string::npos || second == string::npos) {
+            continue;
+        }
+        string controllers = line.substr(first + 1, second - first - 1);
+        string path = line.substr(second + 1);
+
+        vector<string> bases;
+        if (controllers.empty()) {
+            bases = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+        } else {
+            std::stringstream controllerList(controllers);
+            string controller;
+            while (std::getline(controllerList, controller, ',')) {
+                if (controller == "cpu") {
+                    bases = {"/sys/fs/cgroup/" + controllers, "/sys/fs/cgroup/cpu"};
+                }
+            }
+        }
+
+        // The quota can be set anywhere between our cgroup and the root
+        for (const string& base : bases) {
+            string dir = path;
+            while (true) {
+                candidates.push_back(base + (dir == "/" ? "" : dir));
+                if (dir.empty() || dir == "/") {
+                    break;
+                }
+                size_t slash = dir.rfind('/');
+                dir = (slash == 0 || slash == string::npos) ? "/" : dir.substr(0, slash);
+            }
+        }
+    }
+
+    size_t limit = 0;
+    for (const string& dir : candidates) {
+        long long quota = -1;
+        long long period = 0;
+
+        // cgroup v2: "max 100000" or "<quota> <period>"
+        std::ifstream cpuMax(dir + "/cpu.max");
+        if (cpuMax) {
+            string quotaText;
+            if (!(cpuMax >> quotaText >> period)) {
+                continue;
+            }
+            if (quotaText != "max") {
+                const char* end = quotaText.data() + quotaText.size();
+                if (std::from_chars(quotaText.data(), end, quota).ptr != end) {
+                    continue;
+                }
+            }
+        } else {
+            // cgroup v1: the quota is -1 when there is none
+            std::ifstream quotaFile(dir + "/cpu.cfs_quota_us");
+            std::ifstream periodFile(dir + "/cpu.cfs_period_us");
+            if (!(quotaFile >> quota) || !(periodFile >> period)) {
+                continue;
+            }
+        }
+
+        if (quota > 0 && period > 0) {
+            size_t cpus = static_cast<size_t>((quota + period - 1) / period);
+            limit = (limit == 0) ? cpus : std::min(limit, cpus);
+        }
+    }
+
+    return limit;
+}
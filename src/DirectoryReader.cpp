@@ -6,16 +6,23 @@
  ******************************************************************************/
 
 #include "DirectoryReader.h"                // header file for class definition
-#include "FileAnalyzer.h"                   // for getting file info
+#include "FileTable.h"                      // for storing file info
+#include "AsyncStatEngine.h"                // for batched io_uring stat and open
+#include "Snapshot.h"                       // for reusing directories from a previous scan
+#include "HardLinkSet.h"                    // for counting hard linked files once
+#include "PathFilter.h"                     // for the include and exclude globs
+#include "MountTable.h"                     // for skipping pseudo filesystems and reading each mount its own way
+#include "LargestEntries.h"                 // for keeping the largest files
 #include <iostream>                         // for printing to console
-#include <dirent.h>                         // For directory functions
+#include <dirent.h>                         // For directory functions and getdents64()
+#include <fcntl.h>                          // For open() and fstatat() flags
+#include <unistd.h>                         // For close()
+#include <sys/sysmacros.h>                  // For makedev()
 #include <sys/types.h>                      // For data types used by dirent.h
 #include <sys/stat.h>                       // For the stat structure
 #include <cerrno>                           // For errno
 #include <cstring>                          // For strerror()
-#include <unordered_set>                    // For directories to skip
-#include <unordered_map>                    // For counting file extensions
-#include <algorithm>                        // for std::max_element
+#include <algorithm>                        // for std::sort and std::lower_bound
 #include <iterator>                         // for std::distance
 #include <memory>                           // for std::shared_ptr
 
@@ -25,18 +32,39 @@ using std::cout;
 using std::endl;
 using std::cerr;
 
+// The options shared by every reader in the scan
+ScanOptions DirectoryReader::scanOptions;
+
+// Sub-directories currently held open ahead of being read
+std::atomic<unsigned int> DirectoryReader::openDirectories(0);
+
+/******************************************************************************
+ * DirectoryStamp::operator== : Checks if two stamps describe the same version
+ *                              of the same directory.
+ ******************************************************************************/
+bool DirectoryStamp::operator==(const DirectoryStamp &other) const {
+    return dev == other.dev && ino == other.ino && mtimeSec == other.mtimeSec && mtimeNsec == other.mtimeNsec
+        && ctimeSec == other.ctimeSec && ctimeNsec == other.ctimeNsec;
+}
+
 //
 //  Constructors and Destructors
 //
 
 // Default constructor
-DirectoryReader::DirectoryReader() : totalSize(0), fileTotalSize(0), subDirTotalSize(0), numFiles(0) {}
+DirectoryReader::DirectoryReader()
+    : arena(nullptr), node(PathArena::NO_PARENT), openFd(-1), baselineDir(PathArena::NO_PARENT), filterState(0), mount(MountTable::NO_MOUNT), mountsHere(nullptr), rereading(false), reused(false), totalSize(0), fileTotalSize(0), subDirTotalSize(0), allocatedSize(0), fileAllocatedSize(0), numFiles(0),
+      subtreeFileCount(0), subtreeDirCount(0), releasedExtension(NO_EXTENSION) {}
 
-// Root directory constructor
-DirectoryReader::DirectoryReader(const string& dirPath) : path(dirPath) {parentPath = "";}
+// Constructor for a directory that already has a node in the arena
+DirectoryReader::DirectoryReader(PathArena& pathArena, uint32_t dirNode)
+    : arena(&pathArena), node(dirNode), openFd(-1), baselineDir(PathArena::NO_PARENT), filterState(0), mount(MountTable::NO_MOUNT), mountsHere(nullptr), rereading(false), reused(false), totalSize(0), fileTotalSize(0), subDirTotalSize(0), allocatedSize(0), fileAllocatedSize(0), numFiles(0),
+      subtreeFileCount(0), subtreeDirCount(0), releasedExtension(NO_EXTENSION) {}
 
-// Sub-directory constructor
-DirectoryReader::DirectoryReader(const string& dirPath, const string& parent) : path(dirPath), parentPath(parent) {}
+// Constructor for a sub-directory its parent found, the reader owns found.fd from now on
+DirectoryReader::DirectoryReader(PathArena& pathArena, const ChildDirectory& found)
+    : arena(&pathArena), node(found.node), openFd(found.fd), baselineDir(found.baseline), filterState(found.filterState), mount(found.mount), mountsHere(nullptr), rereading(false), reused(false), totalSize(0), fileTotalSize(0), subDirTotalSize(0), allocatedSize(0), fileAllocatedSize(0), numFiles(0),
+      subtreeFileCount(0), subtreeDirCount(0), releasedExtension(NO_EXTENSION) {}
 
 
 DirectoryReader::~DirectoryReader() {
@@ -48,32 +76,70 @@ DirectoryReader::~DirectoryReader() {
 //
 
 /******************************************************************************
- * getFiles: Returns a list of files if the directory is already specified.
+ * getFiles: Returns the files if the directory is already specified.
  * 
- * @return files: A vector of strings, each string being the path to a file
+ * @return files: A table with one row per file, valid until the directory changes
  ******************************************************************************/
-vector<FileAnalyzer> DirectoryReader::getFiles() const {
+const FileTable& DirectoryReader::getFiles() const {
     return files;
 }
 
+/******************************************************************************
+ * getFileName: Returns the name of one file without copying the table.
+ * 
+ * @param index: The row of the file
+ * @return The file's name
+ ******************************************************************************/
+std::string_view DirectoryReader::getFileName(size_t index) const {
+    return files.getName(index);
+}
+
+/******************************************************************************
+ * getFileSize: Returns the apparent size of one file.
+ * 
+ * @param index: The row of the file
+ * @return The file's size in bytes
+ ******************************************************************************/
+uint64_t DirectoryReader::getFileSize(size_t index) const {
+    return files.getSize(index);
+}
+
+/******************************************************************************
+ * getFileAllocatedSize: Returns the bytes allocated on disk to one file.
+ * 
+ * @param index: The row of the file
+ * @return The file's allocated bytes
+ ******************************************************************************/
+uint64_t DirectoryReader::getFileAllocatedSize(size_t index) const {
+    return files.getAllocatedSize(index);
+}
+
 /******************************************************************************
  * getDirectories: Returns a list of sub-directories in the given
  *                       directory.
  * 
- * @return directories: A vector of strings, each string being the path to a
- *                      directory
+ * @return directories: The sub-directories' nodes in the arena, valid until the directory changes
  ******************************************************************************/
-vector<string> DirectoryReader::getDirectories() const {
+const vector<uint32_t>& DirectoryReader::getDirectories() const {
     return directories;
 }
 
 /******************************************************************************
- * getParentPath: Returns the path of the parent directory.
+ * getParentNode: Returns the arena node of the parent directory.
  * 
- * @return parentPath: The path of the parent directory
+ * @return The parent's node, or PathArena::NO_PARENT for the root
  ******************************************************************************/
-string DirectoryReader::getParentPath() const {
-    return parentPath;
+uint32_t DirectoryReader::getParentNode() const {
+    return arena->getParent(node);
+}
+
+/******************************************************************************
+ * getNode: Returns the arena node of the directory.
+ * 
+ * @return node: The directory's node in the arena
+ ******************************************************************************/
+uint32_t DirectoryReader::getNode() const {
+    return node;
 }
 
 /******************************************************************************
@@ -86,7 +152,7 @@ double DirectoryReader::getAverageFileSize() const {
         return 0;
     }
 
-    return fileTotalSize / numFiles;
+    return static_cast<double>(fileTotalSize) / numFiles;
 }
 
 /******************************************************************************
@@ -101,50 +167,119 @@ double DirectoryReader::getAverageDirectorySize() const {
         return 0;
     }
 
-    return subDirTotalSize / directories.size();
+    return static_cast<double>(subDirTotalSize) / directories.size();
 }
 
 /******************************************************************************
  * getTopFileExtension: Returns the most common file extension in the
  *                          directory.
  * 
- * @return topExt: The most common file extension
+ * @return The most common file extension, empty if there are no files
  ******************************************************************************/
-string DirectoryReader::getTopFileExtension() const{
-    string topExt = "";
-    std::unordered_map<string, int> extCounts;
+std::string_view DirectoryReader::getTopFileExtension() const{
+    // The rows are gone, but the answer was kept when they were released
+    uint32_t top = (releasedExtension != NO_EXTENSION) ? releasedExtension : findTopExtension();
+    return (top != NO_EXTENSION) ? ExtensionTable::lookup(top) : std::string_view();
+}
 
-    // Count occurrences of each file extension
-    for (auto &file : files) {
-        string ext = file.getFileExtension();
-        extCounts[ext]++;
-    }
+/******************************************************************************
+ * getTotalSize: Returns the total size of all files in the directory and in
+ *               every directory below it.
+ * 
+ * @return totalSize: The total size of the directory's subtree
+ ******************************************************************************/
+uint64_t DirectoryReader::getTotalSize() const {
+    return totalSize;
+}
 
-    if (extCounts.empty()) {
-        return topExt; // No files, so return an empty string
-    }
+/******************************************************************************
+ * getFileTotalSize: Returns the size of the files directly in the directory.
+ * 
+ * @return fileTotalSize: The total size of the directory's own files
+ ******************************************************************************/
+uint64_t DirectoryReader::getFileTotalSize() const {
+    return fileTotalSize;
+}
 
-    // Find the most common file extension
-    auto maxElement = std::max_element(
-        extCounts.begin(), 
-        extCounts.end(), 
-        [](const auto& a, const auto& b) { return a.second < b.second; }
-    );
-    
-    topExt = maxElement->first;
-    return topExt;
+/******************************************************************************
+ * getAllocatedSize: Returns the bytes allocated on disk to the files in the
+ *                   directory and in every directory below it.
+ * 
+ * @return allocatedSize: The allocated size of the directory's subtree
+ ******************************************************************************/
+uint64_t DirectoryReader::getAllocatedSize() const {
+    return allocatedSize;
 }
 
 /******************************************************************************
- * getTotalSize: Returns the total size of all files in the directory.
+ * getFileAllocatedSize: Returns the bytes allocated on disk to the files
+ *                       directly in the directory.
  * 
- * @return totalSize: The total size of all files in the directory
+ * @return fileAllocatedSize: The allocated size of the directory's own files
  ******************************************************************************/
-double DirectoryReader::getTotalSize() const {
-    return totalSize;
+uint64_t DirectoryReader::getFileAllocatedSize() const {
+    return fileAllocatedSize;
+}
+
+/******************************************************************************
+ * getSubtreeFileCount: Returns the number of files in the directory and in
+ *                      every directory below it.
+ * 
+ * @return subtreeFileCount: The number of files in the directory's subtree
+ ******************************************************************************/
+uint64_t DirectoryReader::getSubtreeFileCount() const {
+    return subtreeFileCount;
+}
+
+/******************************************************************************
+ * getSubtreeDirCount: Returns the number of directories below the directory.
+ * 
+ * @return subtreeDirCount: The number of directories in the directory's
+ *                          subtree, not counting the directory itself
+ ******************************************************************************/
+uint64_t DirectoryReader::getSubtreeDirCount() const {
+    return subtreeDirCount;
 }
 
 
+/******************************************************************************
+ * getStamp: Returns the device, inode and times of the directory. They are
+ *           only filled in when scanOptions.recordStamps is set.
+ * 
+ * @return stamp: The directory's stamp
+ ******************************************************************************/
+const DirectoryStamp& DirectoryReader::getStamp() const {
+    return stamp;
+}
+
+/******************************************************************************
+ * wasReused: Checks if the directory's entries were taken from the baseline
+ *            snapshot because it hadn't changed since.
+ * 
+ * @return reused: true if the directory wasn't read again
+ ******************************************************************************/
+bool DirectoryReader::wasReused() const {
+    return reused;
+}
+
+/******************************************************************************
+ * getFilterState: Returns where the directory is in the filter's globs.
+ * 
+ * @return filterState: The directory's state in scanOptions.filter
+ ******************************************************************************/
+uint32_t DirectoryReader::getFilterState() const {
+    return filterState;
+}
+
+/******************************************************************************
+ * getMount: Returns the mount the directory is on.
+ * 
+ * @return mount: The mount's index in scanOptions.mounts, or MountTable::NO_MOUNT
+ ******************************************************************************/
+uint32_t DirectoryReader::getMount() const {
+    return mount;
+}
+
 /******************************************************************************
  * getNumFiles: Returns the number of files in the directory.
  * 
@@ -156,12 +291,12 @@ int DirectoryReader::getNumFiles() const {
 
 
 /******************************************************************************
- * getPath: Returns the path of the directory.
+ * getPath: Returns the path of the directory, rebuilt from the arena.
  * 
  * @return path: The path of the directory
  ******************************************************************************/
 string DirectoryReader::getPath() const {
-    return path;
+    return arena->getPath(node);
 }
 
 
@@ -169,110 +304,285 @@ string DirectoryReader::getPath() const {
 //  Public Methods
 //
 
+/******************************************************************************
+ * setScanOptions: Sets the options used by every DirectoryReader during a
+ *                 scan. This should be called before any directory is read.
+ * 
+ * @param options: The options to use
+ ******************************************************************************/
+void DirectoryReader::setScanOptions(const ScanOptions &options) {
+    scanOptions = options;
+}
+
+/******************************************************************************
+ * takeChildren: Takes what readDirectory() worked out for each sub-directory:
+ *               the descriptor it opened ahead of time, if any, the matching
+ *               baseline directory, the filter state and the mount. They line
+ *               up with getDirectories().
+ * 
+ * @return The sub-directories, their descriptors owned by the caller from now on
+ ******************************************************************************/
+vector<ChildDirectory> DirectoryReader::takeChildren() {
+    vector<ChildDirectory> taken = std::move(children);
+    children.clear();
+    return taken;
+}
+
+/******************************************************************************
+ * setPreviousDirectories:  Used when a directory is read again. Without it
+ *                          every sub-directory would get a new node, with it
+ *                          the ones that were there before keep theirs.
+ * 
+ * @param previous: The sub-directories from the previous read
+ ******************************************************************************/
+void DirectoryReader::setPreviousDirectories(const vector<uint32_t>& previous) {
+    rereading = true;
+    previousDirectories = previous;
+    std::sort(previousDirectories.begin(), previousDirectories.end(),
+        [this](uint32_t a, uint32_t b) { return arena->getName(a) < arena->getName(b); });
+}
+
+/******************************************************************************
+ * takeAddedDirectories: Takes the sub-directories that got a new node because
+ *                       they weren't among the previous ones.
+ * 
+ * @return The new sub-directories
+ ******************************************************************************/
+vector<uint32_t> DirectoryReader::takeAddedDirectories() {
+    vector<uint32_t> added = std::move(addedDirectories);
+    addedDirectories.clear();
+    vector<uint32_t>().swap(previousDirectories);   // Only needed while reading
+    return added;
+}
+
 /******************************************************************************
  * readDirectory:   Reads the directory specified in the constructor and stores
  *                  the files and sub-directories in the files and directories
  * 
+ * note:    The directory is kept open for the whole read and its entries are
+ *          pulled in large batches with getdents64(). Every entry is then
+ *          stat-ed once, relative to the directory's file descriptor, so the
+ *          kernel only has to resolve the entry's name instead of the full
+ *          path. Only the statx fields in scanOptions.statxMask are requested
+ *          and files are added to the table straight from that result. In
+ *          lazy-stat mode entries are classified from d_type and only stat-ed
+ *          when the filesystem doesn't fill it in.
+ * 
+ *          With scanOptions.asyncStat each batch of entries is stat-ed through
+ *          io_uring instead, and the sub-directories it finds are opened the
+ *          same way, so a single worker keeps hundreds of requests in flight
+ *          on filesystems where every one of them is a network round trip.
+ * 
+ *          With a baseline snapshot the directory's inode and times are
+ *          compared to the previous scan first. If none of them changed,
+ *          neither did the entries, so they are copied from the snapshot
+ *          instead of being read and stat-ed again.
+ * 
  * @return 1 if the directory was read successfully, 0 otherwise
  ******************************************************************************/
 int DirectoryReader::readDirectory() {
-    DIR* dir;                   // Pointer to a directory stream
-    struct dirent* entry;       // Pointer to a directory entry
-    struct stat entInfo;        // Information about the directory entry
-    string fullpath;            // A string to hold the full path of the entry
+    int dirFd = openFd;         // File descriptor of the open directory
+    bool openedAhead = (dirFd != -1);   // Whether the parent opened it for us
+    ssize_t bytesRead;          // Number of bytes returned by getdents64()
+    string path = getPath();    // The path of this directory, only built once
     fileTotalSize = 0;          // Reset the local size variable
+    fileAllocatedSize = 0;
     numFiles = 0;               // Reset the number of files variable
+    openFd = -1;                // The descriptor is closed below either way
+
+    // Each worker thread reuses its own buffers for the directory entries and their stat results
+    thread_local vector<char> entryBuffer(DIRENT_BUFFER_SIZE);
+    thread_local vector<const char*> entryNames;        // The names of the entries in the current batch
+    thread_local vector<struct statx> entryInfo;        // Information about each entry in the batch
+    thread_local vector<int> entryErrors;               // 0 or the errno from stat-ing each entry
+    thread_local vector<const char*> statNames;         // The entries that need an actual stat call
+    thread_local vector<size_t> statIndexes;            // Where each of those goes in the batch
+    thread_local vector<struct statx> statResults;      // The async stat results
+    thread_local vector<int> statErrors;                // The async stat errors
+    thread_local vector<const char*> newDirectories;    // The names of the sub-directories found in the batch
+
+    // Read the directory the way its mount needs, and find the mounts on its sub-directories
+    MountStrategy strategy;
+    if (scanOptions.mounts != nullptr) {
+        strategy = scanOptions.mounts->getStrategy(mount);
+        mountsHere = scanOptions.mounts->mountsIn(path);
+    }
+
+    // Only use io_uring if it was asked for, or the mount is slow enough to need it, and this thread could get a ring
+    bool useAsync = scanOptions.asyncStat || strategy.asyncStat;
+    AsyncStatEngine* engine = useAsync ? AsyncStatEngine::forThisThread() : nullptr;
 
     // Reset the errno variable
     errno = 0;
 
-    // Open the directory as a stream
-    dir = opendir(path.c_str());
-    if (dir == NULL) {
-        cerr << "\033[31mError opening directory: " << path << ". Error: " << strerror(errno) << "\033[0m" << endl;
-        return 0;  // return 0 to indicate failure
+    // Open the directory and keep its file descriptor for the whole read
+    if (dirFd == -1) {
+        dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd == -1) {
+            cerr << "\033[31mError opening directory: " << path << ". Error: " << strerror(errno) << "\033[0m" << endl;
+            return 0;  // return 0 to indicate failure
+        }
     }
 
-    // RAII approach to close dir automatically
-    auto dirCloser = [&]() { closedir(dir); };
-    std::shared_ptr<void> dirCloserGuard((void*)nullptr, [&](void*) { dirCloser(); });
-    
-    // Read files and directories within the current directory
-    while ((entry = readdir(dir)) != NULL) {
-        
-        // Get the full path of the entry
-        if(path != "/"){
-            fullpath = path + "/" + entry->d_name;
+    // RAII approach to close the directory automatically and give a descriptor opened ahead back to the budget
+    auto dirCloser = [&]() {
+        close(dirFd);
+        if (openedAhead) {
+            openDirectories.fetch_sub(1, std::memory_order_relaxed);
         }
-        else{
-            fullpath = path + entry->d_name;
+    };
+    std::shared_ptr<void> dirCloserGuard((void*)nullptr, [&](void*) { dirCloser(); });
+
+    // Stamp the directory so it can be compared with this scan next time
+    if (scanOptions.recordStamps) {
+        struct statx dirInfo;
+        const unsigned int stampMask = STATX_INO | STATX_MTIME | STATX_CTIME;
+        if (statx(dirFd, "", AT_EMPTY_PATH, stampMask, &dirInfo) == 0 && (dirInfo.stx_mask & stampMask) == stampMask) {
+            stamp.dev = makedev(dirInfo.stx_dev_major, dirInfo.stx_dev_minor);
+            stamp.ino = dirInfo.stx_ino;
+            stamp.mtimeSec = dirInfo.stx_mtime.tv_sec;
+            stamp.mtimeNsec = dirInfo.stx_mtime.tv_nsec;
+            stamp.ctimeSec = dirInfo.stx_ctime.tv_sec;
+            stamp.ctimeNsec = dirInfo.stx_ctime.tv_nsec;
         }
-        
-        // If there's an error stat-ing the path, skip it
-        if (lstat(fullpath.c_str(), &entInfo) == -1) {
-            cerr << "\033[31mError stat-ing path: " << fullpath << ". Error: " << strerror(errno) << "\033[0m" << endl;
-            continue;  // move on to the next directory entry
+    }
+
+    // Nothing was added, removed or renamed since the baseline, so take the entries from there
+    const Snapshot* baseline = scanOptions.baseline;
+    if (baseline != nullptr && baselineDir != PathArena::NO_PARENT && stamp.ino != 0
+        && stamp == baseline->getStamp(baselineDir)
+        && baseline->getDirectoryCount(baselineDir) == baseline->getDirectories(baselineDir).size()) {
+        reuseBaseline();
+        return 1;
+    }
+
+    // Read files and directories within the current directory one batch at a time
+    while ((bytesRead = getdents64(dirFd, entryBuffer.data(), entryBuffer.size())) > 0) {
+        entryNames.clear();
+        statNames.clear();
+        statIndexes.clear();
+        newDirectories.clear();
+
+        // Collect the batch first so all of it can be stat-ed together
+        for (ssize_t offset = 0; offset < bytesRead; ) {
+            struct dirent64* entry = reinterpret_cast<struct dirent64*>(entryBuffer.data() + offset);
+            offset += entry->d_reclen;
+
+            // Skip '.' and '..' before doing any work on them to avoid infinite loops
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            size_t index = entryNames.size();
+            entryNames.push_back(entry->d_name);
+            entryInfo.resize(entryNames.size());
+
+            // In lazy mode trust the type from the directory entry when the filesystem gives one,
+            // unless it's a directory and we need its device to stay on one filesystem
+            if (scanOptions.lazyStat && strategy.trustDType && entry->d_type != DT_UNKNOWN
+                && !(scanOptions.oneFileSystem && entry->d_type == DT_DIR)) {
+                entryInfo[index].stx_mask = STATX_TYPE;
+                entryInfo[index].stx_mode = DTTOIF(entry->d_type);
+            } else {
+                statNames.push_back(entry->d_name);
+                statIndexes.push_back(index);
+            }
         }
-        
-        if (S_ISLNK(entInfo.st_mode)) {
-            continue;  // skip symbolic links
+        entryErrors.assign(entryNames.size(), 0);
+
+        // Stat whatever couldn't be classified from d_type
+        if (engine != nullptr) {
+            engine->statBatch(dirFd, statNames, scanOptions.statxMask | STATX_TYPE, statResults, statErrors);
+            for (size_t i = 0; i < statIndexes.size(); ++i) {
+                entryInfo[statIndexes[i]] = statResults[i];
+                entryErrors[statIndexes[i]] = statErrors[i];
+            }
+        } else {
+            for (size_t i = 0; i < statIndexes.size(); ++i) {
+                if (statx(dirFd, statNames[i], AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                          scanOptions.statxMask | STATX_TYPE, &entryInfo[statIndexes[i]]) == -1) {
+                    entryErrors[statIndexes[i]] = errno;
+                }
+            }
         }
 
-        // Check if the entry is a directory
-        if (S_ISDIR(entInfo.st_mode)) {
-            // The entry is a directory
-
-            // Only do all this work if there are directories to skip
-            if(SKIP_DIRECTORIES.size() > 0){
-                bool shouldSkip = false;
-                for (auto skipDir : SKIP_DIRECTORIES) {
-                    // Check if the directory should be skipped
-                    if (fullpath.find(skipDir) != string::npos) {
-                        shouldSkip = true;
-                        break;  // exit the for loop
-                    }
-                }
-                if (shouldSkip) {
-                    continue;  // continue to the next iteration of the while loop
-                }
+        size_t firstNewDirectory = children.size();
+
+        for (size_t i = 0; i < entryNames.size(); ++i) {
+            const char* name = entryNames[i];
+            const struct statx& entInfo = entryInfo[i];
+
+            // If there's an error stat-ing the entry, skip it
+            if (entryErrors[i] != 0) {
+                cerr << "\033[31mError stat-ing path: " << childPath(path, name) << ". Error: " << strerror(entryErrors[i]) << "\033[0m" << endl;
+                continue;  // move on to the next directory entry
             }
 
-            // Skip '.' and '..' to avoid infinite loops
-            if (string(entry->d_name) != "." && string(entry->d_name) != "..") {
-                // Add the directory name to the list of directories
-                directories.push_back(fullpath);
+            if (S_ISLNK(entInfo.stx_mode)) {
+                continue;  // skip symbolic links
             }
 
-        } else {
-            // The entry is a file
+            // Check if the entry is a directory
+            if (S_ISDIR(entInfo.stx_mode)) {
+                // The entry is a directory
 
-            // Make an object to represent the file
-            FileAnalyzer file(fullpath, path);
-            file.analyzeFile();
+                // Skip the directory if the globs leave it out or it's on another filesystem, or give it a node
+                if (!keepDirectory(name, makedev(entInfo.stx_dev_major, entInfo.stx_dev_minor), PathArena::NO_PARENT)) {
+                    continue;  // continue to the next directory entry
+                }
+                newDirectories.push_back(name);
 
-            // Update the total size and number of files
-            fileTotalSize += file.getFileSize();
-            numFiles++;
+            } else {
+                // The entry is a file
+                if (scanOptions.filter != nullptr && !scanOptions.filter->acceptsFile(filterState, name)) {
+                    continue;  // left out by the globs
+                }
 
-            files.push_back(file);
+                // Add a row for the file using the statx result we already have
+                uint64_t fileSize = (entInfo.stx_mask & STATX_SIZE) ? entInfo.stx_size : 0;
+                uint64_t allocated = (entInfo.stx_mask & STATX_BLOCKS) ? entInfo.stx_blocks * 512 : 0;
+                bool linked = (entInfo.stx_mask & STATX_NLINK) && (entInfo.stx_mask & STATX_INO) && entInfo.stx_nlink > 1;
+                addFile(name, entInfo.stx_mode, fileSize, allocated, linked ? entInfo.stx_ino : 0,
+                        makedev(entInfo.stx_dev_major, entInfo.stx_dev_minor));
+            }
         }
-    }
 
-    // if there aren't any sub-directories, the total size is just the size of the files
-    if (directories.empty() && !files.empty()) {
-        totalSize += fileTotalSize;
+        // Open the new sub-directories now, while their names are still in the buffer. A directory read again
+        // keeps most of its sub-directories, which are already read, so nothing is opened for it.
+        if (engine != nullptr && !rereading && !newDirectories.empty()) {
+            openDirectoriesAhead(dirFd, newDirectories, firstNewDirectory);
+        }
     }
 
-
-    // Check if readdir() stopped due to an error
-    if (errno != 0) {
+    // Check if getdents64() stopped due to an error
+    if (bytesRead == -1) {
         cerr << "\033[31mError reading directory: " << path << ". Error: " << strerror(errno) << "\033[0m" << endl;
+        closeDirectoryFds();
         return 0;  // return 0 to indicate failure
     }
 
+    // Work out which sub-directories were already in the baseline, so they can be compared too
+    if (baseline != nullptr && baselineDir != PathArena::NO_PARENT) {
+        matchBaselines();
+    }
+
     return 1;  // return 1 to indicate success
 }
 
+/******************************************************************************
+ * releaseFiles:    Drops the rows of the files once nothing will ask for them
+ *                  by index again. The counts and sizes are kept in their own
+ *                  fields already, and the most common extension is worked
+ *                  out before the rows go, so the directory's record is the
+ *                  same as if they were still there.
+ ******************************************************************************/
+void DirectoryReader::releaseFiles() {
+    if (!files.empty()) {
+        releasedExtension = findTopExtension();
+    }
+    files = FileTable();
+}
+
 /******************************************************************************
  * canReadDirectory: Checks if the directory specified in the constructor can
  *                   be read.
@@ -286,7 +596,7 @@ int DirectoryReader::canReadDirectory() const {
     errno = 0;
 
     // Open the directory as a stream
-    dir = opendir(path.c_str());
+    dir = opendir(getPath().c_str());
     if (dir == NULL) {
         return 0;
     }
@@ -296,44 +606,325 @@ int DirectoryReader::canReadDirectory() const {
 }
 
 /******************************************************************************
- * addToTotalSize: Adds to the total size of all files and sub-directories in
- *                 the directory specified in the constructor.
+ * setSubtreeTotals: Stores the rolled-up totals of the directory. This is
+ *                   called once, when the last directory below this one has
+ *                   been read.
+ * 
+ * @param subDirSize: The total size of all sub-directories' subtrees
+ * @param subDirAllocated: The bytes allocated to all sub-directories' subtrees
+ * @param subtreeFiles: The number of files in the directory and below it
+ * @param subtreeDirs: The number of directories below the directory
+ ******************************************************************************/
+void DirectoryReader::setSubtreeTotals(uint64_t subDirSize, uint64_t subDirAllocated, uint64_t subtreeFiles,
+                                       uint64_t subtreeDirs){
+    subDirTotalSize = subDirSize;
+    totalSize = fileTotalSize + subDirSize;
+    allocatedSize = fileAllocatedSize + subDirAllocated;
+    subtreeFileCount = subtreeFiles;
+    subtreeDirCount = subtreeDirs;
+}
+
+/******************************************************************************
+ * chargeLinkedFile:    Counts a file with other links in the directory's own
+ *                      files, or stops counting it. addFile() leaves those
+ *                      out, the registry charges each to one directory.
+ * 
+ * @param size: The file's apparent size
+ * @param allocated: The bytes allocated to the file on disk
+ * @param charge: true to count the file, false to take it back out
+ ******************************************************************************/
+void DirectoryReader::chargeLinkedFile(uint64_t size, uint64_t allocated, bool charge) {
+    if (charge) {
+        fileTotalSize += size;
+        fileAllocatedSize += allocated;
+        totalSize += size;
+        allocatedSize += allocated;
+    } else {
+        fileTotalSize -= size;
+        fileAllocatedSize -= allocated;
+        totalSize -= size;
+        allocatedSize -= allocated;
+    }
+}
+
+/******************************************************************************
+ * chargeSubtree:   Counts a file with other links that was charged to a
+ *                  directory below this one, or stops counting it.
+ * 
+ * @param size: The file's apparent size
+ * @param allocated: The bytes allocated to the file on disk
+ * @param charge: true to count the file, false to take it back out
+ ******************************************************************************/
+void DirectoryReader::chargeSubtree(uint64_t size, uint64_t allocated, bool charge) {
+    if (charge) {
+        subDirTotalSize += size;
+        totalSize += size;
+        allocatedSize += allocated;
+    } else {
+        subDirTotalSize -= size;
+        totalSize -= size;
+        allocatedSize -= allocated;
+    }
+}
+
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * childPath: Builds the full path of an entry inside a directory.
+ * 
+ * @param path: The path of the directory
+ * @param name: The name of the entry
+ * @return The full path of the entry
+ ******************************************************************************/
+string DirectoryReader::childPath(const string& path, const char* name) {
+    if (path != "/") {
+        return path + "/" + name;
+    }
+    return path + name;
+}
+
+/******************************************************************************
+ * findTopExtension:    Counts the files' extensions in a table indexed by
+ *                      extension id that each thread keeps and zeroes again
+ *                      after every use, so no map is built per directory. Of
+ *                      extensions that are equally common, the one that sorts
+ *                      first wins, so the answer depends neither on the order
+ *                      the files were read in nor on the order ids were
+ *                      handed out. A scan, an incremental scan and a snapshot
+ *                      of the same directory all agree.
+ * 
+ * @return The id of the most common extension, NO_EXTENSION if there are no files
+ ******************************************************************************/
+uint32_t DirectoryReader::findTopExtension() const {
+    thread_local vector<uint32_t> counts;   // How many files have each extension, all 0 between calls
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        uint32_t id = files.getExtensionId(i);
+        if (id >= counts.size()) {
+            counts.resize(id + 1, 0);
+        }
+        ++counts[id];
+    }
+
+    // Only a tie between two different extensions needs their names
+    uint32_t top = NO_EXTENSION;
+    uint32_t topCount = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        uint32_t id = files.getExtensionId(i);
+        if (counts[id] > topCount
+            || (counts[id] == topCount && id != top && ExtensionTable::lookup(id) < ExtensionTable::lookup(top))) {
+            topCount = counts[id];
+            top = id;
+        }
+    }
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        counts[files.getExtensionId(i)] = 0;
+    }
+    return top;
+}
+
+/******************************************************************************
+ * directoryNode:   Returns the arena node for a sub-directory. Nodes are
+ *                  never freed, so when a directory is read again the ones
+ *                  its sub-directories had are looked up by name first.
  * 
- * @param size: The size to add to the total size of all files and
- *              sub-directories
+ * @param name: The name of the sub-directory
+ * @return Its node
  ******************************************************************************/
-void DirectoryReader::addToTotalSize(double size){
-    totalSize += size;
+uint32_t DirectoryReader::directoryNode(std::string_view name) {
+    if (!rereading) {
+        return arena->addNode(node, name);
+    }
+
+    auto match = std::lower_bound(previousDirectories.begin(), previousDirectories.end(), name,
+        [this](uint32_t child, std::string_view value) { return arena->getName(child) < value; });
+    if (match != previousDirectories.end() && arena->getName(*match) == name) {
+        return *match;
+    }
+
+    uint32_t added = arena->addNode(node, name);
+    addedDirectories.push_back(added);
+    return added;
 }
 
 /******************************************************************************
- * addToSubDirTotalSize: Adds to the total size of all sub-directories in the
- *                       directory specified in the constructor.
+ * addFile: Adds a file to the table and to the directory's totals. A file
+ *          with several links would be counted once for every directory that
+ *          links to it, so it only goes into the hard link set here and the
+ *          registry charges it to one of them once every link has been read.
+ *          It is offered to the largest files at the same time. A streamed
+ *          scan can't wait, so there the first link read counts right away.
+ *          The file is still listed everywhere, unless no report lists files.
  * 
- * @param size: The size to add to the total size of all sub-directories
+ * @param name: The name of the file
+ * @param mode: The raw mode bits
+ * @param size: The apparent size in bytes
+ * @param allocated: The bytes allocated on disk
+ * @param linkedInode: The inode number if the file has other links, 0 otherwise
+ * @param dev: The device the file is on
  ******************************************************************************/
-void DirectoryReader::addToSubDirTotalSize(double size){
-    subDirTotalSize += size;
+void DirectoryReader::addFile(std::string_view name, mode_t mode, uint64_t size, uint64_t allocated,
+                              uint64_t linkedInode, uint64_t dev) {
+    if (scanOptions.listFiles) {
+        files.addFile(name, mode, size, allocated, linkedInode);
+    }
+    numFiles++;
+
+    if (linkedInode == 0 || scanOptions.hardLinks == nullptr
+        || scanOptions.hardLinks->addLink(dev, linkedInode, node, name, size, allocated)) {
+        fileTotalSize += size;
+        fileAllocatedSize += allocated;
+        if (scanOptions.largest != nullptr) {
+            scanOptions.largest->offerFile(node, name, size, allocated);
+        }
+    }
 }
 
+/******************************************************************************
+ * openDirectoriesAhead: Opens a batch of sub-directories through io_uring so
+ *                       the tasks that read them don't each block on an
+ *                       open(). Only as many are opened as the scan-wide
+ *                       budget allows, the rest open themselves later.
+ * 
+ * @param dirFd: The open descriptor of this directory
+ * @param names: The names of the sub-directories, in the order they were added
+ * @param firstDirectory: The index in children of the first of them
+ ******************************************************************************/
+void DirectoryReader::openDirectoriesAhead(int dirFd, const vector<const char*>& names, size_t firstDirectory) {
+    thread_local vector<const char*> toOpen;    // The names that fit in the budget
+    thread_local vector<int> fds;               // Their descriptors, or -errno
+
+    // Reserve room in the budget for as many of the names as will fit
+    unsigned int limit = scanOptions.maxOpenDirectories;
+    unsigned int current = openDirectories.load(std::memory_order_relaxed);
+    unsigned int granted;
+    do {
+        granted = (current < limit) ? std::min<unsigned int>(limit - current, names.size()) : 0;
+    } while (granted > 0 && !openDirectories.compare_exchange_weak(current, current + granted, std::memory_order_relaxed));
+
+    if (granted == 0) {
+        return;
+    }
+
+    toOpen.assign(names.begin(), names.begin() + granted);
+    AsyncStatEngine::forThisThread()->openBatch(dirFd, toOpen, fds);
+
+    unsigned int failed = 0;
+    for (size_t i = 0; i < granted; ++i) {
+        if (fds[i] >= 0) {
+            children[firstDirectory + i].fd = fds[i];
+        } else {
+            failed++;   // The child will try again itself and report the error
+        }
+    }
+    openDirectories.fetch_sub(failed, std::memory_order_relaxed);
+}
 
 /******************************************************************************
- * operator= : Overloads the assignment operator to copy the contents of one
- *             DirectoryReader object to another.
+ * reuseBaseline: Fills the directory in from the baseline snapshot. Its
+ *                sub-directories still get nodes and are visited, since
+ *                something deeper down may have changed.
+ ******************************************************************************/
+void DirectoryReader::reuseBaseline() {
+    const Snapshot& baseline = *scanOptions.baseline;
+    reused = true;
+
+    for (size_t i = 0; i < baseline.getFileCount(baselineDir); ++i) {
+        const SnapshotFile& file = baseline.getFileRecord(baselineDir, i);
+        if (scanOptions.filter != nullptr && !scanOptions.filter->acceptsFile(filterState, baseline.getFileName(baselineDir, i))) {
+            continue;
+        }
+        addFile(baseline.getFileName(baselineDir, i), file.mode, file.size, file.allocated, file.linkedInode, stamp.dev);
+    }
+
+    for (uint32_t child : baseline.getDirectories(baselineDir)) {
+        keepDirectory(baseline.getName(child), baseline.getStamp(child).dev, child);
+    }
+}
+
+/******************************************************************************
+ * matchBaselines: Looks up every sub-directory that was just read among the
+ *                 baseline directory's children. They are sorted by name in
+ *                 the snapshot, so each one is a binary search.
+ ******************************************************************************/
+void DirectoryReader::matchBaselines() {
+    const Snapshot& baseline = *scanOptions.baseline;
+    DirectoryList baselineChildren = baseline.getDirectories(baselineDir);
+    vector<uint32_t> oldChildren(baselineChildren.begin(), baselineChildren.end());
+
+    for (ChildDirectory& child : children) {
+        std::string_view name = arena->getName(child.node);
+        auto match = std::lower_bound(oldChildren.begin(), oldChildren.end(), name,
+            [&baseline](uint32_t old, std::string_view value) { return baseline.getName(old) < value; });
+        if (match != oldChildren.end() && baseline.getName(*match) == name) {
+            child.baseline = *match;
+        }
+    }
+}
+
+/******************************************************************************
+ * keepDirectory:   Checks a sub-directory against the globs, the mount table
+ *                  and, with scanOptions.oneFileSystem, the root's device.
+ *                  This runs before the sub-directory gets a node, so one
+ *                  that is left out is never opened, and nothing below it is
+ *                  looked at. One that is kept gets its node and its entry
+ *                  in children.
  * 
- * @param other: A reference to the DirectoryReader object to be copied
- * @return *this: A reference to the DirectoryReader object that was copied to
+ * @param name: The name of the sub-directory
+ * @param dev: The device the sub-directory is on
+ * @param baseline: The sub-directory in the baseline snapshot, or PathArena::NO_PARENT
+ * @return true if it should be visited
  ******************************************************************************/
-DirectoryReader& DirectoryReader:: operator=(const DirectoryReader& other) {
-    if (this != &other) {  // self-assignment check
-        path = other.path;
-        parentPath = other.parentPath;
-        files = other.files;
-        directories = other.directories;
-        totalSize = other.totalSize;
-        fileTotalSize = other.fileTotalSize;
-        subDirTotalSize = other.subDirTotalSize;
-        numFiles = other.numFiles;
+bool DirectoryReader::keepDirectory(std::string_view name, uint64_t dev, uint32_t baseline) {
+    if (scanOptions.oneFileSystem && dev != scanOptions.device) {
+        return false;
     }
-    return *this;
-}
\ No newline at end of file
+
+    // A mount point starts a new mount, anything else stays on this one
+    uint32_t childMount = mount;
+    if (mountsHere != nullptr) {
+        uint32_t found = scanOptions.mounts->findMount(*mountsHere, name);
+        if (found != MountTable::NO_MOUNT && scanOptions.mounts->getStrategy(found).skip) {
+            if (scanOptions.mounts->firstSkip(found)) {
+                const Mount& skipped = scanOptions.mounts->getMount(found);
+                cerr << "\033[33mSkipping " << skipped.path << ": " << skipped.fsType << " filesystem\033[0m" << endl;
+            }
+            return false;
+        }
+        if (found != MountTable::NO_MOUNT) {
+            childMount = found;
+        }
+    }
+
+    uint32_t state = 0;
+    if (scanOptions.filter != nullptr) {
+        state = scanOptions.filter->enterDirectory(filterState, name);
+        if (state == PathFilter::SKIP) {
+            return false;
+        }
+    }
+
+    uint32_t child = directoryNode(name);
+    directories.push_back(child);
+    children.push_back(ChildDirectory{child, -1, baseline, state,
+                                      (scanOptions.mounts != nullptr) ? childMount : MountTable::NO_MOUNT});
+    return true;
+}
+
+/******************************************************************************
+ * closeDirectoryFds: Closes the sub-directory descriptors that were opened
+ *                    ahead of time but will never be read.
+ ******************************************************************************/
+void DirectoryReader::closeDirectoryFds() {
+    for (ChildDirectory& child : children) {
+        if (child.fd != -1) {
+            close(child.fd);
+            openDirectories.fetch_sub(1, std::memory_order_relaxed);
+            child.fd = -1;
+        }
+    }
+}
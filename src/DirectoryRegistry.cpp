@@ -0,0 +1,552 @@
+/******************************************************************************
+ * File: DirectoryRegistry.cpp
+ * Description: Holds every directory the scan has finished reading, indexed
+ *              by its node in the PathArena so workers can add results
+ *              without a global lock. It also rolls sizes up the tree: every
+ *              directory counts the children it is still waiting on, and the
+ *              last child to finish folds the directory into its parent.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "DirectoryRegistry.h"              // header file for class definition
+#include "HardLinkSet.h"                    // for charging files with several links once
+#include "LargestEntries.h"                 // for keeping the largest directories
+#include "ScanStream.h"                     // for writing directories as they finish
+#include <string>                           // for comparing the paths of directories linking to a file
+#include <unordered_set>                    // for the links a directory read again still has
+#include <utility>                          // for std::move
+#include <vector>                           // for the stack erase() walks the subtree with
+
+//
+//  Constructors and Destructors
+//
+
+DirectoryRegistry::DirectoryRegistry(const PathArena &arena)
+    : arena(arena), largest(nullptr), stream(nullptr), hardLinks(nullptr),
+      chunks(new std::atomic<Slot*>[MAX_CHUNKS]) {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+DirectoryRegistry::~DirectoryRegistry() {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        delete[] chunks[i].load(std::memory_order_relaxed);
+    }
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * insert:  Moves a read directory into the slot of its arena node. Every node
+ *          is read by exactly one worker, so the slot needs no lock, only the
+ *          ready flag to publish it to other threads. The directory waits on
+ *          each of its sub-directories plus itself, so none of the children
+ *          can finish it before finishDirectory() is called.
+ *
+ * note:    When streaming, the files' rows are dropped here. From then on
+ *          only their totals are needed, by the roll-up and by the record.
+ *
+ * @param dir: The directory to move in
+ ******************************************************************************/
+void DirectoryRegistry::insert(DirectoryReader&& dir) {
+    if (stream != nullptr) {
+        dir.releaseFiles();
+    }
+
+    Slot& slot = slotFor(dir.getNode());
+    slot.pendingChildren.store(static_cast<uint32_t>(dir.getDirectories().size()) + 1, std::memory_order_relaxed);
+    slot.dir.reset(new DirectoryReader(std::move(dir)));
+    slot.ready.store(true, std::memory_order_release);
+}
+
+/******************************************************************************
+ * insertFailed: Records a directory that couldn't be read. It stays out of
+ *               the registry but still has to be folded into its parent,
+ *               which is waiting on it. finishDirectory() does that.
+ *
+ * @param node: The arena node of the directory
+ ******************************************************************************/
+void DirectoryRegistry::insertFailed(uint32_t node) {
+    slotFor(node).pendingChildren.store(1, std::memory_order_relaxed);
+}
+
+/******************************************************************************
+ * finishDirectory: Drops a directory's hold on itself. When that was the last
+ *                  thing it was waiting on, its totals are final: they are
+ *                  stored in the directory and folded into the parent, and if
+ *                  the parent was only waiting on this child, the same
+ *                  happens to the parent, and so on up the tree.
+ *
+ * note:    The counters are only ever added to before the decrement that
+ *          releases them, and the decrement that reaches zero acquires all of
+ *          them, so the totals are exact and the same on every run. Files
+ *          with several links aren't in them yet, chargeHardLinks() adds
+ *          those once every link has been read.
+ *
+ * @param node: The arena node of the directory
+ ******************************************************************************/
+void DirectoryRegistry::finishDirectory(uint32_t node) {
+    while (node != PathArena::NO_PARENT) {
+        Slot& slot = slotFor(node);
+
+        // Someone else is still working below this directory, they will finish it
+        if (slot.pendingChildren.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+
+        uint64_t subDirBytes = slot.childBytes.load(std::memory_order_relaxed);
+        uint64_t subDirAllocated = slot.childAllocated.load(std::memory_order_relaxed);
+        uint64_t files = slot.childFiles.load(std::memory_order_relaxed);
+        uint64_t dirs = slot.childDirs.load(std::memory_order_relaxed);
+        uint64_t bytes = subDirBytes;
+        uint64_t allocated = subDirAllocated;
+
+        // Failed directories have no files of their own and no record to update
+        if (slot.ready.load(std::memory_order_acquire)) {
+            files += slot.dir->getNumFiles();
+            bytes += slot.dir->getFileTotalSize();
+            allocated += slot.dir->getFileAllocatedSize();
+            slot.dir->setSubtreeTotals(subDirBytes, subDirAllocated, files, dirs);
+            if (largest != nullptr) {
+                largest->offerDirectory(node, bytes, allocated);
+            }
+
+            // Nothing reads a finished directory during a streamed scan, so once it's written it goes
+            if (stream != nullptr) {
+                stream->directoryFinished(node);
+                slot.ready.store(false, std::memory_order_release);
+                slot.dir.reset();
+            }
+        }
+
+        // Fold this directory into its parent and move up
+        uint32_t parent = arena.getParent(node);
+        if (parent != PathArena::NO_PARENT) {
+            Slot& parentSlot = slotFor(parent);
+
+            // A parent waiting on nothing already has its totals, this subtree was added to a finished
+            // scan. During a scan that can't happen, since the parent waits on this directory.
+            if (parentSlot.pendingChildren.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+            parentSlot.childBytes.fetch_add(bytes, std::memory_order_relaxed);
+            parentSlot.childAllocated.fetch_add(allocated, std::memory_order_relaxed);
+            parentSlot.childFiles.fetch_add(files, std::memory_order_relaxed);
+            parentSlot.childDirs.fetch_add(dirs + 1, std::memory_order_relaxed);
+        }
+        node = parent;
+    }
+}
+
+/******************************************************************************
+ * setLargestEntries:   Has finishDirectory() offer each directory's totals
+ *                      to the largest directories as soon as they are final,
+ *                      on whichever worker finishes it.
+ *
+ * @param largestEntries: Where to offer them, or nullptr to stop
+ ******************************************************************************/
+void DirectoryRegistry::setLargestEntries(LargestEntries *largestEntries) {
+    largest = largestEntries;
+}
+
+/******************************************************************************
+ * setStream:   Has finishDirectory() write each directory to the stream as
+ *              soon as its totals are final, and release it afterwards, so
+ *              a streamed scan only holds the directories still in progress.
+ *
+ * @param scanStream: Where to write them, or nullptr to stop
+ ******************************************************************************/
+void DirectoryRegistry::setStream(ScanStream *scanStream) {
+    stream = scanStream;
+}
+
+/******************************************************************************
+ * setHardLinks:    Has chargeHardLinks() charge the files in a hard link set,
+ *                  and replace() and erase() let go of the links of the
+ *                  directories they throw away.
+ *
+ * @param hardLinkSet: The links the scan found, or nullptr to stop
+ ******************************************************************************/
+void DirectoryRegistry::setHardLinks(HardLinkSet *hardLinkSet) {
+    hardLinks = hardLinkSet;
+}
+
+/******************************************************************************
+ * chargeHardLinks: Counts every file with several links that changed since
+ *                  the last call in exactly one of the directories linking
+ *                  to it: the one with the smallest path, which comes before
+ *                  everything below it. The choice only depends on the tree,
+ *                  so the totals are the same on every run. The file is
+ *                  added to that directory and to every directory above it,
+ *                  after being taken out of the one charged before, if any.
+ *
+ * note:    The directories were offered to the largest directories without
+ *          their linked files, so once anything is charged they are offered
+ *          again with the totals they have now.
+ ******************************************************************************/
+void DirectoryRegistry::chargeHardLinks() {
+    if (hardLinks == nullptr) {
+        return;
+    }
+
+    bool charged = false;
+    std::string path;
+    std::string bestPath;
+    hardLinks->forEachChanged([&](HardLinkSet::Inode &inode) {
+        if (inode.owner != HardLinkSet::NO_OWNER && contains(inode.owner)) {
+            chargeUp(inode.owner, inode.chargedSize, inode.chargedAllocated, false);
+        }
+        inode.owner = HardLinkSet::NO_OWNER;
+
+        const HardLinkSet::Link *best = nullptr;
+        for (const HardLinkSet::Link &link : inode.links) {
+            if (!contains(link.directory)) {
+                continue;
+            }
+            path.clear();
+            arena.appendPath(link.directory, path);
+            if (best == nullptr || path < bestPath) {
+                best = &link;
+                bestPath.swap(path);
+            }
+        }
+        if (best == nullptr) {
+            return;
+        }
+
+        chargeUp(best->directory, inode.size, inode.allocated, true);
+        inode.owner = best->directory;
+        inode.chargedSize = inode.size;
+        inode.chargedAllocated = inode.allocated;
+        if (largest != nullptr) {
+            largest->offerFile(best->directory, best->name, inode.size, inode.allocated);
+        }
+        charged = true;
+    });
+
+    if (charged && largest != nullptr) {
+        largest->clearDirectories();
+        for (uint32_t node = 0; node < arena.size(); ++node) {
+            if (contains(node)) {
+                const DirectoryReader &dir = get(node);
+                largest->offerDirectory(node, dir.getTotalSize(), dir.getAllocatedSize());
+            }
+        }
+    }
+}
+
+/******************************************************************************
+ * replace: Moves a directory that was read again into the slot it already
+ *          had. It isn't waiting on anything, so sub-directories scanned
+ *          below it later stop rolling up there and refreshTotals() fills
+ *          in its totals instead.
+ *
+ * @param dir: The directory to move in
+ ******************************************************************************/
+void DirectoryRegistry::replace(DirectoryReader&& dir) {
+    Slot& slot = slotFor(dir.getNode());
+    if (slot.ready.load(std::memory_order_acquire)) {
+        releaseLinks(dir.getNode(), *slot.dir, &dir);
+    }
+    slot.pendingChildren.store(0, std::memory_order_relaxed);
+    slot.dir.reset(new DirectoryReader(std::move(dir)));
+    slot.ready.store(true, std::memory_order_release);
+}
+
+/******************************************************************************
+ * erase:   Takes a directory that no longer exists out of the registry, along
+ *          with everything below it. The nodes stay in the arena, they just
+ *          aren't reported on anymore.
+ *
+ * @param node: The arena node of the directory
+ ******************************************************************************/
+void DirectoryRegistry::erase(uint32_t node) {
+    std::vector<uint32_t> stack = {node};
+
+    while (!stack.empty()) {
+        uint32_t current = stack.back();
+        Slot& slot = slotFor(current);
+        stack.pop_back();
+
+        if (slot.ready.load(std::memory_order_acquire)) {
+            for (uint32_t child : slot.dir->getDirectories()) {
+                stack.push_back(child);
+            }
+            releaseLinks(current, *slot.dir, nullptr);
+        }
+
+        slot.ready.store(false, std::memory_order_release);
+        slot.dir.reset();
+        slot.pendingChildren.store(0, std::memory_order_relaxed);
+        slot.childBytes.store(0, std::memory_order_relaxed);
+        slot.childAllocated.store(0, std::memory_order_relaxed);
+        slot.childFiles.store(0, std::memory_order_relaxed);
+        slot.childDirs.store(0, std::memory_order_relaxed);
+    }
+}
+
+/******************************************************************************
+ * refreshTotals:   Recomputes a directory's totals from the totals its
+ *                  children have now, the same way finishDirectory() adds
+ *                  them up, and repeats that for every directory above it.
+ *                  Only the path to the root is touched, so a change costs
+ *                  the children of each directory on that path.
+ *
+ * @param node: The arena node of the directory that changed
+ ******************************************************************************/
+void DirectoryRegistry::refreshTotals(uint32_t node) {
+    while (node != PathArena::NO_PARENT) {
+        Slot& slot = slotFor(node);
+        if (slot.ready.load(std::memory_order_acquire)) {
+            uint64_t subDirBytes = 0;
+            uint64_t subDirAllocated = 0;
+            uint64_t files = slot.dir->getNumFiles();
+            uint64_t dirs = 0;
+
+            // Sub-directories that couldn't be read still count as a directory
+            for (uint32_t child : slot.dir->getDirectories()) {
+                if (contains(child)) {
+                    const DirectoryReader& childDir = get(child);
+                    subDirBytes += childDir.getTotalSize();
+                    subDirAllocated += childDir.getAllocatedSize();
+                    files += childDir.getSubtreeFileCount();
+                    dirs += childDir.getSubtreeDirCount();
+                }
+                dirs++;
+            }
+            slot.dir->setSubtreeTotals(subDirBytes, subDirAllocated, files, dirs);
+        }
+        node = arena.getParent(node);
+    }
+}
+
+/******************************************************************************
+ * contains: Checks if a directory has been inserted.
+ *
+ * @param node: The arena node of the directory
+ * @return true if the directory is in the registry
+ ******************************************************************************/
+bool DirectoryRegistry::contains(uint32_t node) const {
+    const Slot* slot = findSlot(node);
+    return slot != nullptr && slot->ready.load(std::memory_order_acquire);
+}
+
+/******************************************************************************
+ * get: Retrieves a directory that has been inserted.
+ *
+ * @param node: The arena node of the directory
+ * @return The directory
+ ******************************************************************************/
+DirectoryReader& DirectoryRegistry::get(uint32_t node) {
+    return *slotFor(node).dir;
+}
+
+const DirectoryReader& DirectoryRegistry::get(uint32_t node) const {
+    return *findSlot(node)->dir;
+}
+
+//
+//  DirectorySource
+//
+
+/******************************************************************************
+ * getPath: Rebuilds the path of a directory from the arena.
+ ******************************************************************************/
+std::string DirectoryRegistry::getPath(uint32_t node) const {
+    return arena.getPath(node);
+}
+
+/******************************************************************************
+ * getName: Returns the name of a directory, the root's is the path it was
+ *          given as.
+ ******************************************************************************/
+std::string_view DirectoryRegistry::getName(uint32_t node) const {
+    return arena.getName(node);
+}
+
+/******************************************************************************
+ * appendPath: Appends the path of a directory, rebuilt from the arena.
+ ******************************************************************************/
+void DirectoryRegistry::appendPath(uint32_t node, std::string &out) const {
+    arena.appendPath(node, out);
+}
+
+/******************************************************************************
+ * getDirectories: Returns the sub-directories of an inserted directory, as
+ *                 they are in the directory.
+ ******************************************************************************/
+DirectoryList DirectoryRegistry::getDirectories(uint32_t node) const {
+    return DirectoryList(get(node).getDirectories());
+}
+
+/******************************************************************************
+ * getDirectoryCount: Returns the number of sub-directories an inserted
+ *                    directory had, whether they could be read or not.
+ ******************************************************************************/
+size_t DirectoryRegistry::getDirectoryCount(uint32_t node) const {
+    return get(node).getDirectories().size();
+}
+
+/******************************************************************************
+ * getFileCount: Returns the number of files in an inserted directory.
+ ******************************************************************************/
+size_t DirectoryRegistry::getFileCount(uint32_t node) const {
+    return get(node).getNumFiles();
+}
+
+/******************************************************************************
+ * getFileName: Returns the name of a file in an inserted directory.
+ ******************************************************************************/
+std::string_view DirectoryRegistry::getFileName(uint32_t node, size_t file) const {
+    return get(node).getFileName(file);
+}
+
+/******************************************************************************
+ * getFileSize: Returns the size of a file in an inserted directory.
+ ******************************************************************************/
+uint64_t DirectoryRegistry::getFileSize(uint32_t node, size_t file) const {
+    return get(node).getFileSize(file);
+}
+
+/******************************************************************************
+ * getFileAllocatedSize: Returns the bytes allocated to a file in an inserted
+ *                       directory.
+ ******************************************************************************/
+uint64_t DirectoryRegistry::getFileAllocatedSize(uint32_t node, size_t file) const {
+    return get(node).getFileAllocatedSize(file);
+}
+
+/******************************************************************************
+ * getTotalSize: Returns the rolled-up size of an inserted directory.
+ ******************************************************************************/
+uint64_t DirectoryRegistry::getTotalSize(uint32_t node) const {
+    return get(node).getTotalSize();
+}
+
+/******************************************************************************
+ * getAllocatedSize: Returns the rolled-up allocated size of an inserted
+ *                   directory.
+ ******************************************************************************/
+uint64_t DirectoryRegistry::getAllocatedSize(uint32_t node) const {
+    return get(node).getAllocatedSize();
+}
+
+/******************************************************************************
+ * getSubtreeDirCount: Returns the rolled-up number of directories below an
+ *                     inserted directory.
+ ******************************************************************************/
+uint64_t DirectoryRegistry::getSubtreeDirCount(uint32_t node) const {
+    return get(node).getSubtreeDirCount();
+}
+
+/******************************************************************************
+ * getAverageDirectorySize: Returns the average sub-directory size of an
+ *                          inserted directory.
+ ******************************************************************************/
+double DirectoryRegistry::getAverageDirectorySize(uint32_t node) const {
+    return get(node).getAverageDirectorySize();
+}
+
+/******************************************************************************
+ * getAverageFileSize: Returns the average file size of an inserted directory.
+ ******************************************************************************/
+double DirectoryRegistry::getAverageFileSize(uint32_t node) const {
+    return get(node).getAverageFileSize();
+}
+
+/******************************************************************************
+ * getTopFileExtension: Returns the most common extension in an inserted
+ *                      directory.
+ ******************************************************************************/
+std::string_view DirectoryRegistry::getTopFileExtension(uint32_t node) const {
+    return get(node).getTopFileExtension();
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * slotFor: Returns the slot for a node. The chunk is allocated the first time
+ *          a node in it is needed, whichever thread gets there first wins.
+ ******************************************************************************/
+DirectoryRegistry::Slot& DirectoryRegistry::slotFor(uint32_t node) {
+    size_t chunkIndex = node / SLOTS_PER_CHUNK;
+
+    Slot *chunk = chunks[chunkIndex].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        Slot *newChunk = new Slot[SLOTS_PER_CHUNK];
+        if (chunks[chunkIndex].compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel)) {
+            chunk = newChunk;
+        } else {
+            delete[] newChunk;  // Another thread allocated the chunk first
+        }
+    }
+
+    return chunk[node % SLOTS_PER_CHUNK];
+}
+
+/******************************************************************************
+ * findSlot: Returns the slot for a node without allocating anything.
+ ******************************************************************************/
+const DirectoryRegistry::Slot* DirectoryRegistry::findSlot(uint32_t node) const {
+    const Slot *chunk = chunks[node / SLOTS_PER_CHUNK].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    return &chunk[node % SLOTS_PER_CHUNK];
+}
+
+/******************************************************************************
+ * releaseLinks:    Tells the hard link set that a directory's reader is
+ *                  going away. Links the directory no longer has are
+ *                  forgotten, and whatever it was charged with goes with the
+ *                  old reader, so the next chargeHardLinks() picks an owner
+ *                  again. The totals above it are left to refreshTotals().
+ *
+ * note:    The links are looked up on the directory's own device. Only a
+ *          file mounted over another one could be on a different one.
+ *
+ * @param node: The arena node of the directory
+ * @param old: The reader going away
+ * @param current: The reader taking its place, or nullptr if the directory is gone
+ ******************************************************************************/
+void DirectoryRegistry::releaseLinks(uint32_t node, const DirectoryReader &old, const DirectoryReader *current) {
+    if (hardLinks == nullptr || old.getFiles().getLinkedInodes().empty()) {
+        return;
+    }
+
+    std::unordered_set<uint64_t> kept;
+    if (current != nullptr) {
+        kept.insert(current->getFiles().getLinkedInodes().begin(), current->getFiles().getLinkedInodes().end());
+    }
+    uint64_t dev = old.getStamp().dev;
+    for (uint64_t ino : old.getFiles().getLinkedInodes()) {
+        if (kept.count(ino)) {
+            hardLinks->dropCharge(dev, ino, node);
+        } else {
+            hardLinks->removeLink(dev, ino, node);
+        }
+    }
+}
+
+/******************************************************************************
+ * chargeUp:    Adds a file to the totals of the directory charged with it
+ *              and of every directory above it, or takes it back out.
+ *
+ * @param node: The arena node of the directory charged with the file
+ * @param size: The file's apparent size
+ * @param allocated: The bytes allocated to the file on disk
+ * @param charge: true to add the file, false to take it out
+ ******************************************************************************/
+void DirectoryRegistry::chargeUp(uint32_t node, uint64_t size, uint64_t allocated, bool charge) {
+    get(node).chargeLinkedFile(size, allocated, charge);
+    for (node = arena.getParent(node); node != PathArena::NO_PARENT; node = arena.getParent(node)) {
+        if (contains(node)) {
+            get(node).chargeSubtree(size, allocated, charge);
+        }
+    }
+}
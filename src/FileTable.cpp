@@ -0,0 +1,174 @@
+/******************************************************************************
+ * File: FileTable.cpp
+ * Description: Stores the files of a directory column by column so each file
+ *              only costs a few integers and its name.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "FileTable.h"                      // header file for class definition
+#include "FileAnalyzer.h"                   // for the per-file view
+#include <mutex>                            // for std::unique_lock
+#include <algorithm>                        // for std::lower_bound
+
+using std::string;
+using std::string_view;
+
+//
+//  ExtensionTable
+//
+
+std::deque<string> ExtensionTable::extensions = {""};                   // id 0 is "no extension"
+std::unordered_map<string_view, uint32_t> ExtensionTable::extensionIds = {{"", 0}};
+std::shared_mutex ExtensionTable::tableMutex;
+
+/******************************************************************************
+ * intern:  Returns the id of an extension, adding it to the table if it hasn't
+ *          been seen before. Ids never change once handed out, so every thread
+ *          keeps a small cache and only touches the shared table on a miss.
+ *
+ * @param extension: The extension to look up
+ * @return The id of the extension
+ ******************************************************************************/
+uint32_t ExtensionTable::intern(string_view extension) {
+    thread_local std::unordered_map<string, uint32_t> cache;
+
+    auto cached = cache.find(string(extension));
+    if (cached != cache.end()) {
+        return cached->second;
+    }
+
+    uint32_t id;
+    {
+        // Most extensions already exist, so try with a shared lock first
+        std::shared_lock<std::shared_mutex> lock(tableMutex);
+        auto found = extensionIds.find(extension);
+        if (found != extensionIds.end()) {
+            id = found->second;
+            cache.emplace(extension, id);
+            return id;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(tableMutex);
+    auto found = extensionIds.find(extension);
+    if (found != extensionIds.end()) {
+        id = found->second;
+    } else {
+        // deque keeps the stored strings in place, so the views used as keys stay valid
+        id = static_cast<uint32_t>(extensions.size());
+        extensions.emplace_back(extension);
+        extensionIds.emplace(extensions.back(), id);
+    }
+
+    cache.emplace(extension, id);
+    return id;
+}
+
+/******************************************************************************
+ * lookup: Returns the extension that belongs to an id.
+ *
+ * @param id: An id returned by intern()
+ * @return The extension
+ ******************************************************************************/
+string_view ExtensionTable::lookup(uint32_t id) {
+    std::shared_lock<std::shared_mutex> lock(tableMutex);
+    return extensions[id];
+}
+
+//
+//  Constructors and Destructors
+//
+
+FileTable::FileTable() {}
+
+FileTable::~FileTable() {
+    // Destructor
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * addFile: Adds a file to the table. Few files have more than one link, so
+ *          their inode numbers are kept off to the side instead of in a
+ *          column every file pays for.
+ *
+ * @param name: The name of the file (not the full path)
+ * @param mode: The raw mode bits of the file
+ * @param size: The size of the file in bytes
+ * @param allocated: The bytes allocated to the file on disk
+ * @param linkedInode: The inode number if the file has other hard links, 0 otherwise
+ ******************************************************************************/
+void FileTable::addFile(string_view name, mode_t mode, uint64_t size, uint64_t allocated, uint64_t linkedInode) {
+    if (linkedInode != 0) {
+        linkedRows.push_back(static_cast<uint32_t>(modes.size()));
+        linkedInodes.push_back(linkedInode);
+    }
+
+    nameOffsets.push_back(static_cast<uint32_t>(names.size()));
+    names.append(name);
+    names.push_back('\0');
+
+    modes.push_back(mode);
+    sizes.push_back(size);
+    allocatedSizes.push_back(allocated);
+    extensionIds.push_back(ExtensionTable::intern(FileAnalyzer::extensionOf(name)));
+}
+
+/******************************************************************************
+ * operator[]: Returns a view of the file at the given index. The view is only
+ *             valid for as long as the table is.
+ *
+ * @param index: The index of the file
+ * @return A FileAnalyzer looking at the file
+ ******************************************************************************/
+FileAnalyzer FileTable::operator[](size_t index) const {
+    return FileAnalyzer(*this, index);
+}
+
+//
+//  Getters
+//
+
+size_t FileTable::size() const {
+    return modes.size();
+}
+
+bool FileTable::empty() const {
+    return modes.empty();
+}
+
+string_view FileTable::getName(size_t index) const {
+    // Each name ends one byte before the next one starts because of its '\0'
+    size_t end = (index + 1 < nameOffsets.size()) ? nameOffsets[index + 1] : names.size();
+    return string_view(names.data() + nameOffsets[index], end - nameOffsets[index] - 1);
+}
+
+mode_t FileTable::getMode(size_t index) const {
+    return modes[index];
+}
+
+uint64_t FileTable::getSize(size_t index) const {
+    return sizes[index];
+}
+
+uint64_t FileTable::getAllocatedSize(size_t index) const {
+    return allocatedSizes[index];
+}
+
+uint64_t FileTable::getLinkedInode(size_t index) const {
+    auto row = std::lower_bound(linkedRows.begin(), linkedRows.end(), static_cast<uint32_t>(index));
+    if (row == linkedRows.end() || *row != index) {
+        return 0;
+    }
+    return linkedInodes[row - linkedRows.begin()];
+}
+
+const std::vector<uint64_t>& FileTable::getLinkedInodes() const {
+    return linkedInodes;
+}
+
+uint32_t FileTable::getExtensionId(size_t index) const {
+    return extensionIds[index];
+}
@@ -0,0 +1,161 @@
+/******************************************************************************
+ * File: HardLinkSet.cpp
+ * Description: Remembers every inode with more than one link the scan has
+ *              seen and which directories link to it, so a file reachable
+ *              under several names is only counted once in the totals. The
+ *              set is split into shards with a lock each, so workers adding
+ *              different inodes rarely wait on each other.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "HardLinkSet.h"                    // header file for class definition
+
+const size_t HardLinkSet::SHARD_COUNT;
+const uint32_t HardLinkSet::NO_OWNER;
+
+//
+//  Constructors and Destructors
+//
+
+HardLinkSet::HardLinkSet(bool countFirstLink) : countFirstLink(countFirstLink) {}
+
+HardLinkSet::~HardLinkSet() {}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * addLink: Records that a directory has a link to an inode. Only files with
+ *          more than one link are passed in, which on most trees is a small
+ *          fraction, so the scan only ever takes a shard lock for those.
+ *
+ * note:    Which directory reads its link first depends on the workers, so
+ *          nobody counts the inode here. Once every link is in, the registry
+ *          charges it to the same directory on every run. Only a set that
+ *          counts the first link, for a streamed scan, decides right away.
+ *
+ * @param dev: The device the file is on
+ * @param ino: The file's inode number
+ * @param directory: The arena node of the directory holding the link
+ * @param name: The name of the link
+ * @param size: The file's apparent size
+ * @param allocated: The bytes allocated to the file on disk
+ * @return true if the directory should count the file's size now
+ ******************************************************************************/
+bool HardLinkSet::addLink(uint64_t dev, uint64_t ino, uint32_t directory, std::string_view name, uint64_t size,
+                          uint64_t allocated) {
+    Key key = {dev, ino};
+    Shard &shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto inserted = shard.inodes.try_emplace(key, Inode{size, allocated, NO_OWNER, 0, 0, true, {}});
+    Inode &inode = inserted.first->second;
+    if (countFirstLink) {
+        if (inserted.second) {
+            inode.owner = directory;
+        }
+        return inserted.second;
+    }
+
+    inode.size = size;
+    inode.allocated = allocated;
+    inode.changed = true;
+    for (Link &link : inode.links) {
+        if (link.directory == directory) {
+            if (name < link.name) {
+                link.name = name;
+            }
+            return false;
+        }
+    }
+    inode.links.push_back(Link{directory, std::string(name)});
+    return false;
+}
+
+/******************************************************************************
+ * removeLink:  Forgets a directory's link to an inode. If the directory was
+ *              charged with it, it no longer is: its totals are going away.
+ *
+ * @param dev: The device the file is on
+ * @param ino: The file's inode number
+ * @param directory: The arena node of the directory that held the link
+ ******************************************************************************/
+void HardLinkSet::removeLink(uint64_t dev, uint64_t ino, uint32_t directory) {
+    Key key = {dev, ino};
+    Shard &shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.inodes.find(key);
+    if (found == shard.inodes.end()) {
+        return;
+    }
+    Inode &inode = found->second;
+    for (size_t i = 0; i < inode.links.size(); ++i) {
+        if (inode.links[i].directory == directory) {
+            inode.links.erase(inode.links.begin() + i);
+            break;
+        }
+    }
+    if (inode.owner == directory) {
+        inode.owner = NO_OWNER;
+    }
+    inode.changed = true;
+}
+
+/******************************************************************************
+ * dropCharge:  Forgets that a directory was charged with an inode, because
+ *              the totals it was charged in were replaced by a new read. The
+ *              link stays, the next charge may pick the directory again.
+ *
+ * @param dev: The device the file is on
+ * @param ino: The file's inode number
+ * @param directory: The arena node of the directory
+ ******************************************************************************/
+void HardLinkSet::dropCharge(uint64_t dev, uint64_t ino, uint32_t directory) {
+    Key key = {dev, ino};
+    Shard &shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.inodes.find(key);
+    if (found != shard.inodes.end() && found->second.owner == directory) {
+        found->second.owner = NO_OWNER;
+        found->second.changed = true;
+    }
+}
+
+/******************************************************************************
+ * size: Returns the number of inodes seen so far.
+ ******************************************************************************/
+size_t HardLinkSet::size() const {
+    size_t total = 0;
+    for (const Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.inodes.size();
+    }
+    return total;
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * shardFor: Returns the shard an inode belongs to.
+ ******************************************************************************/
+HardLinkSet::Shard& HardLinkSet::shardFor(const Key &key) {
+    return shards[KeyHash()(key) & (SHARD_COUNT - 1)];
+}
+
+/******************************************************************************
+ * KeyHash: Mixes the device and inode numbers. Inode numbers are often
+ *          sequential, so the result goes through a multiplicative mix to
+ *          spread neighbours over the shards and the buckets.
+ ******************************************************************************/
+size_t HardLinkSet::KeyHash::operator()(const Key &key) const {
+    uint64_t hash = key.ino * 0x9E3779B97F4A7C15ULL ^ (key.dev + 0x632BE59BD9B4E019ULL);
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 32;
+    return static_cast<size_t>(hash);
+}
@@ -0,0 +1,158 @@
+/******************************************************************************
+ * File: LargestEntries.cpp
+ * Description: Keeps the largest files and directories seen during a scan.
+ *              Every worker thread gets its own pair of bounded heaps, so
+ *              offering an entry never takes a lock shared with the other
+ *              workers, and the heaps are merged once the scan is over.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "LargestEntries.h"                 // header file for class definition
+#include <algorithm>                        // for the heap functions and std::sort
+
+using std::string_view;
+using std::vector;
+
+std::atomic<uint64_t> LargestEntries::nextId(1);
+
+// Orders the heaps so the smallest entry kept is at the front, ready to be replaced
+static bool larger(const LargestEntry &a, const LargestEntry &b) {
+    return a.size > b.size;
+}
+
+//
+//  Constructors and Destructors
+//
+
+LargestEntries::LargestEntries(size_t limit)
+    : limit(limit), id(nextId.fetch_add(1, std::memory_order_relaxed)) {}
+
+LargestEntries::~LargestEntries() {}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * offerFile: Offers a file. Most files are smaller than the smallest one
+ *            kept, which is a single comparison, and the name is only copied
+ *            for the ones that make it in.
+ *
+ * @param dir: The arena node of the directory holding the file
+ * @param name: The file's name
+ * @param size: The apparent size
+ * @param allocated: The bytes allocated on disk
+ ******************************************************************************/
+void LargestEntries::offerFile(uint32_t dir, string_view name, uint64_t size, uint64_t allocated) {
+    push(heapsForThisThread().files, size, allocated, dir, name);
+}
+
+/******************************************************************************
+ * offerDirectory: Offers a directory once its subtree's totals are final.
+ *
+ * @param dir: The arena node of the directory
+ * @param size: The total size of the directory and everything below it
+ * @param allocated: The bytes allocated to the directory and everything below it
+ ******************************************************************************/
+void LargestEntries::offerDirectory(uint32_t dir, uint64_t size, uint64_t allocated) {
+    push(heapsForThisThread().directories, size, allocated, dir, string_view());
+}
+
+/******************************************************************************
+ * getFiles: Returns the largest files, largest first.
+ ******************************************************************************/
+vector<LargestEntry> LargestEntries::getFiles() const {
+    return merge(&Heaps::files);
+}
+
+/******************************************************************************
+ * getDirectories: Returns the largest directories, largest first.
+ ******************************************************************************/
+vector<LargestEntry> LargestEntries::getDirectories() const {
+    return merge(&Heaps::directories);
+}
+
+/******************************************************************************
+ * clearDirectories: Empties every thread's heap of directories.
+ ******************************************************************************/
+void LargestEntries::clearDirectories() {
+    std::lock_guard<std::mutex> lock(heapsMutex);
+    for (auto &threadHeaps : heaps) {
+        threadHeaps->directories.clear();
+    }
+}
+
+/******************************************************************************
+ * getLimit: Returns how many files and how many directories are kept.
+ ******************************************************************************/
+size_t LargestEntries::getLimit() const {
+    return limit;
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * heapsForThisThread:  Returns the calling thread's heaps. Each thread looks
+ *                      them up under the lock once and remembers them, so
+ *                      every offer after that touches nothing shared.
+ ******************************************************************************/
+LargestEntries::Heaps& LargestEntries::heapsForThisThread() {
+    thread_local uint64_t cachedId = 0;
+    thread_local Heaps *cached = nullptr;
+
+    if (cachedId != id) {
+        std::lock_guard<std::mutex> lock(heapsMutex);
+        heaps.emplace_back(new Heaps());
+        cached = heaps.back().get();
+        cachedId = id;
+    }
+    return *cached;
+}
+
+/******************************************************************************
+ * push: Adds an entry to a min-heap of at most limit entries, replacing the
+ *       smallest one once it's full.
+ ******************************************************************************/
+void LargestEntries::push(vector<LargestEntry> &heap, uint64_t size, uint64_t allocated, uint32_t dir,
+                          string_view name) const {
+    if (limit == 0 || (heap.size() == limit && size <= heap.front().size)) {
+        return;
+    }
+
+    LargestEntry entry = {size, allocated, dir, std::string(name)};
+    if (heap.size() == limit) {
+        std::pop_heap(heap.begin(), heap.end(), larger);
+        heap.back() = std::move(entry);
+    } else {
+        heap.push_back(std::move(entry));
+    }
+    std::push_heap(heap.begin(), heap.end(), larger);
+}
+
+/******************************************************************************
+ * merge:   Puts one heap from every thread together and keeps the largest
+ *          entries, so only threads times limit entries are ever held.
+ *
+ * @param heap: Which of the heaps to merge
+ * @return The largest entries, largest first
+ ******************************************************************************/
+vector<LargestEntry> LargestEntries::merge(vector<LargestEntry> Heaps::*heap) const {
+    vector<LargestEntry> merged;
+    {
+        std::lock_guard<std::mutex> lock(heapsMutex);
+        for (const auto &threadHeaps : heaps) {
+            const vector<LargestEntry> &entries = (*threadHeaps).*heap;
+            merged.insert(merged.end(), entries.begin(), entries.end());
+        }
+    }
+
+    if (merged.size() > limit) {
+        std::partial_sort(merged.begin(), merged.begin() + limit, merged.end(), larger);
+        merged.resize(limit);
+    } else {
+        std::sort(merged.begin(), merged.end(), larger);
+    }
+    return merged;
+}
@@ -0,0 +1,234 @@
+/******************************************************************************
+ * File: MountTable.cpp
+ * Description: Reads the mounts below the scanned root from
+ *              /proc/self/mountinfo and picks how each of them is scanned:
+ *              pseudo filesystems like /proc and /sys are skipped, network
+ *              and FUSE filesystems are stat-ed in batches, and d_type is only
+ *              trusted where the filesystem fills it in reliably.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "MountTable.h"                     // header file for class definition
+#include <fstream>                          // for reading mountinfo
+#include <sstream>                          // for splitting its lines
+#include <unordered_set>                    // for the lists of filesystem types
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+const uint32_t MountTable::NO_MOUNT;
+
+// Filesystems the kernel makes up on the fly. Reading them is slow, fails all over and counts nothing on disk.
+static const std::unordered_set<string> PSEUDO_FILESYSTEMS = {
+    "proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "securityfs", "debugfs", "tracefs", "pstore",
+    "bpf", "configfs", "fusectl", "mqueue", "hugetlbfs", "binfmt_misc", "autofs", "rpc_pipefs", "nsfs",
+    "selinuxfs", "efivarfs"
+};
+
+// Filesystems where every stat is a round trip to a server or a daemon
+static const std::unordered_set<string> REMOTE_FILESYSTEMS = {
+    "nfs", "nfs4", "cifs", "smb3", "smbfs", "9p", "ceph", "glusterfs", "lustre", "afs", "fuse", "fuseblk"
+};
+
+//
+//  Constructors and Destructors
+//
+
+MountTable::MountTable() : rootMount(NO_MOUNT) {}
+
+MountTable::~MountTable() {}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * load:    Reads the mount table and keeps the mounts below the root, each
+ *          filed under the directory it is mounted in, with its path spelled
+ *          the way the scan builds paths from the root it was given.
+ *
+ * note:    Mounts on the root's parents or elsewhere can't be reached by the
+ *          scan, so only the one holding the root is kept of those. Where
+ *          several mounts sit on the same directory the last one is on top,
+ *          which is the order mountinfo lists them in.
+ *
+ * @param root: The scanned root, as given on the command line
+ * @param realRoot: The real path of the root
+ * @param mountInfo: The file to read
+ * @return true if the mount table was read
+ ******************************************************************************/
+bool MountTable::load(const string &root, const string &realRoot, const string &mountInfo) {
+    std::ifstream file(mountInfo);
+    if (!file) {
+        return false;
+    }
+
+    size_t longestRoot = 0;
+    string line;
+    while (std::getline(file, line)) {
+        // id parent major:minor root mountPoint options [optional fields...] - type source superOptions
+        std::istringstream fields(line);
+        string id, parent, device, mountRoot, mountPoint, options, field, fsType;
+        if (!(fields >> id >> parent >> device >> mountRoot >> mountPoint >> options)) {
+            continue;
+        }
+        while (fields >> field && field != "-") {}
+        if (!(fields >> fsType)) {
+            continue;
+        }
+
+        Mount mount;
+        mount.fsType = fsType;
+        mount.strategy = strategyFor(fsType);
+        string path = unescape(mountPoint);
+
+        // The mount holding the root is the last one on the longest path leading to it
+        bool holdsRoot = realRoot == path || path == "/"
+                         || (realRoot.compare(0, path.size(), path) == 0 && realRoot[path.size()] == '/');
+        if (holdsRoot && path.size() >= longestRoot) {
+            longestRoot = path.size();
+            mount.path = root;
+            mounts.push_back(mount);
+            rootMount = static_cast<uint32_t>(mounts.size() - 1);
+            continue;
+        }
+
+        // Anything else only matters if the scan can reach it
+        size_t prefix = (realRoot == "/") ? 1 : realRoot.size() + 1;
+        if (path.size() <= prefix || path.compare(0, prefix - 1, realRoot, 0, prefix - 1) != 0 || path[prefix - 1] != '/') {
+            continue;
+        }
+        string relative = path.substr(prefix);
+        size_t lastSlash = relative.rfind('/');
+        string parentRelative = (lastSlash == string::npos) ? string() : relative.substr(0, lastSlash);
+
+        // Joined like PathArena::getPath(), which doesn't double up on a root ending in '/'
+        auto join = [&root](const string &rest) { return (!root.empty() && root.back() == '/') ? root + rest : root + "/" + rest; };
+        string parentPath = parentRelative.empty() ? root : join(parentRelative);
+        mount.path = join(relative);
+
+        // Nested overlays are container layers, the same files are already on the filesystem under them
+        if (fsType == "overlay") {
+            mount.strategy.skip = true;
+        }
+
+        mounts.push_back(mount);
+        children[parentPath].push_back(static_cast<uint32_t>(mounts.size() - 1));
+    }
+
+    reported.reset(new std::atomic<bool>[mounts.size()]);
+    for (size_t i = 0; i < mounts.size(); ++i) {
+        reported[i].store(false, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+/******************************************************************************
+ * strategyFor: Picks how a filesystem type is read.
+ *
+ * note:    FUSE filesystems pass d_type through from whatever daemon serves
+ *          them, and plenty of those leave it as DT_UNKNOWN or always say
+ *          DT_REG, so their entries are stat-ed even when only names are
+ *          needed.
+ *
+ * @param fsType: The type from mountinfo
+ * @return The strategy
+ ******************************************************************************/
+MountStrategy MountTable::strategyFor(const string &fsType) {
+    MountStrategy strategy;
+    bool fuse = fsType == "fuse" || fsType == "fuseblk" || fsType.compare(0, 5, "fuse.") == 0;
+
+    strategy.skip = PSEUDO_FILESYSTEMS.count(fsType) > 0;
+    strategy.asyncStat = fuse || REMOTE_FILESYSTEMS.count(fsType) > 0;
+    strategy.trustDType = !fuse;
+    return strategy;
+}
+
+/******************************************************************************
+ * getRootMount: Returns the mount the root is on, NO_MOUNT if unknown.
+ ******************************************************************************/
+uint32_t MountTable::getRootMount() const {
+    return rootMount;
+}
+
+/******************************************************************************
+ * getMount: Returns a mount by index.
+ ******************************************************************************/
+const Mount& MountTable::getMount(uint32_t index) const {
+    return mounts[index];
+}
+
+/******************************************************************************
+ * getStrategy: Returns how a mount is read, the default for NO_MOUNT.
+ ******************************************************************************/
+const MountStrategy& MountTable::getStrategy(uint32_t index) const {
+    return (index == NO_MOUNT) ? defaultStrategy : mounts[index].strategy;
+}
+
+/******************************************************************************
+ * mountsIn:    Returns the mounts on sub-directories of a directory. Very
+ *              few directories have any, so this is one hash lookup for each
+ *              directory and nothing at all for their entries.
+ *
+ * @param path: The path of the directory, as the scan spells it
+ * @return The mounts, or nullptr if there are none
+ ******************************************************************************/
+const vector<uint32_t>* MountTable::mountsIn(const string &path) const {
+    if (children.empty()) {
+        return nullptr;
+    }
+    auto found = children.find(path);
+    return (found != children.end()) ? &found->second : nullptr;
+}
+
+/******************************************************************************
+ * findMount: Finds the mount on a sub-directory by name.
+ *
+ * @param candidates: The mounts in the parent directory, from mountsIn()
+ * @param name: The name of the sub-directory
+ * @return The topmost mount on it, or NO_MOUNT
+ ******************************************************************************/
+uint32_t MountTable::findMount(const vector<uint32_t> &candidates, string_view name) const {
+    for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+        const string &path = mounts[*it].path;
+        if (path.size() > name.size() && path.compare(path.size() - name.size(), name.size(), name) == 0
+            && path[path.size() - name.size() - 1] == '/') {
+            return *it;
+        }
+    }
+    return NO_MOUNT;
+}
+
+/******************************************************************************
+ * firstSkip:   Returns true only the first time it's called for a mount.
+ *              In watch mode the directory holding a mount point can be read
+ *              many times, and the mount should only be reported once.
+ ******************************************************************************/
+bool MountTable::firstSkip(uint32_t index) const {
+    return !reported[index].exchange(true, std::memory_order_relaxed);
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * unescape: Turns the "\040" style escapes in a mountinfo field back into
+ *           the characters they stand for.
+ ******************************************************************************/
+string MountTable::unescape(const string &field) {
+    string result;
+    result.reserve(field.size());
+    for (size_t i = 0; i < field.size(); ++i) {
+        if (field[i] == '\\' && i + 3 < field.size()
+            && field[i + 1] >= '0' && field[i + 1] <= '3' && field[i + 2] >= '0' && field[i + 2] <= '7'
+            && field[i + 3] >= '0' && field[i + 3] <= '7') {
+            result += static_cast<char>((field[i + 1] - '0') * 64 + (field[i + 2] - '0') * 8 + (field[i + 3] - '0'));
+            i += 3;
+        } else {
+            result += field[i];
+        }
+    }
+    return result;
+}
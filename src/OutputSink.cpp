@@ -0,0 +1,292 @@
+/******************************************************************************
+ * File: OutputSink.cpp
+ * Description: Collects report output in large buffers and writes them from a
+ *              thread of its own, so formatting never waits on the disk or
+ *              the terminal and every write is a big one.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "OutputSink.h"                     // header file for class definition
+#include <algorithm>                        // for std::min
+#include <cerrno>                           // for errno
+#include <charconv>                         // for std::to_chars
+#include <cstdlib>                          // for aligned_alloc() and free()
+#include <cstring>                          // for memcpy()
+#include <fcntl.h>                          // for open() and fcntl()
+#include <iostream>                         // for flushing std::cout and error messages
+#include <unistd.h>                         // for write() and close()
+
+const size_t OutputSink::BUFFER_SIZE;
+const size_t OutputSink::BUFFER_COUNT;
+const size_t OutputSink::ALIGNMENT;
+
+//
+//  Constructors and Destructors
+//
+
+OutputSink::OutputSink()
+    : fd(-1), ownsFd(false), direct(false), memory(nullptr), current(0), used(0), closing(false), failed(false) {}
+
+OutputSink::~OutputSink() {
+    close();
+    free(memory);
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * openConsole: Sends the output to stdout. Whatever std::cout still holds is
+ *              flushed first, so the status messages come before the report.
+ ******************************************************************************/
+bool OutputSink::openConsole() {
+    std::cout.flush();
+    fd = STDOUT_FILENO;
+    ownsFd = false;
+    direct = false;
+    return start();
+}
+
+/******************************************************************************
+ * openFile:    Creates or truncates a file and sends the output to it.
+ *
+ * note:    Not every filesystem takes O_DIRECT, tmpfs for one refuses it. The
+ *          file is then written through the page cache like any other.
+ *
+ * @param fileName: The file to write to
+ * @param directIO: Whether to bypass the page cache
+ * @return true if the file could be opened
+ ******************************************************************************/
+bool OutputSink::openFile(const std::string &fileName, bool directIO) {
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    fd = directIO ? ::open(fileName.c_str(), flags | O_DIRECT, 0644) : -1;
+    direct = (fd >= 0);
+    if (directIO && !direct) {
+        std::cerr << "\033[33mCannot write " << fileName << " with direct I/O, writing it through the page cache.\033[0m"
+                  << std::endl;
+    }
+    if (fd < 0) {
+        fd = ::open(fileName.c_str(), flags, 0644);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    ownsFd = true;
+    return start();
+}
+
+/******************************************************************************
+ * write:   Copies bytes into the current buffer, handing it to the writer
+ *          each time it fills up.
+ *
+ * @param data: The bytes to write
+ * @param length: How many there are
+ ******************************************************************************/
+void OutputSink::write(const char *data, size_t length) {
+    if (memory == nullptr) {
+        return;     // Never opened
+    }
+
+    while (length > 0) {
+        if (used == BUFFER_SIZE) {
+            handOver();
+        }
+        size_t chunk = std::min(length, BUFFER_SIZE - used);
+        memcpy(memory + current * BUFFER_SIZE + used, data, chunk);
+        used += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void OutputSink::write(std::string_view text) {
+    write(text.data(), text.size());
+}
+
+void OutputSink::put(char c) {
+    write(&c, 1);
+}
+
+/******************************************************************************
+ * writeNumber: Writes a number, padded with spaces on the left to width
+ *              characters like std::setw() would.
+ *
+ * @param value: The number to write
+ * @param width: The least number of characters to take up
+ ******************************************************************************/
+void OutputSink::writeNumber(uint64_t value, size_t width) {
+    static const char SPACES[] = "                                ";
+    char digits[20];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    size_t length = result.ptr - digits;
+
+    for (size_t pad = (width > length) ? width - length : 0; pad > 0; ) {
+        size_t chunk = std::min(pad, sizeof(SPACES) - 1);
+        write(SPACES, chunk);
+        pad -= chunk;
+    }
+    write(digits, length);
+}
+
+/******************************************************************************
+ * close:   Hands over the last buffer, lets the writer finish and closes the
+ *          file. Safe to call more than once.
+ *
+ * @return true if everything was written
+ ******************************************************************************/
+bool OutputSink::close() {
+    if (!writer.joinable()) {
+        return !failed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (used > 0) {
+            full.emplace_back(current, used);
+            used = 0;
+        }
+        closing = true;
+    }
+    bufferFull.notify_one();
+    writer.join();
+
+    if (ownsFd && ::close(fd) != 0) {
+        failed = true;
+    }
+    fd = -1;
+    ownsFd = false;
+    return !failed;
+}
+
+/******************************************************************************
+ * appendNumber: Appends a number to a string.
+ ******************************************************************************/
+void OutputSink::appendNumber(std::string &out, uint64_t value) {
+    char digits[20];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, result.ptr - digits);
+}
+
+/******************************************************************************
+ * appendDouble:    Appends a double with 6 significant digits and no
+ *                  trailing zeros, which is what an ostream prints by default.
+ ******************************************************************************/
+void OutputSink::appendDouble(std::string &out, double value) {
+    char number[32];
+    std::to_chars_result result = std::to_chars(number, number + sizeof(number), value, std::chars_format::general, 6);
+    out.append(number, result.ptr - number);
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * start:   Allocates the buffers, page aligned for O_DIRECT, and starts the
+ *          writer. The first buffer is the one being filled.
+ ******************************************************************************/
+bool OutputSink::start() {
+    memory = static_cast<char*>(aligned_alloc(ALIGNMENT, BUFFER_SIZE * BUFFER_COUNT));
+    if (memory == nullptr) {
+        if (ownsFd) {
+            ::close(fd);
+        }
+        return false;
+    }
+    for (size_t i = 1; i < BUFFER_COUNT; ++i) {
+        empty.push_back(i);
+    }
+    writer = std::thread(&OutputSink::writeBuffers, this);
+    return true;
+}
+
+/******************************************************************************
+ * handOver:    Queues the current buffer for the writer and starts filling an
+ *              empty one. While every buffer is waiting to be written the
+ *              caller waits, which holds formatting back to the speed of the
+ *              output instead of letting memory grow.
+ ******************************************************************************/
+void OutputSink::handOver() {
+    std::unique_lock<std::mutex> lock(mutex);
+    full.emplace_back(current, used);
+    bufferFull.notify_one();
+
+    bufferFree.wait(lock, [this]() { return !empty.empty(); });
+    current = empty.front();
+    empty.pop_front();
+    used = 0;
+}
+
+/******************************************************************************
+ * writeBuffers:    Runs on the writer thread. Buffers are written outside the
+ *                  lock and given back to be filled again. Once a write has
+ *                  failed the rest are only given back.
+ ******************************************************************************/
+void OutputSink::writeBuffers() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        bufferFull.wait(lock, [this]() { return !full.empty() || closing; });
+        if (full.empty()) {
+            return;     // Closed and everything is written
+        }
+
+        std::pair<size_t, size_t> buffer = full.front();
+        full.pop_front();
+        bool skip = failed;
+        lock.unlock();
+
+        bool written = skip || writeAll(memory + buffer.first * BUFFER_SIZE, buffer.second);
+
+        lock.lock();
+        if (!written) {
+            failed = true;
+        }
+        empty.push_back(buffer.first);
+        bufferFree.notify_one();
+    }
+}
+
+/******************************************************************************
+ * writeAll:    Writes a buffer, carrying on after short writes and signals.
+ *
+ * note:    O_DIRECT only takes lengths that are a multiple of the block size.
+ *          Every buffer but the last is full, the last one's tail is written
+ *          after turning O_DIRECT off. A filesystem that opens with O_DIRECT
+ *          but refuses the writes gets the same treatment.
+ *
+ * @param data: The bytes to write
+ * @param length: How many there are
+ * @return true if they were all written
+ ******************************************************************************/
+bool OutputSink::writeAll(const char *data, size_t length) {
+    while (length > 0) {
+        size_t chunk = length;
+        if (direct && length % ALIGNMENT != 0) {
+            chunk = length - length % ALIGNMENT;
+            if (chunk == 0) {
+                direct = false;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+        }
+
+        ssize_t written = ::write(fd, data, chunk);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL && direct) {
+                direct = false;
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
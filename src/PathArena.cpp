@@ -0,0 +1,198 @@
+/******************************************************************************
+ * File: PathArena.cpp
+ * Description: Stores the directory tree as nodes that only know their parent
+ *              and their own name, so full paths are only built when printed.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "PathArena.h"                      // header file for class definition
+#include <cstring>                          // for memcpy()
+
+using std::string;
+using std::string_view;
+
+const uint32_t PathArena::NO_PARENT;
+
+// Hands every arena its own id so a thread's pool cursor is never reused by another arena
+static std::atomic<uint64_t> nextArenaId(1);
+
+// The block each thread is currently bump allocating names from
+struct PoolCursor {
+    uint64_t arenaId = 0;       // The arena the block belongs to
+    char *next = nullptr;       // The next free byte in the block
+    size_t left = 0;            // The number of free bytes left in the block
+};
+
+thread_local PoolCursor poolCursor;
+
+//
+//  Constructors and Destructors
+//
+
+PathArena::PathArena() : chunks(new std::atomic<Node*>[MAX_CHUNKS]), nodeCount(0) {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+    arenaId = nextArenaId.fetch_add(1);
+}
+
+PathArena::~PathArena() {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        delete[] chunks[i].load(std::memory_order_relaxed);
+    }
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * addNode: Adds a node to the tree. The node's chunk is allocated the first
+ *          time an index in it is handed out, whichever thread gets there
+ *          first wins and everyone else uses its chunk.
+ *
+ * @param parent: The index of the parent node, or NO_PARENT for a root
+ * @param name: The name of the node (the full path for a root)
+ * @return The index of the new node
+ ******************************************************************************/
+uint32_t PathArena::addNode(uint32_t parent, string_view name) {
+    uint32_t node = nodeCount.fetch_add(1, std::memory_order_relaxed);
+    size_t chunkIndex = node / NODES_PER_CHUNK;
+
+    Node *chunk = chunks[chunkIndex].load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+        Node *newChunk = new Node[NODES_PER_CHUNK];
+        if (chunks[chunkIndex].compare_exchange_strong(chunk, newChunk, std::memory_order_acq_rel)) {
+            chunk = newChunk;
+        } else {
+            delete[] newChunk;  // Another thread allocated the chunk first
+        }
+    }
+
+    Node &entry = chunk[node % NODES_PER_CHUNK];
+    entry.parent = parent;
+    entry.nameLength = static_cast<uint32_t>(name.size());
+    entry.name = storeName(name);
+
+    return node;
+}
+
+//
+//  Getters
+//
+
+uint32_t PathArena::getParent(uint32_t node) const {
+    return nodeAt(node).parent;
+}
+
+string_view PathArena::getName(uint32_t node) const {
+    const Node &entry = nodeAt(node);
+    return string_view(entry.name, entry.nameLength);
+}
+
+size_t PathArena::size() const {
+    return nodeCount.load(std::memory_order_acquire);
+}
+
+/******************************************************************************
+ * getPath: Rebuilds the full path of a node by walking up to the root.
+ *
+ * @param node: The index of the node
+ * @return The full path of the node
+ ******************************************************************************/
+string PathArena::getPath(uint32_t node) const {
+    string path;
+    appendPath(node, path);
+    return path;
+}
+
+/******************************************************************************
+ * appendPath:  Appends the full path of a node. The names are found walking
+ *              up to the root, so the length is worked out on a first walk
+ *              and the names are copied in from the end on a second one,
+ *              which needs no list of them.
+ *
+ * note:    Only the root's name can end in '/', so that is the one place a
+ *          separator can be left out, the same as joining the names front to
+ *          back without doubling up on a root like "/".
+ *
+ * @param node: The index of the node
+ * @param out: Where the path is appended
+ ******************************************************************************/
+void PathArena::appendPath(uint32_t node, string &out) const {
+    // Add up the names and a separator in front of each one but the root's
+    size_t length = 0;
+    uint32_t root = node;
+    for (uint32_t current = node; current != NO_PARENT; current = getParent(current)) {
+        length += getName(current).size() + 1;
+        root = current;
+    }
+    string_view rootName = getName(root);
+    length -= 1;
+    if (node != root && (rootName.empty() || rootName.back() == '/')) {
+        length -= 1;
+    }
+
+    // Fill the names in from the end
+    size_t start = out.size();
+    out.resize(start + length);
+    char *end = &out[0] + out.size();
+    for (uint32_t current = node; current != root; current = getParent(current)) {
+        string_view name = getName(current);
+        end -= name.size();
+        memcpy(end, name.data(), name.size());
+        if (end != &out[start] + rootName.size()) {
+            *--end = '/';
+        }
+    }
+    memcpy(&out[start], rootName.data(), rootName.size());
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * nodeAt: Returns the node at an index.
+ ******************************************************************************/
+PathArena::Node& PathArena::nodeAt(uint32_t node) const {
+    return chunks[node / NODES_PER_CHUNK].load(std::memory_order_acquire)[node % NODES_PER_CHUNK];
+}
+
+/******************************************************************************
+ * storeName: Copies a name into the string pool. Every thread bump allocates
+ *            from its own block, so the pool lock is only taken once a block
+ *            is used up.
+ *
+ * @param name: The name to store
+ * @return A pointer to the stored copy
+ ******************************************************************************/
+const char* PathArena::storeName(string_view name) {
+    // Names that wouldn't fit in a normal block get a block of their own
+    if (name.size() > POOL_BLOCK_SIZE / 4) {
+        std::unique_ptr<char[]> block(new char[name.size()]);
+        memcpy(block.get(), name.data(), name.size());
+
+        std::unique_lock<std::mutex> lock(poolMutex);
+        poolBlocks.push_back(std::move(block));
+        return poolBlocks.back().get();
+    }
+
+    // Grab a new block if this thread's block is full or belongs to another arena
+    if (poolCursor.arenaId != arenaId || poolCursor.left < name.size()) {
+        std::unique_ptr<char[]> block(new char[POOL_BLOCK_SIZE]);
+        poolCursor.arenaId = arenaId;
+        poolCursor.next = block.get();
+        poolCursor.left = POOL_BLOCK_SIZE;
+
+        std::unique_lock<std::mutex> lock(poolMutex);
+        poolBlocks.push_back(std::move(block));
+    }
+
+    char *stored = poolCursor.next;
+    memcpy(stored, name.data(), name.size());
+    poolCursor.next += name.size();
+    poolCursor.left -= name.size();
+
+    return stored;
+}
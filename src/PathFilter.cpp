@@ -0,0 +1,382 @@
+/******************************************************************************
+ * File: PathFilter.cpp
+ * Description: Decides which directories and files the scan visits, from
+ *              include and exclude globs. The globs are compiled once into a
+ *              trie of path components, and every directory carries a small
+ *              state id saying where its path is in that trie, so checking an
+ *              entry only ever looks at its own name, never its full path.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "PathFilter.h"                     // header file for class definition
+#include <algorithm>                        // for std::sort and std::unique
+#include <fnmatch.h>                        // for fnmatch()
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+const uint32_t PathFilter::SKIP;
+const uint32_t PathFilter::UNKNOWN;
+const size_t PathFilter::STATES_PER_CHUNK;
+const size_t PathFilter::MAX_CHUNKS;
+
+// The Windows drives are mounted under /mnt by the Linux subsystem for Windows
+const vector<string> PathFilter::DEFAULT_EXCLUDES = {"/mnt/*"};
+
+// Checks if a component has to go through fnmatch()
+static bool hasWildcards(string_view component) {
+    return component.find_first_of("*?[\\") != string_view::npos;
+}
+
+//
+//  Constructors and Destructors
+//
+
+PathFilter::PathFilter()
+    : nodes(1), hasIncludes(false), chunks(new std::atomic<State*>[MAX_CHUNKS]), stateCount(0) {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+PathFilter::~PathFilter() {
+    for (size_t i = 0; i < MAX_CHUNKS; ++i) {
+        delete[] chunks[i].load(std::memory_order_relaxed);
+    }
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * addExclude: Adds a glob for directories and files to leave out.
+ *
+ * @param glob: The glob, see the top of PathFilter.h
+ * @param root: The real path of the scanned root
+ ******************************************************************************/
+void PathFilter::addExclude(const string &glob, const string &root) {
+    addGlob(glob, root, EXCLUDE);
+}
+
+/******************************************************************************
+ * addInclude: Adds a glob for directories and files to keep. Once there is
+ *             one, files only count if they or a directory above them match.
+ *
+ * @param glob: The glob, see the top of PathFilter.h
+ * @param root: The real path of the scanned root
+ ******************************************************************************/
+void PathFilter::addInclude(const string &glob, const string &root) {
+    addGlob(glob, root, INCLUDE);
+}
+
+/******************************************************************************
+ * rootState:   Walks the trie down the root's own path, so absolute globs
+ *              line up with the scan. An exclude matching the root or a
+ *              directory above it is ignored: the root was asked for by name.
+ *
+ * @param root: The real path of the scanned root
+ * @return The state to give the root's reader
+ ******************************************************************************/
+uint32_t PathFilter::rootState(const string &root) {
+    vector<uint32_t> reached = {0};
+    close(reached);
+    bool included = (endsAt(reached) & INCLUDE) != 0;
+
+    for (const string &component : components(root)) {
+        vector<uint32_t> next;
+        step(reached, component, next);
+        reached = std::move(next);
+        included = included || (endsAt(reached) & INCLUDE);
+    }
+    return intern(std::move(reached), included);
+}
+
+/******************************************************************************
+ * enterDirectory:  Moves a directory's state over one of its sub-directories.
+ *                  Most names match no glob at all and lead to the same
+ *                  state, which is remembered, so only names that match
+ *                  something take the lock to look their state up.
+ *
+ * @param state: The directory's state
+ * @param name: The name of the sub-directory
+ * @return The sub-directory's state, or SKIP if it must not be opened
+ ******************************************************************************/
+uint32_t PathFilter::enterDirectory(uint32_t state, string_view name) {
+    thread_local vector<uint32_t> next;
+    const State &current = getState(state);
+
+    next.clear();
+    bool matched = step(current.nodes, name, next);
+    if (!matched) {
+        uint32_t known = current.otherwise.load(std::memory_order_acquire);
+        if (known != UNKNOWN) {
+            return known;
+        }
+    }
+
+    uint8_t ends = endsAt(next);
+    bool included = current.included || (ends & INCLUDE);
+    bool includeAlive = false;
+    for (uint32_t reached : next) {
+        includeAlive = includeAlive || nodes[reached].leadsToInclude;
+    }
+
+    uint32_t result;
+    if ((ends & EXCLUDE) || (hasIncludes && !included && !includeAlive)) {
+        result = SKIP;
+    } else {
+        result = intern(vector<uint32_t>(next), included);
+    }
+
+    if (!matched) {
+        // Two threads may get here at once, they both find the same state
+        current.otherwise.store(result, std::memory_order_release);
+    }
+    return result;
+}
+
+/******************************************************************************
+ * acceptsFile: Checks a file against the globs, from its directory's state.
+ *
+ * @param state: The state of the directory holding the file
+ * @param name: The name of the file
+ * @return true if the file should be listed and counted
+ ******************************************************************************/
+bool PathFilter::acceptsFile(uint32_t state, string_view name) const {
+    thread_local vector<uint32_t> next;
+    const State &current = getState(state);
+
+    next.clear();
+    if (!step(current.nodes, name, next)) {
+        return !hasIncludes || current.included;
+    }
+
+    uint8_t ends = endsAt(next);
+    return !(ends & EXCLUDE) && (!hasIncludes || current.included || (ends & INCLUDE));
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * addGlob: Adds a glob to the trie, one node per component. Globs sharing a
+ *          beginning share nodes, so "**" followed by a hundred names is one
+ *          "**" node with a hundred children and costs one hash lookup per
+ *          entry rather than a hundred comparisons.
+ *
+ * @param glob: The glob
+ * @param root: The real path of the scanned root
+ * @param kind: EXCLUDE or INCLUDE
+ ******************************************************************************/
+void PathFilter::addGlob(const string &glob, const string &root, uint8_t kind) {
+    string full;
+    vector<string> parts = components(glob);
+    if (!glob.empty() && glob[0] == '/') {
+        full = glob;
+    } else if (parts.size() > 1) {
+        full = root + "/" + glob;
+    } else {
+        full = "**/" + glob;
+    }
+
+    uint32_t current = 0;
+    for (const string &component : components(full)) {
+        if (component == "**") {
+            if (!nodes[current].repeats) {
+                if (nodes[current].anyDepth == NO_NODE) {
+                    nodes[current].anyDepth = static_cast<uint32_t>(nodes.size());
+                    nodes.emplace_back();
+                    nodes.back().repeats = true;
+                }
+                current = nodes[current].anyDepth;
+            }
+            continue;
+        }
+
+        uint32_t child = NO_NODE;
+        if (!hasWildcards(component)) {
+            auto found = nodes[current].literals.find(component);
+            if (found != nodes[current].literals.end()) {
+                child = found->second;
+            } else {
+                child = static_cast<uint32_t>(nodes.size());
+                nodes[current].literals.emplace(component, child);
+                nodes.emplace_back();
+            }
+        } else {
+            for (const Glob &existing : nodes[current].globs) {
+                if (existing.pattern == component) {
+                    child = existing.child;
+                }
+            }
+            if (child == NO_NODE) {
+                child = static_cast<uint32_t>(nodes.size());
+                string suffix = component.substr(1);
+                bool suffixOnly = component[0] == '*' && !hasWildcards(suffix);
+                nodes[current].globs.push_back({component, suffixOnly ? suffix : string(), suffixOnly, child});
+                nodes.emplace_back();
+            }
+        }
+        current = child;
+    }
+
+    nodes[current].ends |= kind;
+    hasIncludes = hasIncludes || kind == INCLUDE;
+
+    // Children always come after their parents, so one backwards pass rolls the includes up
+    for (size_t i = nodes.size(); i-- > 0; ) {
+        Node &node = nodes[i];
+        node.leadsToInclude = (node.ends & INCLUDE) != 0;
+        for (const auto &literal : node.literals) {
+            node.leadsToInclude = node.leadsToInclude || nodes[literal.second].leadsToInclude;
+        }
+        for (const Glob &wildcard : node.globs) {
+            node.leadsToInclude = node.leadsToInclude || nodes[wildcard.child].leadsToInclude;
+        }
+        if (node.anyDepth != NO_NODE) {
+            node.leadsToInclude = node.leadsToInclude || nodes[node.anyDepth].leadsToInclude;
+        }
+    }
+}
+
+/******************************************************************************
+ * close: Adds the "**" nodes that can be reached without matching anything,
+ *        since "**" also matches no components at all, then sorts the nodes
+ *        so equal sets compare equal.
+ *
+ * @param reached: The nodes to close
+ ******************************************************************************/
+void PathFilter::close(vector<uint32_t> &reached) const {
+    for (size_t i = 0; i < reached.size(); ++i) {
+        if (nodes[reached[i]].anyDepth != NO_NODE) {
+            reached.push_back(nodes[reached[i]].anyDepth);
+        }
+    }
+    std::sort(reached.begin(), reached.end());
+    reached.erase(std::unique(reached.begin(), reached.end()), reached.end());
+}
+
+/******************************************************************************
+ * step: Moves every node over one path component.
+ *
+ * @param from: The nodes the parent directory is at
+ * @param name: The component
+ * @param to: Gets the nodes the component leads to, closed
+ * @return true if a name or wildcard matched, false if only "**" nodes carried on
+ ******************************************************************************/
+bool PathFilter::step(const vector<uint32_t> &from, string_view name, vector<uint32_t> &to) const {
+    bool matched = false;
+    string key;
+
+    for (uint32_t index : from) {
+        const Node &node = nodes[index];
+        if (node.repeats) {
+            to.push_back(index);
+        }
+
+        if (!node.literals.empty()) {
+            key.assign(name.data(), name.size());
+            auto found = node.literals.find(key);
+            if (found != node.literals.end()) {
+                to.push_back(found->second);
+                matched = true;
+            }
+        }
+
+        for (const Glob &wildcard : node.globs) {
+            bool hit;
+            if (wildcard.suffixOnly) {
+                hit = name.size() >= wildcard.suffix.size()
+                      && name.compare(name.size() - wildcard.suffix.size(), string_view::npos, wildcard.suffix) == 0;
+            } else {
+                key.assign(name.data(), name.size());
+                hit = fnmatch(wildcard.pattern.c_str(), key.c_str(), 0) == 0;
+            }
+            if (hit) {
+                to.push_back(wildcard.child);
+                matched = true;
+            }
+        }
+    }
+
+    close(to);
+    return matched;
+}
+
+/******************************************************************************
+ * endsAt: Returns EXCLUDE and/or INCLUDE if a glob of that kind ends at any
+ *         of the nodes.
+ ******************************************************************************/
+uint8_t PathFilter::endsAt(const vector<uint32_t> &reached) const {
+    uint8_t ends = 0;
+    for (uint32_t index : reached) {
+        ends |= nodes[index].ends;
+    }
+    return ends;
+}
+
+/******************************************************************************
+ * intern:  Returns the id of the state for a set of nodes, adding it if no
+ *          directory has been in it before. A handful of states usually
+ *          covers the whole tree.
+ *
+ * @param reached: The nodes, sorted
+ * @param included: Whether the directory or one above it matched an include
+ * @return The state's id
+ ******************************************************************************/
+uint32_t PathFilter::intern(vector<uint32_t> &&reached, bool included) {
+    std::lock_guard<std::mutex> lock(internMutex);
+
+    auto key = std::make_pair(std::move(reached), included);
+    auto found = stateIds.find(key);
+    if (found != stateIds.end()) {
+        return found->second;
+    }
+
+    uint32_t id = stateCount;
+    size_t chunk = id / STATES_PER_CHUNK;
+    if (chunk >= MAX_CHUNKS) {
+        return 0;   // Can't happen with globs a person typed, the root's state is the safest answer
+    }
+    if (chunks[chunk].load(std::memory_order_relaxed) == nullptr) {
+        chunks[chunk].store(new State[STATES_PER_CHUNK], std::memory_order_release);
+    }
+
+    State &state = chunks[chunk].load(std::memory_order_relaxed)[id % STATES_PER_CHUNK];
+    state.nodes = key.first;
+    state.included = included;
+
+    stateIds.emplace(std::move(key), id);
+    stateCount++;
+    return id;
+}
+
+/******************************************************************************
+ * getState: Returns a state by id. States are never moved or changed once
+ *           handed out, so this doesn't need the lock.
+ ******************************************************************************/
+const PathFilter::State& PathFilter::getState(uint32_t id) const {
+    return chunks[id / STATES_PER_CHUNK].load(std::memory_order_acquire)[id % STATES_PER_CHUNK];
+}
+
+/******************************************************************************
+ * components: Splits a path into its components, dropping empty ones and ".".
+ ******************************************************************************/
+vector<string> PathFilter::components(const string &path) {
+    vector<string> parts;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == string::npos) {
+            end = path.size();
+        }
+        if (end > start && path.compare(start, end - start, ".") != 0) {
+            parts.push_back(path.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return parts;
+}
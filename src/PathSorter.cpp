@@ -0,0 +1,218 @@
+/******************************************************************************
+ * File: PathSorter.cpp
+ * Description: Puts the directories below a root in byte order of their
+ *              paths without building a single path. The tree already holds
+ *              every path's prefix, so only each directory's own children
+ *              have to be sorted, and those sorts are independent of each
+ *              other and run on a thread pool.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "PathSorter.h"                     // header file for class definition
+#include "DirectorySource.h"                // for the tree being sorted
+#include "ThreadPool.h"                     // for sorting the children of many directories at once
+#include <algorithm>                        // for std::sort and std::min
+#include <cstring>                          // for memcmp()
+#include <deque>                            // for the walk's stack, which mustn't move its frames
+
+using std::string_view;
+using std::vector;
+
+const size_t PathSorter::PARALLEL_THRESHOLD;
+const size_t PathSorter::CHUNK_SIZE;
+
+//
+//  Constructors and Destructors
+//
+
+PathSorter::PathSorter(const DirectorySource &source) : source(source) {}
+
+PathSorter::~PathSorter() {}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * sort:    Sorts the directories below root by path, comparing bytes like
+ *          `LC_ALL=C sort` does.
+ *
+ * note:    Every path below a directory starts with its path, so they only
+ *          differ in what comes after. Below a directory each child adds
+ *          two keys: its name, for the child itself, and its name followed
+ *          by '/', for everything below it. The two aren't always next to
+ *          each other, "a" < "a-b" < "a/c" for one. Sorting those keys in
+ *          every directory and walking them depth first gives the same
+ *          order as sorting the full paths, while only ever comparing names.
+ *
+ * @param root: The directory to start from
+ * @param sorted: Filled with the directories, root first
+ ******************************************************************************/
+void PathSorter::sort(uint32_t root, vector<uint32_t> &sorted) {
+    if (!source.contains(root)) {
+        return;
+    }
+    collect(root);
+
+    // Work out where each directory's keys go, a leaf has nothing below it and only needs the one
+    size_t count = nodes.size();
+    firstItem.assign(count + 1, 0);
+    for (size_t position = 0; position < count; ++position) {
+        uint64_t keys = 0;
+        for (size_t child = position + 1; child < ends[position]; child = ends[child]) {
+            keys += (ends[child] > child + 1) ? 2 : 1;
+        }
+        firstItem[position + 1] = firstItem[position] + keys;
+    }
+    items.resize(firstItem[count]);
+
+    // The directories don't share anything while their keys are sorted, so big trees are split up
+    if (count < PARALLEL_THRESHOLD) {
+        sortChildren(0, count);
+    } else {
+        ThreadPool pool;
+        for (size_t begin = 0; begin < count; begin += CHUNK_SIZE) {
+            size_t end = std::min(count, begin + CHUNK_SIZE);
+            pool.enqueue([this, begin, end]() { sortChildren(begin, end); });
+        }
+        pool.waitForCompletion();
+    }
+
+    sorted.reserve(sorted.size() + count);
+    emit(sorted);
+
+    // Only the result is needed from here on
+    vector<uint32_t>().swap(nodes);
+    vector<string_view>().swap(names);
+    vector<uint32_t>().swap(ends);
+    vector<uint64_t>().swap(firstItem);
+    vector<uint64_t>().swap(items);
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * collect: Lists root and every directory below it that was read, depth
+ *          first, so each subtree takes up one run of positions. The walk
+ *          keeps its own stack, a deep tree can't run out of call stack.
+ *
+ * @param root: The directory to start from
+ ******************************************************************************/
+void PathSorter::collect(uint32_t root) {
+    // A frame's iterator points at the frame's own list, so frames must stay where they are
+    struct Frame {
+        size_t position;                    // The directory's position in nodes
+        DirectoryList children;             // Its sub-directories
+        DirectoryList::Iterator next;       // The next one to visit
+    };
+    std::deque<Frame> frames;
+
+    auto enter = [&](uint32_t node) {
+        size_t position = nodes.size();
+        nodes.push_back(node);
+        names.push_back(source.getName(node));
+        ends.push_back(0);
+        frames.push_back(Frame{position, source.getDirectories(node), DirectoryList::Iterator(nullptr, 0, 0)});
+        frames.back().next = frames.back().children.begin();
+    };
+
+    enter(root);
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.next == frame.children.end()) {
+            ends[frame.position] = static_cast<uint32_t>(nodes.size());
+            frames.pop_back();
+            continue;
+        }
+
+        uint32_t child = *frame.next;
+        ++frame.next;
+        if (source.contains(child)) {
+            enter(child);
+        }
+    }
+}
+
+/******************************************************************************
+ * sortChildren:    Fills in and sorts the keys of a run of directories. A key
+ *                  is a child's position shifted left by one, with the low
+ *                  bit set for the key of everything below it.
+ *
+ * @param begin: The first directory's position
+ * @param end: The position one past the last directory
+ ******************************************************************************/
+void PathSorter::sortChildren(size_t begin, size_t end) {
+    for (size_t position = begin; position < end; ++position) {
+        uint64_t *keys = items.data() + firstItem[position];
+        size_t count = 0;
+        for (size_t child = position + 1; child < ends[position]; child = ends[child]) {
+            keys[count++] = uint64_t(child) << 1;
+            if (ends[child] > child + 1) {
+                keys[count++] = (uint64_t(child) << 1) | 1;
+            }
+        }
+        std::sort(keys, keys + count, [this](uint64_t a, uint64_t b) { return before(a, b); });
+    }
+}
+
+/******************************************************************************
+ * before:  Compares two keys of the same directory as bytes, the way
+ *          std::string does. A subtree's key is its name followed by '/'.
+ *
+ * @param a: The first key
+ * @param b: The second key
+ * @return true if a comes first
+ ******************************************************************************/
+bool PathSorter::before(uint64_t a, uint64_t b) const {
+    string_view first = names[a >> 1];
+    string_view second = names[b >> 1];
+    size_t common = std::min(first.size(), second.size());
+
+    int order = (common > 0) ? memcmp(first.data(), second.data(), common) : 0;
+    if (order != 0) {
+        return order < 0;
+    }
+
+    // One name starts the other. Names are unique and hold no '/', so only the '/' of a subtree's key decides.
+    if (first.size() == second.size()) {
+        return (a & 1) < (b & 1);
+    }
+    if (first.size() < second.size()) {
+        return (a & 1) == 0 || '/' < static_cast<unsigned char>(second[common]);
+    }
+    return (b & 1) != 0 && static_cast<unsigned char>(first[common]) < '/';
+}
+
+/******************************************************************************
+ * emit:    Walks the sorted keys from the root. A child's own key adds it,
+ *          the key of what is below it walks into it.
+ *
+ * @param sorted: Where the directories are added
+ ******************************************************************************/
+void PathSorter::emit(vector<uint32_t> &sorted) const {
+    struct Frame {
+        size_t position;                    // The directory whose keys are being walked
+        uint64_t next;                      // The next of its keys
+    };
+    vector<Frame> frames;
+
+    sorted.push_back(nodes[0]);
+    frames.push_back(Frame{0, firstItem[0]});
+    while (!frames.empty()) {
+        Frame &frame = frames.back();
+        if (frame.next == firstItem[frame.position + 1]) {
+            frames.pop_back();
+            continue;
+        }
+
+        uint64_t key = items[frame.next++];
+        size_t child = key >> 1;
+        if (key & 1) {
+            frames.push_back(Frame{child, firstItem[child]});
+        } else {
+            sorted.push_back(nodes[child]);
+        }
+    }
+}
@@ -7,8 +7,12 @@
 #include "ReportGenerator.h"
 #include "DirectoryReader.h"
 #include "FileAnalyzer.h"
+#include "FileTable.h"
+#include "LargestEntries.h"
+#include "OutputSink.h"
+#include "PathSorter.h"
+#include "TreeRenderer.h"
 #include "Utilities.h"
-#include <sstream>
 #include <iostream>
 #include <fstream>
 #include <algorithm>
@@ -19,8 +23,9 @@
 // Constructor and destructor
 //
 
-ReportGenerator::ReportGenerator(std::unordered_map<std::string, DirectoryReader> compDir)
-    : completedDirectories(compDir) {}
+ReportGenerator::ReportGenerator(const DirectorySource& compDir)
+    : completedDirectories(compDir), largestEntries(nullptr), directOutput(false),
+      threadPool(nullptr) {}
 
 ReportGenerator::~ReportGenerator() {
     // Nothing to do here
@@ -30,65 +35,36 @@ ReportGenerator::~ReportGenerator() {
 // Public methods
 //
 
-/******************************************************************************
- * sortDirectories: Sorts a vector of DirectoryReader objects by path.
- ******************************************************************************/
-void ReportGenerator::sortDirectories(std::vector<DirectoryReader>& toSort) {
-    std::sort(toSort.begin(), toSort.end(), 
-        [](const DirectoryReader& a, const DirectoryReader& b) {
-            return a.getPath() < b.getPath();
-        });
-}
-
 /******************************************************************************
  * dumpInfo:  Dumps all the information in the specified root directory
  * 
  * @param fileName: The name of the file to write to
- * @param root: The path of the root directory
+ * @param root: The arena node of the root directory
  * @param mode: The mode to use
  * 
  * Possible modes:
  *      0: Print all information to the console
  *      1: Print all information to a file
  ******************************************************************************/
-void ReportGenerator::dumpInfo(std::string fileName, std::string root, size_t mode) {
-    std::ofstream outFile;
-
-    // Open the file if mode is 1
-    if (mode == 1) {
-        outFile.open(fileName);
-        if (!outFile) {
-            std::cerr << "\033[31mError opening file for writing\033[0m" << std::endl;
-            return;
-        }
+void ReportGenerator::dumpInfo(std::string fileName, uint32_t root, size_t mode) {
+    // Open the file if mode is 1, otherwise the records go to the console
+    OutputSink out;
+    if (!openOutput(out, fileName, mode == 1)) {
+        return;
     }
 
-    std::vector<DirectoryReader> dirs;
+    std::vector<uint32_t> dirs;
     collectSubdirectories(root, dirs);  // Collect all the subdirectories of the root directory
 
     // print the information for each directory to the console or to a file
-    for (const auto& dir : dirs) {
-        std::ostringstream oss;
-        oss << "________________________________________________________________________________" << std::endl;
-        oss << dir.getPath() << std::endl;
-        oss << "Directories: " << dir.getDirectories().size() << std::endl;
-        oss << "Total size: " << dir.getTotalSize() << std::endl;
-        oss << "Average sub-directory size: " << dir.getAverageDirectorySize() << std::endl;
-        oss << "Files: " << dir.getFiles().size() << std::endl;
-        oss << "Average file size: " << dir.getAverageFileSize() << std::endl;
-        oss << "Most common extension: " << dir.getTopFileExtension() << std::endl;
-        oss << std::endl;
-
-        if (mode == 0) {
-            std::cout << oss.str();
-        } else {
-            outFile << oss.str();
-        }
+    std::string record;
+    for (uint32_t dir : dirs) {
+        record.clear();
+        appendInfo(completedDirectories, dir, record);
+        out.write(record);
     }
 
-    if (mode == 1) {
-        outFile.close();
-    }
+    closeOutput(out);
 }
 
 /******************************************************************************
@@ -96,7 +72,7 @@ void ReportGenerator::dumpInfo(std::string fileName, std::string root, size_t mo
  *                  up to a specified level.
  * 
  * @param fileName: The name of the file to write to
- * @param root: The path of the root directory
+ * @param root: The arena node of the root directory
  * @param mode: The mode to use
  * @param levels: The number of levels to consider
  * 
@@ -104,61 +80,150 @@ void ReportGenerator::dumpInfo(std::string fileName, std::string root, size_t mo
  *      0: Print all information to the console
  *      1: Print all information to a file
  ******************************************************************************/
-void ReportGenerator::dumpInfoLevels(std::string fileName, std::string root, size_t mode, size_t levels) {
-    std::ofstream outFile;
-
-    // Open the file if mode is 1
-    if (mode == 1) {
-        outFile.open(fileName);
-        if (!outFile) {
-            std::cerr << "\033[31mError opening file for writing\033[0m" << std::endl;
-            return;
-        }
+void ReportGenerator::dumpInfoLevels(std::string fileName, uint32_t root, size_t mode, size_t levels) {
+    // Open the file if mode is 1, otherwise the records go to the console
+    OutputSink out;
+    if (!openOutput(out, fileName, mode == 1)) {
+        return;
     }
 
-    std::vector<DirectoryReader> dirs;
+    std::vector<uint32_t> dirs;
 
     // Collect all the subdirectories of the root directory up to the given level
     collectSubdirectoriesLevels(root, dirs, levels);  
 
     // Print the information for each directory to the console or to a file
-    for (const auto& dir : dirs) {
-        std::ostringstream oss;
-        oss << "________________________________________________________________________________" << std::endl;
-        oss << dir.getPath() << std::endl;
-        oss << "Directories: " << dir.getDirectories().size() << std::endl;
-        oss << "Total size: " << dir.getTotalSize() << std::endl;
-        oss << "Average sub-directory size: " << dir.getAverageDirectorySize() << std::endl;
-        oss << "Files: " << dir.getFiles().size() << std::endl;
-        oss << "Average file size: " << dir.getAverageFileSize() << std::endl;
-        oss << "Most common extension: " << dir.getTopFileExtension() << std::endl;
-        oss << std::endl;
-
-        if (mode == 0) {
-            std::cout << oss.str();
-        } else {
-            outFile << oss.str();
-        }
+    std::string record;
+    for (uint32_t dir : dirs) {
+        record.clear();
+        appendInfo(completedDirectories, dir, record);
+        out.write(record);
+    }
+
+    closeOutput(out);
+}
+
+
+/******************************************************************************
+ * dumpLargest: Prints the largest files and directories below the specified
+ *              root, largest first.
+ * 
+ * note:    A scan that knew about the report beforehand hands over what its
+ *          workers collected, and nothing has to be looked through here.
+ *          Otherwise, such as for a snapshot, every file is offered to a
+ *          bounded heap of the same kind, so only the largest are ever held.
+ *          Files with several links are then listed under every name.
+ * 
+ * @param fileName: The name of the file to write to
+ * @param root: The arena node of the root directory
+ * @param mode: The mode to use
+ * @param limit: How many files and how many directories to list
+ * 
+ * Possible modes:
+ *      0: Print the largest entries to the console
+ *      1: Print the largest entries to a file
+ ******************************************************************************/
+void ReportGenerator::dumpLargest(std::string fileName, uint32_t root, size_t mode, size_t limit) {
+    OutputSink out;
+    if (!openOutput(out, fileName, mode == 1)) {
+        return;
     }
 
-    if (mode == 1) {
-        outFile.close();
+    std::vector<LargestEntry> files;
+    std::vector<LargestEntry> dirs;
+    if (largestEntries != nullptr && largestEntries->getLimit() >= limit) {
+        files = largestEntries->getFiles();
+        dirs = largestEntries->getDirectories();
+    } else {
+        LargestEntries largest(limit);
+        std::vector<uint32_t> all;
+        collectSubdirectories(root, all);
+        for (uint32_t dir : all) {
+            largest.offerDirectory(dir, completedDirectories.getTotalSize(dir), completedDirectories.getAllocatedSize(dir));
+            for (size_t i = 0; i < completedDirectories.getFileCount(dir); ++i) {
+                largest.offerFile(dir, completedDirectories.getFileName(dir, i), completedDirectories.getFileSize(dir, i),
+                                  completedDirectories.getFileAllocatedSize(dir, i));
+            }
+        }
+        files = largest.getFiles();
+        dirs = largest.getDirectories();
     }
+    files.resize(std::min(files.size(), limit));
+    dirs.resize(std::min(dirs.size(), limit));
+
+    // The numbers are right aligned in columns 16 characters wide
+    auto printEntries = [&](const std::string& title, const std::vector<LargestEntry>& entries) {
+        out.write(title);
+        out.write("\n            Size       Allocated  Path\n");
+        std::string path;
+        for (const LargestEntry& entry : entries) {
+            path.clear();
+            completedDirectories.appendPath(entry.dir, path);
+            if (!entry.name.empty()) {
+                if (path.empty() || path.back() != '/') {
+                    path += '/';
+                }
+                path += entry.name;
+            }
+            out.writeNumber(entry.size, 16);
+            out.writeNumber(entry.allocated, 16);
+            out.write("  ");
+            out.write(path);
+            out.put('\n');
+        }
+    };
+
+    printEntries("Largest files:", files);
+    out.put('\n');
+    printEntries("Largest directories:", dirs);
+
+    closeOutput(out);
 }
 
+/******************************************************************************
+ * dumpJson:    Dumps the information about every directory below the
+ *              specified root as NDJSON, one object per line, for tools that
+ *              load the results instead of reading them.
+ * 
+ * @param fileName: The name of the file to write to
+ * @param root: The arena node of the root directory
+ * @param mode: The mode to use
+ * 
+ * Possible modes:
+ *      0: Print the records to the console
+ *      1: Print the records to a file
+ ******************************************************************************/
+void ReportGenerator::dumpJson(std::string fileName, uint32_t root, size_t mode) {
+    OutputSink out;
+    if (!openOutput(out, fileName, mode == 1)) {
+        return;
+    }
+
+    std::vector<uint32_t> dirs;
+    collectSubdirectories(root, dirs);
+
+    std::string record;
+    for (uint32_t dir : dirs) {
+        record.clear();
+        appendJson(completedDirectories, dir, record);
+        out.write(record);
+    }
+
+    closeOutput(out);
+}
 
 /******************************************************************************
  * collectSubdirectories: Recursively collects all the subdirectories of a
  *                        given directory.
  ******************************************************************************/
-void ReportGenerator::collectSubdirectories(std::string root, std::vector<DirectoryReader>& dirs) {
-    if (completedDirectories.find(root) == completedDirectories.end()) {
+void ReportGenerator::collectSubdirectories(uint32_t root, std::vector<uint32_t>& dirs) {
+    if (!completedDirectories.contains(root)) {
         return;
     }
 
-    dirs.push_back(completedDirectories[root]);
+    dirs.push_back(root);
 
-    for (const auto& subDir : completedDirectories[root].getDirectories()) {
+    for (const auto& subDir : completedDirectories.getDirectories(root)) {
         collectSubdirectories(subDir, dirs);
     }
 }
@@ -169,113 +234,97 @@ void ReportGenerator::collectSubdirectories(std::string root, std::vector<Direct
  * 
  * 
  ******************************************************************************/
-void ReportGenerator::collectSubdirectoriesLevels(std::string root, std::vector<DirectoryReader>& dirs, size_t level) {
-    if (completedDirectories.find(root) == completedDirectories.end()) {
+void ReportGenerator::collectSubdirectoriesLevels(uint32_t root, std::vector<uint32_t>& dirs, size_t level) {
+    if (!completedDirectories.contains(root)) {
         return;
     }
 
-    dirs.push_back(completedDirectories[root]);
+    dirs.push_back(root);
 
     if (level > 0) {
-        for (const auto& subDir : completedDirectories[root].getDirectories()) {
+        for (const auto& subDir : completedDirectories.getDirectories(root)) {
             collectSubdirectoriesLevels(subDir, dirs, level - 1);
         }
     }
 }
 
 /******************************************************************************
- * dumpPaths: Dumps all the paths in the completedDirectories map to a file
+ * dumpPaths: Dumps all the paths in the completedDirectories registry to a file
  * 
  * @param fileName: The name of the file to write to
- * @param root: The path of the root directory
+ * @param root: The arena node of the root directory
  * @param mode: The mode to use
  * 
  * Possible modes:
  *      0: Print all paths
- *      1: Print all paths sorted by size
+ *      1: Print all paths sorted by path
  *      2: Dump all paths
- *      3: Dump all paths sorted by size
+ *      3: Dump all paths sorted by path
  ******************************************************************************/
-void ReportGenerator::dumpPaths(std::string fileName, std::string root, size_t mode) {
-    std::vector<DirectoryReader> dirs;
-    collectSubdirectories(root, dirs);
+void ReportGenerator::dumpPaths(std::string fileName, uint32_t root, size_t mode) {
+    std::vector<uint32_t> dirs;
+    if (mode == 1 || mode == 3) {
+        PathSorter sorter(completedDirectories);
+        sorter.sort(root, dirs);    // Sorted in place in the tree, the paths are only built to be written
+    } else {
+        collectSubdirectories(root, dirs);
+    }
 
     if (dirs.empty()) {
         std::cerr << "\033[31mError: No directories to sort\033[0m" << std::endl;
         return;
     }
 
-    // Sorting logic here if mode is 1 or 3
-
-    std::ofstream outFile;
-    if (mode == 2 || mode == 3) {
-        outFile.open(fileName);
-        if (!outFile) {
-            std::cerr << "\033[31mError opening file for writing\033[0m" << std::endl;
-            return;
-        }
+    OutputSink out;
+    if (!openOutput(out, fileName, mode == 2 || mode == 3)) {
+        return;
     }
 
-    for (const auto& dir : dirs) {
-        if (mode < 2) {
-            std::cout << dir.getPath() << std::endl;
-        } else {
-            outFile << dir.getPath() << std::endl;
-        }
+    std::string path;
+    for (uint32_t dir : dirs) {
+        path.clear();
+        completedDirectories.appendPath(dir, path);
+        path += '\n';
+        out.write(path);
     }
 
-    if (mode == 2 || mode == 3) {
-        outFile.close();
-    }
+    closeOutput(out);
 }
 
 /******************************************************************************
  * treeBuilder: Builds a tree of all the directories in the specified root
  *              directory.
  * 
- * @param rootPath: The path of the root directory
+ * @param rootNode: The arena node of the root directory
  * @param mode: The mode to use
  * 
  * Possible modes:
  *      0: Print the tree to the console
  *      1: Print the tree to a file
  ******************************************************************************/
-void ReportGenerator::treeBuilder(std::string fileName, std::string rootPath, size_t mode) {
+void ReportGenerator::treeBuilder(std::string fileName, uint32_t rootNode, size_t mode) {
     try {
-    // Check if the root directory exists in the completedDirectories map
-    if (completedDirectories.find(rootPath) == completedDirectories.end()) {
+    // Check if the root directory exists in the completedDirectories registry
+    if (!completedDirectories.contains(rootNode)) {
         std::cerr << "\033[31mError: Root directory does not exist\033[0m" << std::endl;
         return;
     }
 
-    // Get the root DirectoryReader object
-    DirectoryReader rootDir = completedDirectories[rootPath];
-
     // Check if the root directory is empty
-    if (rootDir.getDirectories().empty() && rootDir.getFiles().empty()) {
+    if (completedDirectories.getDirectories(rootNode).empty() && completedDirectories.getFileCount(rootNode) == 0) {
         std::cerr << "\033[31mError: Root directory is empty\033[0m" << std::endl;
         return;
     }
 
-    std::ostream* outStream;
-    std::ofstream outFile;
-
-    if (mode == 0) {
-        outStream = &std::cout;
-    } else {
-        outFile.open(fileName);
-        if (!outFile.is_open()) {
-            std::cerr << "\033[31mUnable to open file\033[0m";
-            return;
-        }
-        outStream = &outFile;
+    OutputSink out;
+    if (!openOutput(out, fileName, mode != 0)) {
+        return;
     }
 
-    printTree(rootDir, "", true, true, *outStream);
+    TreeRenderer renderer(completedDirectories, threadPool);
+    renderer.render(rootNode, SIZE_MAX, out);
 
-     if (mode != 0) {
-            outFile.close();
-        }
+    closeOutput(out);
         
     } catch (const std::exception& e) {
         std::cerr << "\033[31mException in treeBuilder: " << e.what() << "\033[0m" << std::endl;
@@ -286,7 +335,7 @@ void ReportGenerator::treeBuilder(std::string fileName, std::string rootPath, si
  * treeBuilderLevels: Builds a tree of all the directories in the specified root
  *                    directory up to a certain level.
  * 
- * @param rootPath: The path of the root directory
+ * @param rootNode: The arena node of the root directory
  * @param mode: The mode to use
  * @param levels: The number of levels deep to go
  * 
@@ -294,119 +343,280 @@ void ReportGenerator::treeBuilder(std::string fileName, std::string rootPath, si
  *      0: Print the tree to the console
  *      1: Print the tree to a file
  ******************************************************************************/
-void ReportGenerator::treeBuilderLevels(std::string fileName, std::string rootPath, size_t mode, size_t levels) {
-    if (completedDirectories.find(rootPath) == completedDirectories.end()) {
+void ReportGenerator::treeBuilderLevels(std::string fileName, uint32_t rootNode, size_t mode, size_t levels) {
+    if (!completedDirectories.contains(rootNode)) {
         return;
     }
 
-    DirectoryReader rootDir = completedDirectories[rootPath];
-
-    if (rootDir.getDirectories().empty() && rootDir.getFiles().empty()) {
+    if (completedDirectories.getDirectories(rootNode).empty() && completedDirectories.getFileCount(rootNode) == 0) {
         return;
     }
 
-    std::ostream* outStream;
-    std::ofstream outFile;
-
-    if (mode == 0) {
-        outStream = &std::cout;
-    } else {
-        outFile.open(fileName);
-        if (!outFile.is_open()) {
-            std::cerr << "\033[0mUnable to open file\033[0m";
-            return;
-        }
-        outStream = &outFile;
+    OutputSink out;
+    if (!openOutput(out, fileName, mode != 0)) {
+        return;
     }
 
-    printTreeLevels(rootDir, "", true, true, levels, *outStream);
+    TreeRenderer renderer(completedDirectories, threadPool);
+    renderer.render(rootNode, levels, out);
 
-    if (mode != 0) {
-        outFile.close();
-    }
+    closeOutput(out);
 }
 
 /******************************************************************************
- * printTreeLevels: Prints a tree of directories and files up to a certain level
- *                  deep
+ * startTreeLine:   Starts a line of a tree with the prefix and the branch
+ *                  leading to the entry, then grows the prefix by the part
+ *                  the entry's children are indented with. The root's line
+ *                  has neither.
  * 
- * @param dir: The DirectoryReader object to print
- * @param prefix: The prefix to use for each line
- * @param isLast: Whether or not the current directory is the last in the list
- * @param isRoot: Whether or not the current directory is the root
- * @param levels: The number of levels deep to go
- * @param outStream: The output stream to print to
+ * @param prefix: The prefix of the entry's line
+ * @param isLast: Whether or not the entry is the last in its directory
+ * @param isRoot: Whether or not the entry is the root
  ******************************************************************************/
-void ReportGenerator::printTreeLevels(const DirectoryReader& dir, std::string prefix, bool isLast,
-                                      bool isRoot, size_t levels, std::ostream& outStream) {
-    if (levels == 0) return;
-
-    std::string newPrefix;
-    if (isRoot) {
-        outStream << dir.getPath() << std::endl;
-        newPrefix = prefix;
-        isRoot = false;
-    } else {
-        outStream << prefix << (isLast ? "└─ " : "├─ ") << dir.getPath() << std::endl;
-        newPrefix = prefix + (isLast ? "   " : "│  ");
+void ReportGenerator::startTreeLine(std::string& prefix, bool isLast, bool isRoot) {
+    line.clear();
+    if (!isRoot) {
+        line += prefix;
+        line += isLast ? "└─ " : "├─ ";
+        prefix += isLast ? "   " : "│  ";
     }
+}
 
-    std::vector<std::string> subDirs = dir.getDirectories();
-    for (size_t i = 0; i < subDirs.size(); ++i) {
-        if (completedDirectories.find(subDirs[i]) != completedDirectories.end()) {
-            printTreeLevels(completedDirectories[subDirs[i]], newPrefix, i == subDirs.size() - 1 && dir.getFiles().empty(), false, levels - 1, outStream);
-        }
+/******************************************************************************
+ * sizeTreeBuilder: Builds a tree of the specified root directory where every
+ *                  directory lists its largest files and sub-directories
+ *                  first, like ncdu, so it shows where the space went.
+ * 
+ * @param fileName: The name of the file to write to
+ * @param rootNode: The arena node of the root directory
+ * @param mode: The mode to use
+ * @param levels: The number of levels deep to go, the root's line is the first
+ * @param entries: The number of entries to list in each directory
+ * 
+ * Possible modes:
+ *      0: Print the tree to the console
+ *      1: Print the tree to a file
+ ******************************************************************************/
+void ReportGenerator::sizeTreeBuilder(std::string fileName, uint32_t rootNode, size_t mode, size_t levels,
+                                      size_t entries) {
+    if (!completedDirectories.contains(rootNode)) {
+        std::cerr << "\033[31mError: Root directory does not exist\033[0m" << std::endl;
+        return;
     }
 
-    std::vector<FileAnalyzer> files = dir.getFiles();
-    for (size_t i = 0; i < files.size(); ++i) {
-        outStream << newPrefix << (i == files.size() - 1 ? "└─ " : "├─ ") << files[i].getFileName() << std::endl;
+    OutputSink out;
+    if (!openOutput(out, fileName, mode != 0)) {
+        return;
     }
+
+    printSizeTree(rootNode, levels, entries, out);
+
+    closeOutput(out);
 }
 
 /******************************************************************************
- * printTree: Prints a tree of all the directories and files in the specified
- *            root
- * 
- * @param dir: The DirectoryReader object to print
- * @param prefix: The prefix to use for each line
- * @param isLast: Whether or not the current directory is the last in the list
- * @param isRoot: Whether or not the current directory is the root
- * @param outStream: The output stream to print to
+ * printSizeTree:   Prints a directory with its size, then its largest files
+ *                  and sub-directories, largest first, and one line adding
+ *                  up the rest. The walk keeps its own stack, so a deep tree
+ *                  can't run out of call stack.
+ * 
+ * note:    The sizes below a directory are already rolled up, so only the
+ *          entries that are listed are ever walked into. nth_element()
+ *          picks them out without sorting the rest, a directory of a
+ *          million small files costs one pass over it. Every depth keeps
+ *          one list of entries, reused by each directory at that depth.
+ * 
+ * @param root: The directory at the top of the tree
+ * @param levels: The number of levels deep to go, counting the root
+ * @param entries: The number of entries to list in each directory
+ * @param out: Where the tree is written
  ******************************************************************************/
-void ReportGenerator::printTree(const DirectoryReader& dir, std::string prefix, bool isLast,
-                                                        bool isRoot, std::ostream& outStream) {
-    std::string newPrefix;
-    try {
-    if (isRoot) {
-        outStream << dir.getPath() << std::endl;
-        newPrefix = prefix;
-        isRoot = false;
-    } else {
-        outStream << prefix << (isLast ? "└─ " : "├─ ") << dir.getPath() << std::endl;
-        newPrefix = prefix + (isLast ? "   " : "│  ");
-    }
+void ReportGenerator::printSizeTree(uint32_t root, size_t levels, size_t entries, OutputSink& out) {
+    struct Frame {
+        uint32_t dir;                       // The directory
+        size_t depth;                       // How far below the root it is, and its list in scratch
+        size_t levels;                      // The levels left, counting the directory
+        size_t prefixLength;                // The length of the prefix of its own line
+        size_t next;                        // The next listed entry to print
+        size_t shown;                       // How many entries are listed
+        size_t others;                      // How many entries are left out
+        uint64_t otherBytes;                // How many bytes those take up
+    };
+    std::vector<Frame> frames;
+    std::vector<std::vector<SizedEntry>> scratch;
+    std::string prefix;
+
+    auto nameOf = [this](uint32_t dir, const SizedEntry& entry) {
+        return entry.directory ? completedDirectories.getName(entry.id) : completedDirectories.getFileName(dir, entry.id);
+    };
+
+    auto enter = [&](uint32_t dir, bool isLast, bool isRoot, size_t levelsLeft, size_t depth) {
+        Frame frame{dir, depth, levelsLeft, prefix.size(), 0, 0, 0, 0};
+        startTreeLine(prefix, isLast, isRoot);
+        completedDirectories.appendPath(dir, line);
+        line += " (";
+        OutputSink::appendNumber(line, completedDirectories.getTotalSize(dir));
+        line += " bytes)\n";
+        out.write(line);
+
+        if (levelsLeft > 1) {
+            if (scratch.size() <= depth) {
+                scratch.resize(depth + 1);
+            }
+            std::vector<SizedEntry>& children = scratch[depth];
+            children.clear();
+            for (uint32_t subDir : completedDirectories.getDirectories(dir)) {
+                if (completedDirectories.contains(subDir)) {
+                    children.push_back({completedDirectories.getTotalSize(subDir), subDir, true});
+                }
+            }
+            size_t numFiles = completedDirectories.getFileCount(dir);
+            for (size_t i = 0; i < numFiles; ++i) {
+                children.push_back({completedDirectories.getFileSize(dir, i), static_cast<uint32_t>(i), false});
+            }
+
+            // Largest first, ties by name so the tree comes out the same every time
+            auto larger = [&nameOf, dir](const SizedEntry& a, const SizedEntry& b) {
+                if (a.size != b.size) {
+                    return a.size > b.size;
+                }
+                return nameOf(dir, a) < nameOf(dir, b);
+            };
+
+            frame.shown = std::min(entries, children.size());
+            if (frame.shown < children.size()) {
+                std::nth_element(children.begin(), children.begin() + frame.shown, children.end(), larger);
+            }
+            std::sort(children.begin(), children.begin() + frame.shown, larger);
 
-    // Print the subdirectories
-    std::vector<std::string> subDirs = dir.getDirectories();
-    for (size_t i = 0; i < subDirs.size(); ++i) {
-        if (completedDirectories.find(subDirs[i]) != completedDirectories.end()) {
-            printTree(completedDirectories[subDirs[i]], newPrefix, i == subDirs.size() - 1 && dir.getFiles().empty(), false, outStream);
+            frame.others = children.size() - frame.shown;
+            for (size_t i = frame.shown; i < children.size(); ++i) {
+                frame.otherBytes += children[i].size;
+            }
         }
-    }
-    
-    // Print the files
-    std::vector<FileAnalyzer> files = dir.getFiles();
-    for (size_t i = 0; i < files.size(); ++i) {
-        outStream << newPrefix << (i == files.size() - 1 ? "└─ " : "├─ ") << files[i].getFileName() << std::endl;
-    }
-        
-    } catch (const std::exception& e) {
-        std::cerr << "\033[31mException in printTree: " << e.what() << "\033[0m" << std::endl;
+        frames.push_back(frame);
+    };
+
+    enter(root, true, true, levels, 0);
+    while (!frames.empty()) {
+        Frame& frame = frames.back();
+
+        // The listed entries, walking into the sub-directories
+        if (frame.next < frame.shown) {
+            SizedEntry child = scratch[frame.depth][frame.next++];
+            bool last = (frame.next == frame.shown && frame.others == 0);
+            if (child.directory) {
+                enter(child.id, last, false, frame.levels - 1, frame.depth + 1);
+            } else {
+                line.assign(prefix);
+                line += last ? "└─ " : "├─ ";
+                line += nameOf(frame.dir, child);
+                line += " (";
+                OutputSink::appendNumber(line, child.size);
+                line += " bytes)\n";
+                out.write(line);
+            }
+            continue;
+        }
+
+        // Then the line adding up the rest
+        if (frame.others > 0) {
+            line.assign(prefix);
+            line += "└─ ";
+            OutputSink::appendNumber(line, frame.others);
+            line += (frame.others == 1) ? " other, " : " others, ";
+            OutputSink::appendNumber(line, frame.otherBytes);
+            line += " bytes\n";
+            out.write(line);
+        }
+        prefix.resize(frame.prefixLength);
+        frames.pop_back();
     }
 }
 
+/******************************************************************************
+ * appendInfo:  Appends the block -i prints for a directory. The streaming
+ *              mode writes the same records, so both go through here.
+ * 
+ * @param source: The directories that have been read
+ * @param dir: The directory to describe
+ * @param out: Where the record is appended
+ ******************************************************************************/
+void ReportGenerator::appendInfo(const DirectorySource& source, uint32_t dir, std::string& out) {
+    out += "________________________________________________________________________________\n";
+    source.appendPath(dir, out);
+    out += "\nDirectories: ";
+    OutputSink::appendNumber(out, source.getDirectoryCount(dir));
+    out += "\nTotal size: ";
+    OutputSink::appendNumber(out, source.getTotalSize(dir));
+    out += "\nAllocated size: ";
+    OutputSink::appendNumber(out, source.getAllocatedSize(dir));
+    out += "\nAverage sub-directory size: ";
+    OutputSink::appendDouble(out, source.getAverageDirectorySize(dir));
+    out += "\nFiles: ";
+    OutputSink::appendNumber(out, source.getFileCount(dir));
+    out += "\nAverage file size: ";
+    OutputSink::appendDouble(out, source.getAverageFileSize(dir));
+    out += "\nMost common extension: ";
+    out += source.getTopFileExtension(dir);
+    out += "\n\n";
+}
 
+/******************************************************************************
+ * appendJson:  Appends a directory as one line of NDJSON.
+ * 
+ * note:    Names are bytes, not text. Quotes, backslashes and control
+ *          characters are escaped, anything else is written as it is, so a
+ *          name that isn't valid UTF-8 stays byte for byte what is on disk.
+ * 
+ * @param source: The directories that have been read
+ * @param dir: The directory to describe
+ * @param out: Where the record is appended
+ ******************************************************************************/
+void ReportGenerator::appendJson(const DirectorySource& source, uint32_t dir, std::string& out) {
+    auto appendString = [&out](std::string_view text) {
+        static const char HEX[] = "0123456789abcdef";
+        out += '"';
+        for (char c : text) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (byte < 0x20) {
+                out += "\\u00";
+                out += HEX[byte >> 4];
+                out += HEX[byte & 0xF];
+            } else {
+                out += c;
+            }
+        }
+        out += '"';
+    };
+
+    // Paths rarely need escaping, so the path is appended in place and only copied if it does
+    out += "{\"path\":\"";
+    size_t pathStart = out.size();
+    source.appendPath(dir, out);
+    auto needsEscape = [](char c) { return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20; };
+    if (std::any_of(out.begin() + pathStart, out.end(), needsEscape)) {
+        std::string path = out.substr(pathStart);
+        out.resize(pathStart - 1);
+        appendString(path);
+    } else {
+        out += '"';
+    }
+    out += ",\"directories\":";
+    OutputSink::appendNumber(out, source.getDirectoryCount(dir));
+    out += ",\"files\":";
+    OutputSink::appendNumber(out, source.getFileCount(dir));
+    out += ",\"size\":";
+    OutputSink::appendNumber(out, source.getTotalSize(dir));
+    out += ",\"allocated\":";
+    OutputSink::appendNumber(out, source.getAllocatedSize(dir));
+    out += ",\"extension\":";
+    appendString(source.getTopFileExtension(dir));
+    out += "}\n";
+}
 
 /******************************************************************************
  * mapArgument: Maps a string argument to an Argument enum value for use in
@@ -425,13 +635,159 @@ Argument ReportGenerator::mapArgument(const std::string& arg) {
     if (arg == "-lis") return LEVELS_INFO_TO_FILE;
     if (arg == "-lt") return LEVELS_TREE;
     if (arg == "-lts") return LEVELS_TREE_TO_FILE;
+    if (arg == "-tS") return SIZE_TREE;
+    if (arg == "-tSs") return SIZE_TREE_TO_FILE;
+    if (arg == "-ltS") return LEVELS_SIZE_TREE;
+    if (arg == "-ltSs") return LEVELS_SIZE_TREE_TO_FILE;
+    if (arg == "-top") return LARGEST;
+    if (arg == "-tops") return LARGEST_TO_FILE;
+    if (arg == "-j") return JSON;
+    if (arg == "-js") return JSON_TO_FILE;
     return UNKNOWN;
 }
 
+/******************************************************************************
+ * requiredStatxMask: Works out which statx fields the scan has to collect so
+ *                    every requested report has the data it prints.
+ * 
+ * @param arguments: A vector of arguments passed in from the command line
+ * @return The statx mask to request for each directory entry
+ ******************************************************************************/
+unsigned int ReportGenerator::requiredStatxMask(const std::vector<std::string>& arguments) {
+    unsigned int mask = STATX_TYPE;  // Always needed to tell files from directories
+
+    for (const auto& argument : arguments) {
+        switch (mapArgument(argument)) {
+            case INFO:
+            case INFO_TO_FILE:
+            case LEVELS_INFO:
+            case LEVELS_INFO_TO_FILE:
+            case LARGEST:
+            case LARGEST_TO_FILE:
+            case JSON:
+            case JSON_TO_FILE:
+            case SIZE_TREE:
+            case SIZE_TREE_TO_FILE:
+            case LEVELS_SIZE_TREE:
+            case LEVELS_SIZE_TREE_TO_FILE:
+                mask |= STATX_SIZE | STATX_BLOCKS | STATX_NLINK | STATX_INO;  // NLINK and INO to count hard links once
+                break;
+            default:
+                break;
+        }
+    }
+
+    return mask;
+}
+
+/******************************************************************************
+ * largestLimit: Finds the most entries any -top or -tops report asks for, so
+ *               the scan can keep that many while it runs.
+ * 
+ * @param arguments: A vector of arguments passed in from the command line
+ * @return The largest count asked for, 0 if there is no such report
+ ******************************************************************************/
+size_t ReportGenerator::largestLimit(const std::vector<std::string>& arguments) {
+    size_t limit = 0;
+
+    for (size_t i = 0; i + 1 < arguments.size(); ++i) {
+        Argument arg = mapArgument(arguments[i]);
+        if (arg == LARGEST || arg == LARGEST_TO_FILE) {
+            try {
+                limit = std::max<size_t>(limit, std::stoul(arguments[i + 1]));
+            } catch (const std::exception&) {
+                // generateReport() reports it
+            }
+        }
+    }
+
+    return limit;
+}
+
+/******************************************************************************
+ * listsFiles: Checks if any report needs the rows of every file. The -top
+ *             reports are answered from what was collected during the scan,
+ *             so on their own the scan only has to keep each directory's
+ *             totals.
+ * 
+ * @param arguments: A vector of arguments passed in from the command line
+ * @return true if the scan has to keep every file
+ ******************************************************************************/
+bool ReportGenerator::listsFiles(const std::vector<std::string>& arguments) {
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        Argument arg = mapArgument(arguments[i]);
+        if (arg == LARGEST || arg == LARGEST_TO_FILE) {
+            ++i;    // Skip the count
+        } else {
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************
+ * setLargestEntries: Hands over the largest files and directories collected
+ *                    during the scan, for the -top reports.
+ * 
+ * @param largest: What the scan collected
+ ******************************************************************************/
+void ReportGenerator::setLargestEntries(const LargestEntries* largest) {
+    largestEntries = largest;
+}
+
+/******************************************************************************
+ * setDirectOutput: Writes the report files with O_DIRECT, so a report much
+ *                  larger than the memory doesn't push everything else out of
+ *                  the page cache.
+ * 
+ * @param direct: Whether to bypass the page cache
+ ******************************************************************************/
+void ReportGenerator::setDirectOutput(bool direct) {
+    directOutput = direct;
+}
+
+/******************************************************************************
+ * setThreadPool:   Hands over a pool to render the -t and -lt trees on, so
+ *                  a report doesn't start threads of its own.
+ * 
+ * @param pool: The pool, or nullptr to render on this thread
+ ******************************************************************************/
+void ReportGenerator::setThreadPool(ThreadPool* pool) {
+    threadPool = pool;
+}
+
+/******************************************************************************
+ * openOutput:  Opens where a report goes, the console or the output file.
+ * 
+ * @param out: The sink to open
+ * @param fileName: The file to write to
+ * @param toFile: Whether the report goes to the file rather than the console
+ * @return true if it could be opened
+ ******************************************************************************/
+bool ReportGenerator::openOutput(OutputSink& out, const std::string& fileName, bool toFile) {
+    if (toFile ? out.openFile(fileName, directOutput) : out.openConsole()) {
+        return true;
+    }
+    std::cerr << "\033[31mError opening file for writing\033[0m" << std::endl;
+    return false;
+}
+
+/******************************************************************************
+ * closeOutput: Waits for a report to be written and says so if it couldn't
+ *              be, such as when the disk is full.
+ * 
+ * @param out: The sink the report was written to
+ ******************************************************************************/
+void ReportGenerator::closeOutput(OutputSink& out) {
+    if (!out.close()) {
+        std::cerr << "\033[31mError writing the report\033[0m" << std::endl;
+    }
+}
+
 /******************************************************************************
  * generateReport: Generates a report based on the arguments passed in.
  * 
- * @param root: The path of the root directory
+ * @param root: The arena node of the root directory
  * @param arguments: A vector of arguments passed in from the command line
  * 
  * Possible arguments:
@@ -448,8 +804,16 @@ Argument ReportGenerator::mapArgument(const std::string& arg) {
  *      -lis <numLevels (int)> : Print information about the first <numLevels> levels of directories to a file
  *      -lt  <numLevels (int)> : Print the tree of directories for the first <numLevels> levels
  *      -lts <numLevels (int)> : Print the tree of directories to a file for the first <numLevels> levels
+ *      -top  <numEntries (int)> : Print the largest files and directories
+ *      -tops <numEntries (int)> : Print the largest files and directories to a file
+ *      -j:     Prints the information about every directory as NDJSON
+ *      -js:    Prints the information about every directory as NDJSON to a file
+ *      -tS   <numEntries (int)> : Print the tree with the <numEntries> largest entries of each directory first
+ *      -tSs  <numEntries (int)> : Print the tree with the largest entries first to a file
+ *      -ltS  <numLevels (int)> <numEntries (int)> : Print the tree with the largest entries first for the first <numLevels> levels
+ *      -ltSs <numLevels (int)> <numEntries (int)> : Print the tree with the largest entries first to a file for the first <numLevels> levels
  ******************************************************************************/
-int ReportGenerator::generateReport(std::string fileName, std::string root, std::vector<std::string> arguments) {
+int ReportGenerator::generateReport(std::string fileName, uint32_t root, std::vector<std::string> arguments) {
     int errorCode = 0; // 0 means no error
     std::ofstream reportFile;
 
@@ -518,6 +882,43 @@ int ReportGenerator::generateReport(std::string fileName, std::string root, std:
                         ++i; 
                     }
                     break;
+                case LARGEST:
+                    if (i + 1 < arguments.size()) {
+                        size_t numEntries = std::stoul(arguments[i + 1]);
+                        dumpLargest(fileName, root, 0, numEntries);
+                        ++i;
+                    }
+                    break;
+                case LARGEST_TO_FILE:
+                    if (i + 1 < arguments.size()) {
+                        size_t numEntries = std::stoul(arguments[i + 1]);
+                        dumpLargest(fileName, root, 1, numEntries);
+                        ++i;
+                    }
+                    break;
+                case SIZE_TREE:
+                case SIZE_TREE_TO_FILE:
+                    if (i + 1 < arguments.size()) {
+                        size_t numEntries = std::stoul(arguments[i + 1]);
+                        sizeTreeBuilder(fileName, root, arg == SIZE_TREE ? 0 : 1, SIZE_MAX, numEntries);
+                        ++i;
+                    }
+                    break;
+                case LEVELS_SIZE_TREE:
+                case LEVELS_SIZE_TREE_TO_FILE:
+                    if (i + 2 < arguments.size()) {
+                        size_t numLevels = std::stoul(arguments[i + 1]);
+                        size_t numEntries = std::stoul(arguments[i + 2]);
+                        sizeTreeBuilder(fileName, root, arg == LEVELS_SIZE_TREE ? 0 : 1, numLevels, numEntries);
+                        i += 2;
+                    }
+                    break;
+                case JSON:
+                    dumpJson(fileName, root, 0);
+                    break;
+                case JSON_TO_FILE:
+                    dumpJson(fileName, root, 1);
+                    break;
                 default:
                         std::cerr << "\033[31mUnknown argument: " << arguments[i] << "\033[0m" << std::endl;
                         errorCode = 2; // Update error code
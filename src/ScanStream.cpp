@@ -0,0 +1,200 @@
+/******************************************************************************
+ * File: ScanStream.cpp
+ * Description: Writes a report while the scan is still running. Every
+ *              directory's record is written as soon as its totals are final,
+ *              through an OutputSink with a writer thread of its own, so the
+ *              scan doesn't have to keep the files of the whole tree around
+ *              for a report at the end.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "ScanStream.h"                     // header file for class definition
+#include "DirectorySource.h"                // for building the records
+#include <iostream>                         // for error messages
+
+using std::string;
+
+const size_t ScanStream::BATCH_SIZE;
+std::atomic<uint64_t> ScanStream::nextId(1);
+
+//
+//  Constructors and Destructors
+//
+
+ScanStream::ScanStream()
+    : report(UNKNOWN), source(nullptr), records(0), id(nextId.fetch_add(1, std::memory_order_relaxed)), opened(false) {}
+
+ScanStream::~ScanStream() {
+    if (opened) {
+        close();
+    }
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * configure:   Picks the report to stream from the report arguments. Only
+ *              the reports that describe one directory at a time can be
+ *              written before the scan is over, and only one of them, since
+ *              the file ones would all write to the same file.
+ *
+ * @param arguments: The report arguments
+ * @return true if they are a single report that can be streamed
+ ******************************************************************************/
+bool ScanStream::configure(const std::vector<string> &arguments) {
+    Argument arg = (arguments.size() == 1) ? ReportGenerator::mapArgument(arguments[0]) : UNKNOWN;
+
+    switch (arg) {
+        case PATHS:
+        case PATHS_TO_FILE:
+        case INFO:
+        case INFO_TO_FILE:
+        case JSON:
+        case JSON_TO_FILE:
+            report = arg;
+            return true;
+        default:
+            std::cerr << "\033[31m--stream writes one of -p, -ps, -i, -is, -j or -js, and nothing else\033[0m" << std::endl;
+            return false;
+    }
+}
+
+/******************************************************************************
+ * open: Opens the output file, if the report goes to one, and starts the
+ *       writer thread.
+ *
+ * @param fileName: The file to write to
+ * @param directories: The directories being scanned, the records are built from them
+ * @param directIO: Whether to write the file without going through the page cache
+ * @return true if the output could be opened
+ ******************************************************************************/
+bool ScanStream::open(const string &fileName, const DirectorySource &directories, bool directIO) {
+    source = &directories;
+
+    opened = writesToConsole() ? sink.openConsole() : sink.openFile(fileName, directIO);
+    if (!opened) {
+        std::cerr << "\033[31mError opening file for writing\033[0m" << std::endl;
+    }
+    return opened;
+}
+
+/******************************************************************************
+ * needsFiles:  Checks if the scan has to keep the files' rows while it reads
+ *              a directory. The path list never does, the other records name
+ *              the most common extension, which is worked out before the rows
+ *              are dropped.
+ ******************************************************************************/
+bool ScanStream::needsFiles() const {
+    return report != PATHS && report != PATHS_TO_FILE;
+}
+
+/******************************************************************************
+ * writesToConsole: Checks if the records go to the console.
+ ******************************************************************************/
+bool ScanStream::writesToConsole() const {
+    return report == PATHS || report == INFO || report == JSON;
+}
+
+/******************************************************************************
+ * directoryFinished:   Formats a directory's record into the calling
+ *                      worker's buffer, and hands the buffer over once it is
+ *                      full. Directories finish bottom up, so every record
+ *                      comes after the records of the directories below it.
+ *
+ * @param node: The directory, whose totals are final
+ ******************************************************************************/
+void ScanStream::directoryFinished(uint32_t node) {
+    string &text = bufferForThisThread().text;
+
+    switch (report) {
+        case INFO:
+        case INFO_TO_FILE:
+            ReportGenerator::appendInfo(*source, node, text);
+            break;
+        case JSON:
+        case JSON_TO_FILE:
+            ReportGenerator::appendJson(*source, node, text);
+            break;
+        default:
+            source->appendPath(node, text);
+            text += '\n';
+            break;
+    }
+    records.fetch_add(1, std::memory_order_relaxed);
+
+    if (text.size() >= BATCH_SIZE) {
+        submit(text);
+    }
+}
+
+/******************************************************************************
+ * close:   Hands over what the workers still hold and waits for the sink to
+ *          write it all.
+ *
+ * note:    The workers are done by now, waiting for the pool to run out of
+ *          tasks already ordered their last writes before this.
+ *
+ * @return true if everything was written
+ ******************************************************************************/
+bool ScanStream::close() {
+    std::vector<std::unique_ptr<Buffer>> remaining;
+    {
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        remaining.swap(buffers);
+    }
+    for (auto &buffer : remaining) {
+        if (!buffer->text.empty()) {
+            submit(buffer->text);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    opened = false;
+    return sink.close();
+}
+
+/******************************************************************************
+ * getRecordCount: Returns the number of records written.
+ ******************************************************************************/
+uint64_t ScanStream::getRecordCount() const {
+    return records.load(std::memory_order_relaxed);
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * bufferForThisThread: Returns the calling thread's buffer. Each thread adds
+ *                      its buffer under the lock once and remembers it, so
+ *                      formatting a record touches nothing shared.
+ ******************************************************************************/
+ScanStream::Buffer& ScanStream::bufferForThisThread() {
+    thread_local uint64_t cachedId = 0;
+    thread_local Buffer *cached = nullptr;
+
+    if (cachedId != id) {
+        std::lock_guard<std::mutex> lock(sinkMutex);
+        buffers.emplace_back(new Buffer());
+        cached = buffers.back().get();
+        cached->text.reserve(BATCH_SIZE);
+        cachedId = id;
+    }
+    return *cached;
+}
+
+/******************************************************************************
+ * submit:  Copies a batch into the sink and empties it, keeping its memory
+ *          for the next one. While every one of the sink's buffers is
+ *          waiting to be written the worker waits, which holds the scan back
+ *          to the speed of the output instead of letting memory grow.
+ *
+ * @param batch: Whole records
+ ******************************************************************************/
+void ScanStream::submit(string &batch) {
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    sink.write(batch);
+    batch.clear();
+}
@@ -0,0 +1,575 @@
+/******************************************************************************
+ * File: Snapshot.cpp
+ * Description: Saves the result of a scan to a compact binary file and maps
+ *              it back in, so reports can be generated from it in place
+ *              without scanning the filesystem again.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "Snapshot.h"                       // header file for class definition
+#include "FileTable.h"                      // for the files of each directory
+#include <iostream>                         // for printing to console
+#include <fstream>                          // for writing the snapshot
+#include <algorithm>                        // for std::sort
+#include <cstdio>                           // For rename()
+#include <cstring>                          // For memcmp(), memcpy() and strerror()
+#include <cerrno>                           // For errno
+#include <fcntl.h>                          // For open()
+#include <unistd.h>                         // For close()
+#include <sys/mman.h>                       // For mapping the snapshot
+#include <sys/stat.h>                       // For the size of the snapshot
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::cerr;
+using std::endl;
+
+constexpr char Snapshot::SNAPSHOT_MAGIC[8];
+
+static_assert(sizeof(SnapshotHeader) == 80, "the snapshot header layout changed");
+static_assert(sizeof(SnapshotDirectory) == 152, "the snapshot directory layout changed");
+static_assert(sizeof(SnapshotFile) == 40, "the snapshot file layout changed");
+
+// Rounds a section offset up so the records after it are aligned
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+// Checks that count items of itemSize bytes starting at offset end by limit, without overflowing
+static bool fitsBefore(uint64_t offset, uint64_t count, uint64_t itemSize, uint64_t limit) {
+    return offset <= limit && count <= (limit - offset) / itemSize;
+}
+
+//
+//  Constructors and Destructors
+//
+
+Snapshot::Snapshot()
+    : mapping(nullptr), mappingSize(0), header(nullptr), directories(nullptr), files(nullptr), strings(nullptr) {}
+
+Snapshot::~Snapshot() {
+    if (mapping != nullptr) {
+        munmap(const_cast<void*>(mapping), mappingSize);
+    }
+}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * save: Writes every directory that was read below root to a snapshot file.
+ *       The tree is laid out depth first with each directory's children and
+ *       files sorted by name. The file is written next to its final name and
+ *       renamed over it, so a crash never leaves half a snapshot behind.
+ *
+ * @param fileName: The file to write
+ * @param registry: The directories that were read
+ * @param arena: The tree of directory names
+ * @param root: The arena node of the root directory
+ * @return true if the snapshot was written
+ ******************************************************************************/
+bool Snapshot::save(const string &fileName, const DirectoryRegistry &registry, const PathArena &arena, uint32_t root) {
+    vector<SnapshotDirectory> dirRecords;
+    vector<SnapshotFile> fileRecords;
+    string stringPool;
+
+    auto addString = [&stringPool](string_view text) {
+        uint64_t offset = stringPool.size();
+        stringPool.append(text.data(), text.size());
+        stringPool.push_back('\0');
+        return offset;
+    };
+
+    if (!registry.contains(root)) {
+        cerr << "\033[31mError: Root directory was not read, nothing to save\033[0m" << endl;
+        return false;
+    }
+
+    // Walk the tree depth first with an explicit stack so deep trees can't overflow the call stack.
+    // A directory is visited twice: once to write its record and once, after its subtree, to close it.
+    struct Visit {
+        uint32_t node;          // The arena node
+        uint32_t parent;        // The index of the parent's record
+        bool closing;           // Whether the subtree below the record is done
+        uint32_t record;        // The index of the record, when closing
+    };
+    vector<Visit> stack = {{root, PathArena::NO_PARENT, false, 0}};
+    vector<uint32_t> children;
+    vector<size_t> fileOrder;
+
+    while (!stack.empty()) {
+        Visit visit = stack.back();
+        stack.pop_back();
+
+        if (visit.closing) {
+            dirRecords[visit.record].subtreeEnd = static_cast<uint32_t>(dirRecords.size());
+            continue;
+        }
+
+        const DirectoryReader &dir = registry.get(visit.node);
+        uint32_t index = static_cast<uint32_t>(dirRecords.size());
+
+        SnapshotDirectory record = {};
+        // The root keeps its whole path, everything else just its name
+        string rootPath = (visit.node == root) ? arena.getPath(root) : string();
+        string_view name = (visit.node == root) ? string_view(rootPath) : arena.getName(visit.node);
+        record.nameOffset = addString(name);
+        record.nameLength = static_cast<uint32_t>(name.size());
+        record.parent = visit.parent;
+        record.foundDirectories = static_cast<uint32_t>(dir.getDirectories().size());
+        record.totalSize = dir.getTotalSize();
+        record.fileTotalSize = dir.getFileTotalSize();
+        record.subDirTotalSize = dir.getTotalSize() - dir.getFileTotalSize();
+        record.subtreeFileCount = dir.getSubtreeFileCount();
+        record.subtreeDirCount = dir.getSubtreeDirCount();
+        record.allocatedSize = dir.getAllocatedSize();
+        record.fileAllocatedSize = dir.getFileAllocatedSize();
+
+        const DirectoryStamp &stamp = dir.getStamp();
+        record.dev = stamp.dev;
+        record.ino = stamp.ino;
+        record.mtimeSec = stamp.mtimeSec;
+        record.mtimeNsec = stamp.mtimeNsec;
+        record.ctimeSec = stamp.ctimeSec;
+        record.ctimeNsec = stamp.ctimeNsec;
+
+        string_view topExtension = dir.getTopFileExtension();
+        record.topExtensionOffset = addString(topExtension);
+        record.topExtensionLength = static_cast<uint32_t>(topExtension.size());
+
+        // The files, sorted by name
+        const FileTable &table = dir.getFiles();
+        fileOrder.resize(table.size());
+        for (size_t i = 0; i < fileOrder.size(); ++i) {
+            fileOrder[i] = i;
+        }
+        std::sort(fileOrder.begin(), fileOrder.end(),
+                  [&table](size_t a, size_t b) { return table.getName(a) < table.getName(b); });
+
+        record.firstFile = fileRecords.size();
+        record.fileCount = static_cast<uint32_t>(table.size());
+        for (size_t i : fileOrder) {
+            SnapshotFile file = {};
+            file.nameOffset = addString(table.getName(i));
+            file.nameLength = static_cast<uint32_t>(table.getName(i).size());
+            file.mode = table.getMode(i);
+            file.size = table.getSize(i);
+            file.allocated = table.getAllocatedSize(i);
+            file.linkedInode = table.getLinkedInode(i);
+            fileRecords.push_back(file);
+        }
+
+        // Only the sub-directories that were read make it into the snapshot, sorted by name
+        children.clear();
+        for (uint32_t child : dir.getDirectories()) {
+            if (registry.contains(child)) {
+                children.push_back(child);
+            }
+        }
+        std::sort(children.begin(), children.end(),
+                  [&arena](uint32_t a, uint32_t b) { return arena.getName(a) < arena.getName(b); });
+        record.childCount = static_cast<uint32_t>(children.size());
+
+        dirRecords.push_back(record);
+
+        // Close this record once all of its children are done, and visit them in order
+        stack.push_back({visit.node, visit.parent, true, index});
+        for (auto child = children.rbegin(); child != children.rend(); ++child) {
+            stack.push_back({*child, index, false, 0});
+        }
+    }
+
+    // Lay out the sections
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.directoryCount = dirRecords.size();
+    header.directoriesOffset = alignOffset(sizeof(SnapshotHeader));
+    header.fileCount = fileRecords.size();
+    header.filesOffset = alignOffset(header.directoriesOffset + dirRecords.size() * sizeof(SnapshotDirectory));
+    header.stringsSize = stringPool.size();
+    header.stringsOffset = alignOffset(header.filesOffset + fileRecords.size() * sizeof(SnapshotFile));
+    header.fileSize = header.stringsOffset + header.stringsSize;
+
+    // Write everything to a temporary file first
+    string tempName = fileName + ".tmp";
+    std::ofstream out(tempName, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        cerr << "\033[31mError opening snapshot for writing: " << tempName << "\033[0m" << endl;
+        return false;
+    }
+
+    auto writeAt = [&out](uint64_t offset, const void *data, size_t size) {
+        static const char padding[8] = {};
+        uint64_t position = static_cast<uint64_t>(out.tellp());
+        out.write(padding, offset - position);
+        out.write(static_cast<const char*>(data), size);
+    };
+    writeAt(0, &header, sizeof(header));
+    writeAt(header.directoriesOffset, dirRecords.data(), dirRecords.size() * sizeof(SnapshotDirectory));
+    writeAt(header.filesOffset, fileRecords.data(), fileRecords.size() * sizeof(SnapshotFile));
+    writeAt(header.stringsOffset, stringPool.data(), stringPool.size());
+    out.close();
+
+    if (!out) {
+        cerr << "\033[31mError writing snapshot: " << tempName << "\033[0m" << endl;
+        std::remove(tempName.c_str());
+        return false;
+    }
+
+    if (std::rename(tempName.c_str(), fileName.c_str()) != 0) {
+        cerr << "\033[31mError saving snapshot: " << fileName << ". Error: " << strerror(errno) << "\033[0m" << endl;
+        std::remove(tempName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/******************************************************************************
+ * open: Maps a snapshot file in read-only and checks that it is one this
+ *       version understands, that every section lies inside the file and
+ *       that every record points inside its sections. Nothing is copied,
+ *       every query reads the mapping directly.
+ *
+ * @param fileName: The snapshot to open
+ * @return true if the snapshot is ready to use
+ ******************************************************************************/
+bool Snapshot::open(const string &fileName) {
+    int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        cerr << "\033[31mError opening snapshot: " << fileName << ". Error: " << strerror(errno) << "\033[0m" << endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(SnapshotHeader)) {
+        cerr << "\033[31mError: " << fileName << " is not a snapshot\033[0m" << endl;
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping keeps the file alive
+    if (map == MAP_FAILED) {
+        cerr << "\033[31mError mapping snapshot: " << fileName << ". Error: " << strerror(errno) << "\033[0m" << endl;
+        return false;
+    }
+
+    mapping = map;
+    mappingSize = info.st_size;
+    header = static_cast<const SnapshotHeader*>(map);
+
+    // Make sure this really is a snapshot we can read
+    const char *problem = nullptr;
+    if (std::memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        problem = "is not a snapshot";
+    } else if (header->byteOrder != SNAPSHOT_BYTE_ORDER) {
+        problem = "was written on a machine with a different byte order";
+    } else if (header->version != SNAPSHOT_VERSION) {
+        problem = "was written by a different version of LFSA";
+    } else if (header->headerSize != sizeof(SnapshotHeader) || header->fileSize != mappingSize) {
+        problem = "is truncated or corrupt";
+    } else if (header->directoryCount == 0 || header->directoryCount > PathArena::NO_PARENT
+               || header->directoriesOffset % 8 != 0 || header->filesOffset % 8 != 0
+               || header->directoriesOffset < sizeof(SnapshotHeader)
+               || !fitsBefore(header->directoriesOffset, header->directoryCount, sizeof(SnapshotDirectory),
+                              header->filesOffset)
+               || !fitsBefore(header->filesOffset, header->fileCount, sizeof(SnapshotFile), header->stringsOffset)
+               || !fitsBefore(header->stringsOffset, header->stringsSize, 1, mappingSize)) {
+        problem = "is truncated or corrupt";
+    } else {
+        const char *base = static_cast<const char*>(map);
+        directories = reinterpret_cast<const SnapshotDirectory*>(base + header->directoriesOffset);
+        files = reinterpret_cast<const SnapshotFile*>(base + header->filesOffset);
+        strings = base + header->stringsOffset;
+        if (!checkRecords()) {
+            problem = "is truncated or corrupt";
+        }
+    }
+
+    if (problem != nullptr) {
+        cerr << "\033[31mError: " << fileName << " " << problem << "\033[0m" << endl;
+        munmap(map, mappingSize);
+        mapping = nullptr;
+        header = nullptr;
+        directories = nullptr;
+        files = nullptr;
+        strings = nullptr;
+        return false;
+    }
+
+    // Tell the kernel we are about to read the records front to back
+    madvise(map, mappingSize, MADV_WILLNEED);
+    return true;
+}
+
+//
+//  DirectorySource
+//
+
+/******************************************************************************
+ * contains: Checks if a directory index is in the snapshot.
+ ******************************************************************************/
+bool Snapshot::contains(uint32_t dir) const {
+    return header != nullptr && dir < header->directoryCount;
+}
+
+/******************************************************************************
+ * getPath: Rebuilds the full path of a directory from its ancestors' names.
+ ******************************************************************************/
+string Snapshot::getPath(uint32_t dir) const {
+    string path;
+    appendPath(dir, path);
+    return path;
+}
+
+/******************************************************************************
+ * getName: Returns the name of a directory, the full path for the root.
+ ******************************************************************************/
+string_view Snapshot::getName(uint32_t dir) const {
+    return getString(directories[dir].nameOffset, directories[dir].nameLength);
+}
+
+/******************************************************************************
+ * appendPath:  Appends the full path of a directory. Like the arena, the
+ *              length is worked out walking up first, then the names are
+ *              copied in from the end on a second walk.
+ ******************************************************************************/
+void Snapshot::appendPath(uint32_t dir, string &out) const {
+    size_t length = 0;
+    uint32_t root = dir;
+    for (uint32_t current = dir; current != PathArena::NO_PARENT; current = directories[current].parent) {
+        length += directories[current].nameLength + 1;
+        root = current;
+    }
+    string_view rootName = getName(root);
+    length -= 1;
+    if (dir != root && (rootName.empty() || rootName.back() == '/')) {
+        length -= 1;
+    }
+
+    size_t start = out.size();
+    out.resize(start + length);
+    char *end = &out[0] + out.size();
+    for (uint32_t current = dir; current != root; current = directories[current].parent) {
+        string_view name = getName(current);
+        end -= name.size();
+        memcpy(end, name.data(), name.size());
+        if (end != &out[start] + rootName.size()) {
+            *--end = '/';
+        }
+    }
+    memcpy(&out[start], rootName.data(), rootName.size());
+}
+
+/******************************************************************************
+ * getDirectories: Returns the sub-directories of a directory. The first one
+ *                 comes right after it and each of the others right after
+ *                 the subtree of the one before, so they are read straight
+ *                 from the mapped records.
+ ******************************************************************************/
+DirectoryList Snapshot::getDirectories(uint32_t dir) const {
+    return DirectoryList(dir + 1, directories[dir].childCount,
+                         reinterpret_cast<const char*>(&directories[0].subtreeEnd), sizeof(SnapshotDirectory));
+}
+
+/******************************************************************************
+ * getDirectoryCount: Returns the number of sub-directories that were found.
+ ******************************************************************************/
+size_t Snapshot::getDirectoryCount(uint32_t dir) const {
+    return directories[dir].foundDirectories;
+}
+
+/******************************************************************************
+ * getFileCount: Returns the number of files in a directory.
+ ******************************************************************************/
+size_t Snapshot::getFileCount(uint32_t dir) const {
+    return directories[dir].fileCount;
+}
+
+/******************************************************************************
+ * getFileName: Returns the name of one of a directory's files.
+ ******************************************************************************/
+string_view Snapshot::getFileName(uint32_t dir, size_t file) const {
+    const SnapshotFile &record = files[directories[dir].firstFile + file];
+    return getString(record.nameOffset, record.nameLength);
+}
+
+/******************************************************************************
+ * getFileSize: Returns the size of one of a directory's files.
+ ******************************************************************************/
+uint64_t Snapshot::getFileSize(uint32_t dir, size_t file) const {
+    return files[directories[dir].firstFile + file].size;
+}
+
+/******************************************************************************
+ * getFileAllocatedSize: Returns the bytes allocated to one of a directory's
+ *                       files.
+ ******************************************************************************/
+uint64_t Snapshot::getFileAllocatedSize(uint32_t dir, size_t file) const {
+    return files[directories[dir].firstFile + file].allocated;
+}
+
+/******************************************************************************
+ * getTotalSize: Returns the total size of a directory's subtree.
+ ******************************************************************************/
+uint64_t Snapshot::getTotalSize(uint32_t dir) const {
+    return directories[dir].totalSize;
+}
+
+/******************************************************************************
+ * getAllocatedSize: Returns the bytes allocated to a directory's subtree.
+ ******************************************************************************/
+uint64_t Snapshot::getAllocatedSize(uint32_t dir) const {
+    return directories[dir].allocatedSize;
+}
+
+/******************************************************************************
+ * getSubtreeDirCount: Returns the number of directories below a directory.
+ ******************************************************************************/
+uint64_t Snapshot::getSubtreeDirCount(uint32_t dir) const {
+    return directories[dir].subtreeDirCount;
+}
+
+/******************************************************************************
+ * getAverageDirectorySize: Returns the average size of a directory's
+ *                          sub-directories, the same way DirectoryReader does.
+ ******************************************************************************/
+double Snapshot::getAverageDirectorySize(uint32_t dir) const {
+    const SnapshotDirectory &record = directories[dir];
+    if (record.foundDirectories == 0 || record.totalSize == 0) {
+        return 0;
+    }
+    return static_cast<double>(record.subDirTotalSize) / record.foundDirectories;
+}
+
+/******************************************************************************
+ * getAverageFileSize: Returns the average size of a directory's files.
+ ******************************************************************************/
+double Snapshot::getAverageFileSize(uint32_t dir) const {
+    const SnapshotDirectory &record = directories[dir];
+    if (record.fileCount == 0 || record.fileTotalSize == 0) {
+        return 0;
+    }
+    return static_cast<double>(record.fileTotalSize) / record.fileCount;
+}
+
+/******************************************************************************
+ * getTopFileExtension: Returns the most common extension in a directory.
+ ******************************************************************************/
+string_view Snapshot::getTopFileExtension(uint32_t dir) const {
+    return getString(directories[dir].topExtensionOffset, directories[dir].topExtensionLength);
+}
+
+//
+//  Snapshot specific getters
+//
+
+/******************************************************************************
+ * getStamp: Returns the device, inode and times a directory had when it was
+ *           scanned. They are all 0 if the scan didn't record them.
+ ******************************************************************************/
+DirectoryStamp Snapshot::getStamp(uint32_t dir) const {
+    const SnapshotDirectory &record = directories[dir];
+
+    DirectoryStamp stamp;
+    stamp.dev = record.dev;
+    stamp.ino = record.ino;
+    stamp.mtimeSec = record.mtimeSec;
+    stamp.mtimeNsec = record.mtimeNsec;
+    stamp.ctimeSec = record.ctimeSec;
+    stamp.ctimeNsec = record.ctimeNsec;
+    return stamp;
+}
+
+/******************************************************************************
+ * getFileRecord: Returns the record of one of a directory's files.
+ ******************************************************************************/
+const SnapshotFile& Snapshot::getFileRecord(uint32_t dir, size_t file) const {
+    return files[directories[dir].firstFile + file];
+}
+
+/******************************************************************************
+ * getSubtreeEnd: Returns the index one past the last directory below a
+ *                directory. Its subtree is every index from dir up to there.
+ ******************************************************************************/
+uint32_t Snapshot::getSubtreeEnd(uint32_t dir) const {
+    return directories[dir].subtreeEnd;
+}
+
+/******************************************************************************
+ * adviseSequential: Replaces the read-ahead hint given when the snapshot was
+ *                   opened. A single pass in order only needs the pages just
+ *                   ahead, and the ones behind can be reclaimed, so a huge
+ *                   snapshot doesn't have to fit in memory.
+ ******************************************************************************/
+void Snapshot::adviseSequential() const {
+    if (mapping != nullptr) {
+        madvise(const_cast<void*>(mapping), mappingSize, MADV_SEQUENTIAL);
+    }
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * checkRecords:    Checks every record once, so the getters can trust them.
+ *                  Each directory's parent comes before it, its subtree ends
+ *                  after it and inside its parent's, its sub-directories
+ *                  follow one another up to the end of its subtree, and its
+ *                  files and names lie inside their sections. Without this a
+ *                  damaged file could send a walk up a cycle of parents or
+ *                  along siblings that never reach the end of the subtree.
+ *
+ * @return true if every record is usable
+ ******************************************************************************/
+bool Snapshot::checkRecords() const {
+    const uint64_t count = header->directoryCount;
+    auto nameFits = [this](uint64_t offset, uint32_t length) {
+        return fitsBefore(offset, length, 1, header->stringsSize);
+    };
+
+    for (uint64_t dir = 0; dir < count; ++dir) {
+        const SnapshotDirectory &record = directories[dir];
+        uint64_t parentEnd = (dir == ROOT) ? count : directories[record.parent].subtreeEnd;
+        if ((dir == ROOT) != (record.parent == PathArena::NO_PARENT) || (dir != ROOT && record.parent >= dir)
+            || record.subtreeEnd <= dir || record.subtreeEnd > parentEnd
+            || !fitsBefore(record.firstFile, record.fileCount, 1, header->fileCount)
+            || !nameFits(record.nameOffset, record.nameLength)
+            || !nameFits(record.topExtensionOffset, record.topExtensionLength)) {
+            return false;
+        }
+
+        // The sub-directories are chained through the subtree ends, which must land exactly on this one's
+        uint64_t child = dir + 1;
+        for (uint32_t i = 0; i < record.childCount; ++i) {
+            if (child >= record.subtreeEnd || directories[child].parent != dir) {
+                return false;
+            }
+            child = directories[child].subtreeEnd;
+        }
+        if (child != record.subtreeEnd) {
+            return false;
+        }
+    }
+
+    for (uint64_t file = 0; file < header->fileCount; ++file) {
+        if (!nameFits(files[file].nameOffset, files[file].nameLength)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/******************************************************************************
+ * getString: Returns a string from the pool.
+ ******************************************************************************/
+string_view Snapshot::getString(uint64_t offset, uint32_t length) const {
+    return string_view(strings + offset, length);
+}
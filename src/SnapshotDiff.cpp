@@ -0,0 +1,300 @@
+/******************************************************************************
+ * File: SnapshotDiff.cpp
+ * Description: Compares two snapshots of the same tree and ranks what was
+ *              added, removed or changed size by how many bytes it moved.
+ *              Both snapshots are walked side by side in a single pass, and
+ *              only the largest changes are kept, so memory stays the same
+ *              however big the trees are.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "SnapshotDiff.h"                   // header file for class definition
+#include <algorithm>                        // for the heap functions and std::sort
+#include <iomanip>                          // for std::setw
+#include <string_view>                      // for std::string_view
+
+using std::string;
+using std::string_view;
+using std::vector;
+using std::endl;
+
+const size_t SnapshotDiff::DEFAULT_LIMIT;
+
+// How far a change moved the size, whichever way
+static uint64_t magnitude(const DiffEntry &entry) {
+    return entry.oldSize > entry.newSize ? entry.oldSize - entry.newSize : entry.newSize - entry.oldSize;
+}
+
+// Orders the heaps so the smallest change kept is at the front, ready to be replaced
+static bool largerChange(const DiffEntry &a, const DiffEntry &b) {
+    return magnitude(a) > magnitude(b);
+}
+
+/******************************************************************************
+ * getDelta: Returns the change in bytes, positive if it grew.
+ ******************************************************************************/
+int64_t DiffEntry::getDelta() const {
+    return static_cast<int64_t>(newSize) - static_cast<int64_t>(oldSize);
+}
+
+//
+//  Constructors and Destructors
+//
+
+SnapshotDiff::SnapshotDiff(const Snapshot &oldSnapshot, const Snapshot &newSnapshot, size_t limit)
+    : oldSnapshot(oldSnapshot), newSnapshot(newSnapshot), limit(limit) {}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * compare: Merge-walks the two snapshots. Sub-directories and files are
+ *          sorted by name in both, so two cursors moving forward together
+ *          find everything that is only on one side, like merging two
+ *          sorted lists. Directories that are in both are descended into.
+ *
+ * note:    Directories are stored depth first, so both snapshots are read
+ *          from front to back exactly once. The stack holds one frame per
+ *          level of the tree, with the position reached in each list of
+ *          children, so memory depends on the depth of the tree and not on
+ *          its size or on how many children a directory has.
+ ******************************************************************************/
+void SnapshotDiff::compare() {
+    // Where the walk is in a pair of matching directories
+    struct Frame {
+        uint32_t oldDir;        // The directory in the old snapshot
+        uint32_t newDir;        // The same directory in the new snapshot
+        uint32_t oldChild;      // The next sub-directory in the old snapshot
+        uint32_t newChild;      // The next sub-directory in the new snapshot
+    };
+
+    oldSnapshot.adviseSequential();
+    newSnapshot.adviseSequential();
+
+    compareDirectory(Snapshot::ROOT, Snapshot::ROOT);
+    vector<Frame> stack = {{Snapshot::ROOT, Snapshot::ROOT, Snapshot::ROOT + 1, Snapshot::ROOT + 1}};
+
+    while (!stack.empty()) {
+        Frame &frame = stack.back();
+        bool oldLeft = frame.oldChild < oldSnapshot.getSubtreeEnd(frame.oldDir);
+        bool newLeft = frame.newChild < newSnapshot.getSubtreeEnd(frame.newDir);
+
+        if (!oldLeft && !newLeft) {
+            stack.pop_back();
+            continue;
+        }
+
+        int order;
+        if (!oldLeft) {
+            order = 1;
+        } else if (!newLeft) {
+            order = -1;
+        } else {
+            order = oldSnapshot.getName(frame.oldChild).compare(newSnapshot.getName(frame.newChild));
+        }
+
+        if (order < 0) {
+            compareSubtree(oldSnapshot, frame.oldChild, DiffEntry::REMOVED);
+            frame.oldChild = oldSnapshot.getSubtreeEnd(frame.oldChild);
+        } else if (order > 0) {
+            compareSubtree(newSnapshot, frame.newChild, DiffEntry::ADDED);
+            frame.newChild = newSnapshot.getSubtreeEnd(frame.newChild);
+        } else {
+            uint32_t oldDir = frame.oldChild;
+            uint32_t newDir = frame.newChild;
+            frame.oldChild = oldSnapshot.getSubtreeEnd(oldDir);
+            frame.newChild = newSnapshot.getSubtreeEnd(newDir);
+
+            compareDirectory(oldDir, newDir);
+            stack.push_back({oldDir, newDir, oldDir + 1, newDir + 1});     // frame is invalid from here on
+        }
+    }
+}
+
+/******************************************************************************
+ * print: Prints the overall change, how many directories and files were
+ *        added, removed or changed size, and the largest changes of each.
+ *
+ * @param outStream: Where to print
+ ******************************************************************************/
+void SnapshotDiff::print(std::ostream &outStream) const {
+    uint64_t oldTotal = oldSnapshot.getTotalSize(Snapshot::ROOT);
+    uint64_t newTotal = newSnapshot.getTotalSize(Snapshot::ROOT);
+    int64_t delta = static_cast<int64_t>(newTotal) - static_cast<int64_t>(oldTotal);
+
+    outStream << "Old: " << oldSnapshot.getPath(Snapshot::ROOT) << endl
+              << "New: " << newSnapshot.getPath(Snapshot::ROOT) << endl
+              << "Total size: " << oldTotal << " -> " << newTotal << " (" << (delta >= 0 ? "+" : "") << delta << ")" << endl
+              << "Directories: " << directoryCounts.added << " added, " << directoryCounts.removed << " removed, "
+              << directoryCounts.resized << " changed size" << endl
+              << "Files: " << fileCounts.added << " added, " << fileCounts.removed << " removed, "
+              << fileCounts.resized << " changed size" << endl;
+
+    printEntries(outStream, "Largest directory changes:", topDirectories);
+    printEntries(outStream, "Largest file changes:", topFiles);
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * compareDirectory:    Compares a directory that is in both snapshots: its
+ *                      total size, then its files, merged by name.
+ *
+ * @param oldDir: The directory in the old snapshot
+ * @param newDir: The directory in the new snapshot
+ ******************************************************************************/
+void SnapshotDiff::compareDirectory(uint32_t oldDir, uint32_t newDir) {
+    uint64_t oldTotal = oldSnapshot.getTotalSize(oldDir);
+    uint64_t newTotal = newSnapshot.getTotalSize(newDir);
+    if (oldTotal != newTotal) {
+        directoryCounts.resized++;
+        record(topDirectories, DiffEntry::RESIZED, oldTotal, newTotal, [&]() { return newSnapshot.getPath(newDir); });
+    }
+
+    size_t oldCount = oldSnapshot.getFileCount(oldDir);
+    size_t newCount = newSnapshot.getFileCount(newDir);
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < oldCount || j < newCount) {
+        int order;
+        if (i >= oldCount) {
+            order = 1;
+        } else if (j >= newCount) {
+            order = -1;
+        } else {
+            order = oldSnapshot.getFileName(oldDir, i).compare(newSnapshot.getFileName(newDir, j));
+        }
+
+        if (order < 0) {
+            fileCounts.removed++;
+            record(topFiles, DiffEntry::REMOVED, oldSnapshot.getFileRecord(oldDir, i).size, 0,
+                   [&]() { return filePath(oldSnapshot, oldDir, i); });
+            i++;
+        } else if (order > 0) {
+            fileCounts.added++;
+            record(topFiles, DiffEntry::ADDED, 0, newSnapshot.getFileRecord(newDir, j).size,
+                   [&]() { return filePath(newSnapshot, newDir, j); });
+            j++;
+        } else {
+            uint64_t oldSize = oldSnapshot.getFileRecord(oldDir, i).size;
+            uint64_t newSize = newSnapshot.getFileRecord(newDir, j).size;
+            if (oldSize != newSize) {
+                fileCounts.resized++;
+                record(topFiles, DiffEntry::RESIZED, oldSize, newSize, [&]() { return filePath(newSnapshot, newDir, j); });
+            }
+            i++;
+            j++;
+        }
+    }
+}
+
+/******************************************************************************
+ * compareSubtree:  Records a directory that is only in one snapshot. Only
+ *                  the top of the subtree is listed among the directories,
+ *                  but every directory in it is counted and every file in it
+ *                  is ranked, since a large new file deep inside a new
+ *                  directory is exactly what we're looking for.
+ *
+ * @param snapshot: The snapshot the subtree is in
+ * @param dir: The top of the subtree
+ * @param kind: ADDED if it is only in the new snapshot, REMOVED if only in the old one
+ ******************************************************************************/
+void SnapshotDiff::compareSubtree(const Snapshot &snapshot, uint32_t dir, DiffEntry::Kind kind) {
+    bool added = (kind == DiffEntry::ADDED);
+    uint64_t total = snapshot.getTotalSize(dir);
+    uint32_t end = snapshot.getSubtreeEnd(dir);
+
+    (added ? directoryCounts.added : directoryCounts.removed) += end - dir;
+    record(topDirectories, kind, added ? 0 : total, added ? total : 0, [&]() { return snapshot.getPath(dir); });
+
+    // The subtree is every directory up to its end, in order
+    for (uint32_t current = dir; current < end; ++current) {
+        size_t count = snapshot.getFileCount(current);
+        (added ? fileCounts.added : fileCounts.removed) += count;
+
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t size = snapshot.getFileRecord(current, i).size;
+            record(topFiles, kind, added ? 0 : size, added ? size : 0,
+                   [&]() { return filePath(snapshot, current, i); });
+        }
+    }
+}
+
+/******************************************************************************
+ * record:  Keeps a change if it moved more bytes than the smallest one kept
+ *          so far. The kept changes are a min-heap, so that check is one
+ *          comparison and building the path is skipped for everything else.
+ *
+ * @param top: The heap to add to
+ * @param kind: What happened
+ * @param oldSize: The size before
+ * @param newSize: The size after
+ * @param buildPath: Returns the full path, only called if the change is kept
+ ******************************************************************************/
+template <typename PathBuilder>
+void SnapshotDiff::record(vector<DiffEntry> &top, DiffEntry::Kind kind, uint64_t oldSize, uint64_t newSize,
+                          PathBuilder buildPath) {
+    if (limit == 0) {
+        return;
+    }
+
+    DiffEntry entry = {kind, oldSize, newSize, string()};
+    if (top.size() == limit && magnitude(entry) <= magnitude(top.front())) {
+        return;
+    }
+    entry.path = buildPath();
+
+    if (top.size() == limit) {
+        std::pop_heap(top.begin(), top.end(), largerChange);
+        top.back() = std::move(entry);
+    } else {
+        top.push_back(std::move(entry));
+    }
+    std::push_heap(top.begin(), top.end(), largerChange);
+}
+
+/******************************************************************************
+ * printEntries: Prints a list of changes, the largest first.
+ *
+ * @param outStream: Where to print
+ * @param title: The heading of the list
+ * @param entries: The changes, in heap order
+ ******************************************************************************/
+void SnapshotDiff::printEntries(std::ostream &outStream, const string &title, vector<DiffEntry> entries) {
+    std::sort(entries.begin(), entries.end(), [](const DiffEntry &a, const DiffEntry &b) {
+        return magnitude(a) != magnitude(b) ? magnitude(a) > magnitude(b) : a.path < b.path;
+    });
+
+    outStream << endl << title << endl;
+    if (entries.empty()) {
+        outStream << "    None" << endl;
+    }
+
+    for (const DiffEntry &entry : entries) {
+        int64_t delta = entry.getDelta();
+        const char *kind = (entry.kind == DiffEntry::ADDED) ? "added" : (entry.kind == DiffEntry::REMOVED) ? "removed" : "resized";
+        outStream << std::setw(16) << ((delta >= 0 ? "+" : "") + std::to_string(delta)) << "  "
+                  << std::left << std::setw(8) << kind << std::right << entry.path;
+        if (entry.kind == DiffEntry::RESIZED) {
+            outStream << " (" << entry.oldSize << " -> " << entry.newSize << ")";
+        }
+        outStream << endl;
+    }
+}
+
+/******************************************************************************
+ * filePath: Builds the full path of one of a directory's files.
+ ******************************************************************************/
+string SnapshotDiff::filePath(const Snapshot &snapshot, uint32_t dir, size_t file) {
+    string path = snapshot.getPath(dir);
+    if (path.empty() || path.back() != '/') {
+        path += '/';
+    }
+    string_view name = snapshot.getFileName(dir, file);
+    path.append(name.data(), name.size());
+    return path;
+}
@@ -1,43 +1,51 @@
 /******************************************************************************
  * File: ThreadPool.cpp
- * Description: A basic thread pool implementation.
+ * Description: A work-stealing thread pool. Every worker has its own deque of
+ *              tasks, works on its newest task first and steals the oldest
+ *              task from another worker when it runs out.
  * Author: Robert Tetreault
- * Note: This code is slightly borrowed from code I found on StackOverflow.
  ******************************************************************************/
 
 #include "ThreadPool.h"
 #include <iostream>
 #include <vector>
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <condition_variable>
-#include <functional>
+#include <algorithm>
+
+// The pool and index of the worker running on this thread, if any
+thread_local ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorker = 0;
 
 //
 //  Constructors and Destructors
 //
 
-ThreadPool::ThreadPool() : ThreadPool(std::thread::hardware_concurrency()) { 
+ThreadPool::ThreadPool() : ThreadPool(std::thread::hardware_concurrency()) {
     // if no argument is passed, use the number of hardware threads
 }
 
-ThreadPool::ThreadPool(size_t numThreads) : activeJobs(0), numThreads(numThreads), stop(false)  {
+ThreadPool::ThreadPool(size_t numThreads)
+    : activeJobs(0), queues(new WorkerQueue[numThreads > 0 ? numThreads : 1]), pendingTasks(0),
+      idleWorkers(0), nextVictim(0), numThreads(numThreads > 0 ? numThreads : 1), activeThreads(this->numThreads),
+      stop(false) {
     // Create the worker threads and add them to the list
-    for (size_t i = 0; i < numThreads; ++i) {
-        workers.emplace_back(workerThread, this);
+    for (size_t i = 0; i < this->numThreads; ++i) {
+        workers.emplace_back(workerThread, this, i);
     }
 }
 
 ThreadPool::~ThreadPool() {
-    // Lock the queue and set the stop flag to true
+    // Lock the sleep mutex and set the stop flag to true
     {
-        std::unique_lock<std::mutex> lock(queueMutex);
+        std::unique_lock<std::mutex> lock(sleepMutex);
         stop = true;
     }
 
     // Notify all threads that stop is true
     condition.notify_all();
+    parked.notify_all();
 
     // Join all threads
     for (std::thread &worker : workers) {
@@ -50,65 +58,248 @@ ThreadPool::~ThreadPool() {
 //
 
 /******************************************************************************
- * enqueue: Adds a task to the queue and notifies a waiting worker thread.
+ * waitForCompletion: Waits until all tasks in the pool have been completed.
+ ******************************************************************************/
+void ThreadPool::waitForCompletion() {
+    std::unique_lock<std::mutex> lock(doneMutex);
+    everythingDone.wait(lock, [this]() { return activeJobs == 0; });
+}
+
+/******************************************************************************
+ * setActiveThreads: Changes how many workers may take tasks. Workers above
+ *                   the limit finish the task they are running and then
+ *                   park, and any tasks left on their deques get stolen by
+ *                   the others. Raising the limit wakes them back up.
  * 
- * @param task: The task to be added to the queue
+ * @param n: The number of workers allowed to take tasks
  ******************************************************************************/
-void ThreadPool::enqueue(std::function<void()> task) {
-    // Lock the queue and add the task
+void ThreadPool::setActiveThreads(size_t n) {
+    n = std::max<size_t>(1, std::min(n, numThreads));
+
+    size_t previous;
     {
-        std::unique_lock<std::mutex> lock(queueMutex);
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        previous = activeThreads.exchange(n);
+    }
 
-        // Wait until there's an available thread
-        tasks.push([&, task]() { 
-            task();         // Execute the task
-            if (--activeJobs == 0) {            // Decrement the number of active jobs and check if it's 0
-                everythingDone.notify_all();    // Notify the main thread that all tasks are complete
-            }
-        });
+    if (n > previous) {
+        parked.notify_all();
+    }
+}
+
+/******************************************************************************
+ * getActiveThreads: Returns the number of workers allowed to take tasks.
+ ******************************************************************************/
+size_t ThreadPool::getActiveThreads() const {
+    return activeThreads.load(std::memory_order_relaxed);
+}
+
+/******************************************************************************
+ * size: Returns the number of threads in the pool, parked or not.
+ ******************************************************************************/
+size_t ThreadPool::size() const {
+    return numThreads;
+}
+
+/******************************************************************************
+ * getPendingTasks: Returns the number of tasks waiting to be picked up.
+ ******************************************************************************/
+size_t ThreadPool::getPendingTasks() const {
+    return pendingTasks.load(std::memory_order_relaxed);
+}
+
+//
+//  Private Methods
+//
 
-        // Increment the number of active jobs while the task is being executed
-        activeJobs++;
+/******************************************************************************
+ * push: Puts a task on a deque and wakes a sleeping worker if there is one.
+ *       A worker pushes onto its own deque so the task stays on a warm core,
+ *       anything else uses the shared injection queue.
+ *
+ * @param task: The task to be added to the pool
+ ******************************************************************************/
+void ThreadPool::push(Task&& task) {
+    // Count the job before it can possibly run
+    activeJobs++;
+
+    WorkerQueue& queue = (currentPool == this) ? queues[currentWorker] : injected;
+    {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        queue.size.store(queue.tasks.size(), std::memory_order_relaxed);
     }
+    pendingTasks++;
 
-    // Notify a waiting thread
-    condition.notify_one();
+    // Only touch the sleep mutex when somebody is actually asleep
+    if (idleWorkers > 0) {
+        { std::unique_lock<std::mutex> lock(sleepMutex); }
+        condition.notify_one();
+    }
 }
 
+/******************************************************************************
+ * popLocal: Takes the newest task from a worker's own deque.
+ *
+ * @param index: The index of the worker
+ * @param task: Where to put the task
+ * @return true if a task was found
+ ******************************************************************************/
+bool ThreadPool::popLocal(size_t index, Task& task) {
+    WorkerQueue& queue = queues[index];
+    if (queue.size.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    queue.size.store(queue.tasks.size(), std::memory_order_relaxed);
+    pendingTasks--;
+    return true;
+}
 
 /******************************************************************************
- * workerThread: The function that each worker thread runs. It waits until
- *               there's a task in the queue, then executes it.
- * 
- * @param pool: A pointer to the thread pool
+ * popInjected: Takes the oldest task pushed from outside the pool.
+ *
+ * @param task: Where to put the task
+ * @return true if a task was found
  ******************************************************************************/
-void ThreadPool::workerThread(ThreadPool *pool) {
-    std::function<void()> task;
-    while (true) {
-        {
-            std::unique_lock<std::mutex> lock(pool->queueMutex);
+bool ThreadPool::popInjected(Task& task) {
+    if (injected.size.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
 
-            // Wait until there's a task in the queue or we are stopping the threadpool
-            pool->condition.wait(lock, [pool] { return pool->stop || !pool->tasks.empty(); });
+    std::unique_lock<std::mutex> lock(injected.mutex);
+    return takeOldest(injected, task);
+}
 
-            // Check if we are stopping the threadpool and the queue is empty
-            if (pool->stop && pool->tasks.empty()) {
-                return;
-            }
+/******************************************************************************
+ * steal: Takes the oldest task from another worker's deque. Every attempt
+ *        starts at a different victim so thieves spread out over the pool.
+ *
+ * @param thief: The index of the worker looking for work
+ * @param task: Where to put the task
+ * @return true if a task was found
+ ******************************************************************************/
+bool ThreadPool::steal(size_t thief, Task& task) {
+    WorkerQueue* busyVictim = nullptr;      // A deque that had tasks but was locked by someone else
 
-            // If we get here, there's a task in the queue
-            task = std::move(pool->tasks.front());      // Get the task
-            pool->tasks.pop();                          // Remove the task from the queue
+    size_t start = nextVictim.fetch_add(1, std::memory_order_relaxed);
+    for (size_t offset = 0; offset < numThreads; ++offset) {
+        size_t index = (start + offset) % numThreads;
+        if (index == thief) {
+            continue;
         }
-        task(); // Execute the task
+        WorkerQueue& victim = queues[index];
+
+        // Skip empty deques without touching their locks
+        if (victim.size.load(std::memory_order_relaxed) == 0) {
+            continue;
+        }
+
+        // Don't wait on a busy deque while there are other places to look
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            busyVictim = &victim;
+            continue;
+        }
+
+        if (takeOldest(victim, task)) {
+            return true;
+        }
+    }
+
+    // Every deque with work was busy, so wait for one instead of spinning back around
+    if (busyVictim != nullptr) {
+        std::unique_lock<std::mutex> lock(busyVictim->mutex);
+        return takeOldest(*busyVictim, task);
     }
+
+    return false;
 }
 
 /******************************************************************************
- * waitForCompletion: Waits until all tasks in the queue have been completed.
+ * takeOldest: Takes the task at the front of a deque. The caller has to hold
+ *             the deque's lock.
+ *
+ * @param queue: The deque to take from
+ * @param task: Where to put the task
+ * @return true if the deque had a task
  ******************************************************************************/
-void ThreadPool::waitForCompletion() {
-    std::unique_lock<std::mutex> lock(queueMutex);
-    everythingDone.wait(lock, [this]() { return activeJobs == 0; });
+bool ThreadPool::takeOldest(WorkerQueue& queue, Task& task) {
+    if (queue.tasks.empty()) {
+        return false;
+    }
+
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    queue.size.store(queue.tasks.size(), std::memory_order_relaxed);
+    pendingTasks--;
+    return true;
 }
 
+/******************************************************************************
+ * finishJob: Marks a task as done and wakes waitForCompletion() if it was the
+ *            last one.
+ ******************************************************************************/
+void ThreadPool::finishJob() {
+    if (--activeJobs == 0) {                            // Decrement the number of active jobs and check if it's 0
+        std::unique_lock<std::mutex> lock(doneMutex);
+        everythingDone.notify_all();                    // Notify the main thread that all tasks are complete
+    }
+}
+
+/******************************************************************************
+ * workerThread: The function that each worker thread runs. It works through
+ *               its own deque, then the injection queue, steals when both
+ *               are empty, and sleeps when there's nothing left anywhere.
+ *               Workers above the active limit park instead.
+ *
+ * @param pool: A pointer to the thread pool
+ * @param index: The index of this worker
+ ******************************************************************************/
+void ThreadPool::workerThread(ThreadPool *pool, size_t index) {
+    currentPool = pool;
+    currentWorker = index;
+
+    Task task;
+    while (true) {
+        // Park while this worker is above the active limit
+        if (index >= pool->activeThreads.load(std::memory_order_relaxed)) {
+            std::unique_lock<std::mutex> lock(pool->sleepMutex);
+
+            // A push may have woken this worker instead of an active one, so pass the wake-up on
+            if (pool->pendingTasks > 0) {
+                pool->condition.notify_one();
+            }
+            pool->parked.wait(lock, [pool, index] { return pool->stop || index < pool->activeThreads; });
+            if (pool->stop && pool->pendingTasks == 0) {
+                return;
+            }
+            continue;
+        }
+
+        if (pool->popLocal(index, task) || pool->popInjected(task) || pool->steal(index, task)) {
+            task();             // Execute the task
+            task = Task();      // Release whatever the task captured before going idle
+            pool->finishJob();
+            continue;
+        }
+
+        // Nothing to do, so sleep until a task is pushed or we are stopping the threadpool
+        std::unique_lock<std::mutex> lock(pool->sleepMutex);
+        pool->idleWorkers++;
+        pool->condition.wait(lock, [pool] { return pool->stop || pool->pendingTasks > 0; });
+        pool->idleWorkers--;
+
+        // Check if we are stopping the threadpool and every deque is empty
+        if (pool->stop && pool->pendingTasks == 0) {
+            return;
+        }
+    }
+}
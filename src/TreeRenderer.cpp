@@ -0,0 +1,342 @@
+/******************************************************************************
+ * File: TreeRenderer.cpp
+ * Description: Prints the -t and -lt trees. Runs of small sub-trees are
+ *              rendered by tasks on a thread pool while large ones are split
+ *              further, and every task's text is written in order, so the
+ *              output is the same as printing the tree on one thread.
+ * Author: Robert Tetreault
+ ******************************************************************************/
+
+#include "TreeRenderer.h"                   // header file for class definition
+#include "DirectorySource.h"                // for the tree being printed
+#include "OutputSink.h"                     // for writing it
+#include "ThreadPool.h"                     // for rendering sub-trees at the same time
+
+using std::string;
+
+const size_t TreeRenderer::SPLIT_SIZE;
+const size_t TreeRenderer::MAX_PENDING;
+const size_t TreeRenderer::FLUSH_SIZE;
+const size_t TreeRenderer::MAX_CHUNKS;
+
+//
+//  Constructors and Destructors
+//
+
+TreeRenderer::TreeRenderer(const DirectorySource &source, ThreadPool *pool)
+    : source(source), pool(pool), sink(nullptr) {}
+
+TreeRenderer::~TreeRenderer() {}
+
+//
+//  Public Methods
+//
+
+/******************************************************************************
+ * render:  Prints a tree. With a pool of more than one thread this thread
+ *          renders the top levels of the large sub-trees and hands the small
+ *          ones below them to the pool, then writes the pieces in the order
+ *          they were handed out while the pool renders the ones after them.
+ *
+ * note:    The scan may have parked some of the pool's workers, so all of
+ *          them take tasks while the tree is rendered.
+ *
+ * @param root: The directory at the top of the tree
+ * @param levels: The number of levels to print, the root being the first
+ * @param out: Where the tree is printed
+ ******************************************************************************/
+void TreeRenderer::render(uint32_t root, size_t levels, OutputSink &out) {
+    sink = &out;
+    string prefix;
+    string text;
+
+    if (pool != nullptr && pool->size() > 1) {
+        size_t active = pool->getActiveThreads();
+        pool->setActiveThreads(pool->size());
+        renderSubtree(root, prefix, true, true, levels, text, PLANNER, nullptr);
+        while (!pending.empty()) {
+            writeOldest();
+        }
+        pool->setActiveThreads(active);
+    } else {
+        renderSubtree(root, prefix, true, true, levels, text, WHOLE, nullptr);
+    }
+
+    out.write(text);
+    sink = nullptr;
+}
+
+//
+//  Private Methods
+//
+
+/******************************************************************************
+ * renderSubtree:   Renders a directory's line, its sub-directories' sub-trees
+ *                  and its files, in the same order and with the same
+ *                  prefixes as printing them recursively. The walk keeps its
+ *                  own stack, so a deep tree can't run out of call stack.
+ *
+ * note:    A sub-directory is the last entry of its parent if no other
+ *          sub-directory or file comes after it, counting sub-directories
+ *          that couldn't be read, as it always has.
+ *
+ * note:    The planner hands a sub-directory to the pool if it holds fewer
+ *          than SPLIT_SIZE directories and renders the top of it itself
+ *          otherwise, so a large sub-tree is split wherever it is large.
+ *
+ * @param dir: The directory at the top of the sub-tree
+ * @param prefix: The prefix of the directory's line, grown and shrunk along the way
+ * @param isLast: Whether or not the directory is the last in its parent
+ * @param isRoot: Whether or not the directory is the root, whose line has no branch
+ * @param levels: The number of levels to render, counting the directory
+ * @param text: Where the lines are appended
+ * @param role: What the call is for
+ * @param task: The task being rendered, for the TASK role
+ ******************************************************************************/
+void TreeRenderer::renderSubtree(uint32_t dir, string &prefix, bool isLast, bool isRoot, size_t levels,
+                                 string &text, Role role, Task *task) {
+    // A frame's iterator points at the frame's own list, so frames must stay where they are
+    struct Frame {
+        uint32_t dir;                       // The directory
+        DirectoryList children;             // Its sub-directories
+        DirectoryList::Iterator next;       // The next one to render
+        size_t index;                       // How many of them came before next
+        size_t numFiles;                    // Its number of files
+        size_t prefixLength;                // The length of the prefix of its own line
+        size_t levels;                      // The levels left, counting the directory
+    };
+    std::deque<Frame> frames;
+
+    auto enter = [&](uint32_t node, bool last, bool root, size_t levelsLeft) {
+        size_t prefixLength = prefix.size();
+        if (!root) {
+            text += prefix;
+            text += last ? "└─ " : "├─ ";
+            prefix += last ? "   " : "│  ";
+        }
+        source.appendPath(node, text);
+        text += '\n';
+
+        frames.push_back(Frame{node, source.getDirectories(node), DirectoryList::Iterator(nullptr, 0, 0), 0,
+                               source.getFileCount(node), prefixLength, levelsLeft});
+        frames.back().next = frames.back().children.begin();
+    };
+
+    if (levels == 0) {
+        return;
+    }
+    enter(dir, isLast, isRoot, levels);
+
+    while (!frames.empty()) {
+        if (text.size() >= FLUSH_SIZE) {
+            flush(text, role, task);
+        }
+        Frame &frame = frames.back();
+
+        // The sub-directories first
+        if (frame.next != frame.children.end()) {
+            uint32_t child = *frame.next;
+            ++frame.next;
+            bool last = (frame.index == frame.children.size() - 1 && frame.numFiles == 0);
+            ++frame.index;
+
+            if (!source.contains(child) || frame.levels <= 1) {
+                continue;
+            }
+            if (role == PLANNER) {
+                if (source.getSubtreeDirCount(child) < SPLIT_SIZE) {
+                    splitOff(child, prefix, last, frame.levels - 1, text);
+                    continue;
+                }
+                submitBatch();
+            }
+            enter(child, last, false, frame.levels - 1);
+            continue;
+        }
+
+        // Then the files
+        if (role == PLANNER) {
+            submitBatch();
+        }
+        for (size_t i = 0; i < frame.numFiles; ++i) {
+            text += prefix;
+            text += (i == frame.numFiles - 1) ? "└─ " : "├─ ";
+            text += source.getFileName(frame.dir, i);
+            text += '\n';
+            if (text.size() >= FLUSH_SIZE) {
+                flush(text, role, task);
+            }
+        }
+        prefix.resize(frame.prefixLength);
+        frames.pop_back();
+    }
+}
+
+/******************************************************************************
+ * renderTask:  Renders the sub-trees of a task. A worker passes the text on
+ *              to the writer in chunks, the writer renders straight into the
+ *              output.
+ *
+ * @param task: The task to render
+ * @param role: TASK on a worker, WHOLE on the writer
+ ******************************************************************************/
+void TreeRenderer::renderTask(Task &task, Role role) {
+    string prefix = task.prefix;
+    string text;
+    for (const auto &root : task.roots) {
+        renderSubtree(root.first, prefix, root.second, false, task.levels, text, role, &task);
+    }
+
+    if (role == WHOLE) {
+        sink->write(text);
+        return;
+    }
+    // Notified under the lock, the writer may let the renderer go as soon as it sees done
+    std::lock_guard<std::mutex> lock(taskMutex);
+    if (!text.empty()) {
+        task.chunks.push_back(std::move(text));
+    }
+    task.done = true;
+    chunkReady.notify_all();
+}
+
+/******************************************************************************
+ * flush:   Passes on text that has grown to FLUSH_SIZE and clears it. A task
+ *          waits while MAX_CHUNKS of its chunks haven't been written yet, so
+ *          a task far ahead of the writer doesn't hold its whole sub-tree.
+ *
+ * @param text: The text rendered so far
+ * @param role: What the text was rendered for
+ * @param task: The task being rendered, for the TASK role
+ ******************************************************************************/
+void TreeRenderer::flush(string &text, Role role, Task *task) {
+    switch (role) {
+        case WHOLE:
+            sink->write(text);
+            text.clear();
+            break;
+        case PLANNER:
+            queueText(text);
+            break;
+        case TASK: {
+            std::unique_lock<std::mutex> lock(taskMutex);
+            chunkTaken.wait(lock, [task]() { return task->chunks.size() < MAX_CHUNKS; });
+            task->chunks.push_back(std::move(text));
+            text.clear();
+            lock.unlock();
+            chunkReady.notify_all();
+            break;
+        }
+    }
+}
+
+/******************************************************************************
+ * splitOff:    Adds a sub-tree to the batch of siblings that goes to the pool
+ *              next. Starting a batch queues the planner's text so far ahead
+ *              of it. A batch is handed out once it holds SPLIT_SIZE
+ *              directories.
+ *
+ * @param dir: The directory at the top of the sub-tree
+ * @param prefix: The prefix of the directory's line
+ * @param isLast: Whether or not the directory is the last in its parent
+ * @param levels: The number of levels to render, counting the directory
+ * @param text: The planner's text
+ ******************************************************************************/
+void TreeRenderer::splitOff(uint32_t dir, const string &prefix, bool isLast, size_t levels, string &text) {
+    if (!batch) {
+        if (!text.empty()) {
+            queueText(text);
+        }
+        batch = std::make_shared<Task>();
+        batch->prefix = prefix;
+        batch->levels = levels;
+    }
+
+    batch->roots.emplace_back(dir, isLast);
+    batch->directories += source.getSubtreeDirCount(dir) + 1;
+    if (batch->directories >= SPLIT_SIZE) {
+        submitBatch();
+    }
+}
+
+/******************************************************************************
+ * submitBatch: Queues the batch of siblings on the pool. Once MAX_PENDING
+ *              tasks are waiting the oldest one is written first, so the
+ *              planner never gets far ahead.
+ *
+ * note:    The writer renders a task itself if no worker has started it by
+ *          the time it is the oldest, and the worker then skips it. That
+ *          touches nothing but the task, which the worker keeps alive.
+ ******************************************************************************/
+void TreeRenderer::submitBatch() {
+    if (!batch) {
+        return;
+    }
+    std::shared_ptr<Task> task = std::move(batch);
+    batch.reset();
+
+    pending.push_back(task);
+    pool->enqueue([this, task]() {
+        if (!task->started.exchange(true)) {
+            renderTask(*task, TASK);
+        }
+    });
+
+    if (pending.size() > MAX_PENDING) {
+        writeOldest();
+    }
+}
+
+/******************************************************************************
+ * queueText:   Queues the planner's text behind the tasks handed out so far
+ *              and clears it. With none waiting it is written right away.
+ *
+ * @param text: The planner's text
+ ******************************************************************************/
+void TreeRenderer::queueText(string &text) {
+    if (pending.empty()) {
+        sink->write(text);
+        text.clear();
+        return;
+    }
+
+    std::shared_ptr<Task> task = std::make_shared<Task>();
+    task->chunks.push_back(std::move(text));
+    task->started = true;
+    task->done = true;
+    text.clear();
+
+    pending.push_back(std::move(task));
+    if (pending.size() > MAX_PENDING) {
+        writeOldest();
+    }
+}
+
+/******************************************************************************
+ * writeOldest: Writes the oldest task's chunks as they come in until it is
+ *              done, and lets it go. If no worker has started it yet it is
+ *              rendered here instead of waiting for one.
+ ******************************************************************************/
+void TreeRenderer::writeOldest() {
+    std::shared_ptr<Task> task = std::move(pending.front());
+    pending.pop_front();
+
+    if (!task->started.exchange(true)) {
+        renderTask(*task, WHOLE);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(taskMutex);
+    while (true) {
+        chunkReady.wait(lock, [&task]() { return !task->chunks.empty() || task->done; });
+        if (task->chunks.empty()) {
+            break;
+        }
+        string chunk = std::move(task->chunks.front());
+        task->chunks.pop_front();
+        lock.unlock();
+        chunkTaken.notify_all();
+        sink->write(chunk);
+        lock.lock();
+    }
+}
@@ -7,13 +7,453 @@
  ******************************************************************************/
 #include <iostream>
 #include <fstream>
-#include <unordered_map>
 #include <vector>
-#include <mutex>
+#include <atomic>
 #include <chrono> 
+#include <csignal>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <unordered_set>
+#include <unordered_map>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
 #include "DirectoryReader.h"
+#include "DirectoryRegistry.h"
+#include "PathArena.h"
 #include "ThreadPool.h"
+#include "ConcurrencyController.h"
 #include "ReportGenerator.h"
+#include "Snapshot.h"
+#include "ChangeWatcher.h"
+#include "SnapshotDiff.h"
+#include "HardLinkSet.h"
+#include "PathFilter.h"
+#include "MountTable.h"
+#include "LargestEntries.h"
+#include "ScanStream.h"
+
+// Everything the scan tasks running on the pool share
+struct ScanState {
+    PathArena& arena;                           // Holds a node for every directory found
+    ThreadPool& pool;                           // Runs one task per directory
+    DirectoryRegistry& completedDirectories;    // Every directory that has been read
+    std::atomic<int>& exitCode;                 // Set to 1 if any directory can't be read
+    ConcurrencyController& controller;          // Sizes the pool from how fast directories are read
+    std::atomic<uint64_t>& reusedDirectories;   // Directories taken from the baseline snapshot
+    std::atomic<uint64_t>& rescannedDirectories;    // Directories that had to be read
+    bool announce;                              // Print every directory as it is submitted
+};
+
+// Everything that changes how the scan runs, as opposed to what gets reported
+struct RunOptions {
+    ScanOptions scan;                           // Passed on to every DirectoryReader
+    size_t threads = 0;                         // A fixed number of threads, or 0 to size the pool while scanning
+    std::string saveSnapshot;                   // Where to save the scan, if anywhere
+    std::string loadSnapshot;                   // A snapshot to report on instead of scanning
+    std::string baselineSnapshot;               // A previous scan to only read changed directories against
+    bool watch = false;                         // Keep the tree current after the scan and write the results on every change
+    bool stream = false;                        // Write the report while scanning instead of keeping the tree for it
+    bool directOutput = false;                  // Write the report files without going through the page cache
+    std::vector<std::string> excludes;          // Globs of directories and files to leave out
+    std::vector<std::string> includes;          // Globs of directories and files to keep, everything if empty
+};
+
+// What one batch of changes did to the tree
+struct WatchBatch {
+    uint64_t reread = 0;                        // Directories read again
+    uint64_t added = 0;                         // New sub-directories, scanned with everything below them
+    uint64_t removed = 0;                       // Sub-directories that are gone, with everything below them
+};
+
+// Set by SIGINT and SIGTERM to end the watch mode
+static std::atomic<bool> stopWatching(false);
+
+/******************************************************************************
+ * scanDirectory:   Reads one directory, moves it into the registry and
+ *                  submits a task for each of its sub-directories straight to
+ *                  the pool. The scan is over once the pool runs out of tasks.
+ * 
+ * @param state: The state shared by every scan task
+ * @param dir: The directory to read, with what its parent found out about it
+ ******************************************************************************/
+void scanDirectory(ScanState& state, const ChildDirectory& dir) {
+    uint32_t node = dir.node;
+    DirectoryReader currentDir(state.arena, dir);
+
+    // Attempt to read the directory; skip if failed
+    auto readStart = std::chrono::steady_clock::now();
+    int readResult = currentDir.readDirectory();
+    state.controller.recordRead(currentDir.getNumFiles() + currentDir.getDirectories().size(),
+                                std::chrono::steady_clock::now() - readStart);
+
+    if (!readResult) {
+        std::cerr << "\033[33mFailed to read directory: " << currentDir.getPath() << "\033[0m"<< std::endl;
+        state.exitCode = 1;  // Setting exit code to indicate failure
+
+        // The parent is still waiting on this directory, so let it know there's nothing here
+        state.completedDirectories.insertFailed(node);
+        state.completedDirectories.finishDirectory(node);
+        return;  // Stop here if readDirectory() fails
+    }
+
+    // Remember the sub-directories, then move this directory into the registry
+    std::vector<ChildDirectory> children = currentDir.takeChildren();
+    (currentDir.wasReused() ? state.reusedDirectories : state.rescannedDirectories)++;
+    state.completedDirectories.insert(std::move(currentDir));
+
+    // Submit the sub-directories to the pool, along with any that were already opened
+    for (const ChildDirectory& child : children) {
+        if (state.announce) {
+            std::cout << "Adding directory: " << state.arena.getPath(child.node) << std::endl;
+        }
+        state.pool.enqueue([&state, child]() {
+            scanDirectory(state, child);
+        });
+    }
+
+    // Sizes roll up on their own: whichever task finishes last below a directory folds it into its parent
+    state.completedDirectories.finishDirectory(node);
+}
+
+/******************************************************************************
+ * parseScanArguments:  Takes the options that change how the scan runs out of
+ *                      the argument list, leaving only the positional
+ *                      arguments and the report arguments, in order.
+ * 
+ * @param args: The command-line arguments after the program name
+ * @param options: The options to fill in
+ * @return true if the options were valid
+ ******************************************************************************/
+bool parseScanArguments(std::vector<std::string>& args, RunOptions& options) {
+    std::vector<std::string> reportArgs;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--async-stat") {
+            options.scan.asyncStat = true;
+        } else if (arg == "--threads") {
+            int threads = 0;
+            try {
+                threads = (i + 1 < args.size()) ? std::stoi(args[++i]) : 0;
+            } catch (const std::exception&) {
+                threads = 0;
+            }
+            if (threads <= 0) {
+                std::cerr << "\033[31m--threads needs a positive number of threads\033[0m" << std::endl;
+                return false;
+            }
+            options.threads = threads;
+        } else if (arg == "--save-snapshot" || arg == "--load-snapshot") {
+            if (i + 1 >= args.size()) {
+                std::cerr << "\033[31m" << arg << " needs a snapshot file\033[0m" << std::endl;
+                return false;
+            }
+            (arg == "--save-snapshot" ? options.saveSnapshot : options.loadSnapshot) = args[++i];
+        } else if (arg == "--watch") {
+            options.watch = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--direct-io") {
+            options.directOutput = true;
+        } else if (arg == "-x") {
+            options.scan.oneFileSystem = true;
+        } else if (arg == "--exclude" || arg == "--include") {
+            if (i + 1 >= args.size()) {
+                std::cerr << "\033[31m" << arg << " needs a glob\033[0m" << std::endl;
+                return false;
+            }
+            (arg == "--exclude" ? options.excludes : options.includes).push_back(args[++i]);
+        } else if (arg == "--incremental") {
+            if (i + 1 >= args.size()) {
+                std::cerr << "\033[31m" << arg << " needs a snapshot file\033[0m" << std::endl;
+                return false;
+            }
+            options.baselineSnapshot = args[++i];
+        } else {
+            reportArgs.push_back(arg);
+        }
+    }
+
+    args = std::move(reportArgs);
+    return true;
+}
+
+/******************************************************************************
+ * requestStop: Signal handler that ends the watch mode after the current batch.
+ ******************************************************************************/
+void requestStop(int) {
+    stopWatching = true;
+}
+
+/******************************************************************************
+ * findChangedDirectories:  Compares the stamp of every directory in the tree
+ *                          with the directory on disk. Used when change
+ *                          events were lost, so only the directories that
+ *                          actually changed are read again instead of the
+ *                          whole tree.
+ * 
+ * note:    A file rewritten in place doesn't change its directory's stamp, so
+ *          a size change that was in the lost events isn't picked up.
+ * 
+ * @param state: The state shared by every scan task
+ * @param changed: Gets the nodes of the directories that changed
+ ******************************************************************************/
+void findChangedDirectories(ScanState& state, std::unordered_set<uint32_t>& changed) {
+    const unsigned int stampMask = STATX_INO | STATX_MTIME | STATX_CTIME;
+
+    for (uint32_t node = 0; node < state.arena.size(); ++node) {
+        if (!state.completedDirectories.contains(node)) {
+            continue;
+        }
+
+        struct statx info;
+        DirectoryStamp stamp;
+        if (statx(AT_FDCWD, state.arena.getPath(node).c_str(), AT_SYMLINK_NOFOLLOW, stampMask, &info) == 0) {
+            stamp.dev = makedev(info.stx_dev_major, info.stx_dev_minor);
+            stamp.ino = info.stx_ino;
+            stamp.mtimeSec = info.stx_mtime.tv_sec;
+            stamp.mtimeNsec = info.stx_mtime.tv_nsec;
+            stamp.ctimeSec = info.stx_ctime.tv_sec;
+            stamp.ctimeNsec = info.stx_ctime.tv_nsec;
+        }
+
+        // A directory that is gone fails to read again and is left to its parent
+        if (!(stamp == state.completedDirectories.get(node).getStamp())) {
+            changed.insert(node);
+        }
+    }
+}
+
+/******************************************************************************
+ * applyChanges:    Patches the tree for a batch of directories that changed.
+ *                  Each one is read again, keeping the nodes of the
+ *                  sub-directories that are still there so nothing below them
+ *                  is read. Sub-directories that are gone are taken out of
+ *                  the registry, new ones are scanned on the pool like during
+ *                  the first scan, and then the totals are refreshed from
+ *                  each changed directory up to the root.
+ * 
+ * note:    Parents are read before their children, so a directory that was
+ *          removed along with its parent isn't read for nothing.
+ * 
+ * @param state: The state shared by every scan task
+ * @param watcher: Told about every directory that was read
+ * @param changed: The directories that changed
+ * @return What the batch did
+ ******************************************************************************/
+WatchBatch applyChanges(ScanState& state, ChangeWatcher& watcher, const std::unordered_set<uint32_t>& changed) {
+    DirectoryRegistry& registry = state.completedDirectories;
+    WatchBatch batch;
+
+    std::vector<std::pair<size_t, uint32_t>> order;     // Each directory with its depth
+    for (uint32_t node : changed) {
+        size_t depth = 0;
+        for (uint32_t dir = node; dir != PathArena::NO_PARENT; dir = state.arena.getParent(dir)) {
+            depth++;
+        }
+        order.emplace_back(depth, node);
+    }
+    std::sort(order.begin(), order.end());
+
+    uint32_t firstNewNode = static_cast<uint32_t>(state.arena.size());
+    std::vector<uint32_t> reread;       // Directories read again, their totals have to be refreshed
+    std::vector<uint32_t> toScan;       // New sub-directories
+    std::unordered_map<uint32_t, ChildDirectory> found;     // Each sub-directory read, by node
+
+    for (const auto& [depth, node] : order) {
+        if (!registry.contains(node)) {
+            continue;   // Removed along with a directory above it
+        }
+
+        const DirectoryReader& old = registry.get(node);
+        DirectoryReader dir(state.arena,
+                            ChildDirectory{node, -1, PathArena::NO_PARENT, old.getFilterState(), old.getMount()});
+        const std::vector<uint32_t> previous = old.getDirectories();
+        dir.setPreviousDirectories(previous);
+        if (!dir.readDirectory()) {
+            continue;   // It's gone, the change to its parent takes it out
+        }
+        std::vector<uint32_t> added = dir.takeAddedDirectories();
+
+        // Take out the sub-directories that are gone
+        std::vector<uint32_t> current = dir.getDirectories();
+        for (const ChildDirectory& child : dir.takeChildren()) {
+            found[child.node] = child;
+        }
+        std::unordered_set<uint32_t> stillThere(current.begin(), current.end());
+        for (uint32_t child : previous) {
+            if (!stillThere.count(child)) {
+                registry.erase(child);
+                batch.removed++;
+            }
+        }
+
+        // A sub-directory removed and created again under the same name is a different directory
+        for (uint32_t child : current) {
+            struct statx info;
+            if (registry.contains(child)
+                && statx(AT_FDCWD, state.arena.getPath(child).c_str(), AT_SYMLINK_NOFOLLOW, STATX_INO, &info) == 0
+                && info.stx_ino != registry.get(child).getStamp().ino) {
+                registry.erase(child);
+                added.push_back(child);
+            }
+        }
+
+        registry.replace(std::move(dir));
+        toScan.insert(toScan.end(), added.begin(), added.end());
+        reread.push_back(node);
+    }
+
+    // New sub-directories roll up to the directory that found them and stop there
+    for (uint32_t dir : toScan) {
+        ChildDirectory child = found.at(dir);
+        state.pool.enqueue([&state, child]() {
+            scanDirectory(state, child);
+        });
+    }
+    state.pool.waitForCompletion();
+
+    // Charge the links that were added, and the ones whose directory went away or was read again
+    registry.chargeHardLinks();
+    for (uint32_t node : reread) {
+        registry.refreshTotals(node);
+    }
+
+    // Watch everything that was just read, whether it's new or was there under the same node before
+    auto watch = [&](uint32_t node) {
+        if (registry.contains(node)) {
+            watcher.watchDirectory(node, registry.get(node).getStamp().dev);
+        }
+    };
+    for (uint32_t node : reread) {
+        watch(node);
+    }
+    for (uint32_t node : toScan) {
+        watch(node);
+    }
+    for (uint32_t node = firstNewNode; node < state.arena.size(); ++node) {
+        watch(node);
+    }
+
+    batch.reread = reread.size();
+    batch.added = toScan.size();
+    return batch;
+}
+
+/******************************************************************************
+ * writeResults:    Saves the snapshot and generates the reports that were
+ *                  asked for, from the directories that have been read.
+ * 
+ * @param registry: The directories that have been read
+ * @param arena: The arena holding the directory tree
+ * @param rootNode: The arena node of the root directory
+ * @param options: Where to save the snapshot, if anywhere
+ * @param outputFile: The file reports are written to
+ * @param args: The report arguments, if any
+ * @param largest: The largest files and directories collected during the scan, or nullptr
+ * @param pool: The scan's pool, idle by now, which the trees are rendered on
+ * @return The exit code of the program
+ ******************************************************************************/
+int writeResults(const DirectoryRegistry& registry, const PathArena& arena, uint32_t rootNode,
+                 const RunOptions& options, const std::string& outputFile, const std::vector<std::string>& args,
+                 const LargestEntries* largest, ThreadPool& pool) {
+    // Save the scan so later reports don't have to scan again
+    if (!options.saveSnapshot.empty()) {
+        if (!Snapshot::save(options.saveSnapshot, registry, arena, rootNode)) {
+            std::cerr << "\033[31mFailed to save snapshot.\033[0m" << std::endl;
+            return 1;
+        }
+        std::cout << "\033[32mSnapshot saved to " << options.saveSnapshot << ".\033[0m" << std::endl;
+
+        if (args.empty()) {
+            return 0;   // Nothing to report
+        }
+    }
+
+    std::cout << "\033[32mGenerating report...\033[0m" << std::endl;
+
+    // Generate a report based on the processed directories
+    ReportGenerator report(registry);
+    report.setLargestEntries(largest);
+    report.setDirectOutput(options.directOutput);
+    report.setThreadPool(&pool);
+    
+    if (report.generateReport(outputFile, rootNode, args) != 0) { // Check if the report generation failed
+        std::cerr << "\033[31mFailed to generate report.\033[0m" << std::endl;
+        return 1;
+    }
+
+    std::cout << "\033[32mReport successfully generated.\033[0m" << std::endl;
+    return 0;
+}
+
+/******************************************************************************
+ * watchTree:   Keeps the tree current after the scan. Every directory that
+ *              was read is watched, changes are applied a batch at a time and
+ *              the results are written again after each batch, until the
+ *              program gets SIGINT or SIGTERM.
+ * 
+ * note:    Anything that changed between reading a directory and watching it
+ *          would be missed, so the stamps are compared once the watches are
+ *          in place. The same is done whenever the kernel drops events.
+ * 
+ * @param state: The state shared by every scan task
+ * @param rootNode: The arena node of the root directory
+ * @param options: Where to save the snapshot, if anywhere
+ * @param outputFile: The file reports are written to
+ * @param args: The report arguments, if any
+ * @return The exit code of the program
+ ******************************************************************************/
+int watchTree(ScanState& state, uint32_t rootNode, const RunOptions& options, const std::string& outputFile,
+              const std::vector<std::string>& args) {
+    ChangeWatcher watcher(state.arena);
+    if (!watcher.start()) {
+        return 1;
+    }
+    for (uint32_t node = 0; node < state.arena.size(); ++node) {
+        if (state.completedDirectories.contains(node)) {
+            watcher.watchDirectory(node, state.completedDirectories.get(node).getStamp().dev);
+        }
+    }
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    std::cout << "\033[32mWatching " << state.arena.getPath(rootNode) << " with " << watcher.getBackendName()
+              << ". Press Ctrl+C to stop.\033[0m" << std::endl;
+
+    std::unordered_set<uint32_t> changed;
+    bool overflowed = true;     // Catch up on whatever changed before the watches were in place
+
+    while (overflowed || watcher.waitForChanges(changed, overflowed, stopWatching)) {
+        if (overflowed) {
+            findChangedDirectories(state, changed);
+        }
+        overflowed = false;
+        if (changed.empty()) {
+            continue;
+        }
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        WatchBatch batch = applyChanges(state, watcher, changed);
+        changed.clear();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::high_resolution_clock::now() - start_time).count();
+
+        std::cout << "\033[32mApplied changes in " << duration << " ms: " << batch.reread << " directories read again, "
+                  << batch.added << " added, " << batch.removed << " removed.\033[0m" << std::endl;
+
+        // What was collected during the scan is out of date now, so the reports look through the tree
+        if (writeResults(state.completedDirectories, state.arena, rootNode, options, outputFile, args, nullptr, state.pool) != 0) {
+            return 1;
+        }
+    }
+
+    std::cout << "\033[32mStopped watching.\033[0m" << std::endl;
+    return 0;
+}
 
 /******************************************************************************
  * helper:  Prints a help message to the console explaining how to use the
@@ -33,7 +473,111 @@ void helper(){
               << "    -li  <numLevels (int)> : Print information about the first <numLevels> levels of directories" << std::endl
               << "    -lis <numLevels (int)> : Print information about the first <numLevels> levels of directories to a file" << std::endl
               << "    -lt  <numLevels (int)> : Print the tree of directories for the first <numLevels> levels" << std::endl
-              << "    -lts <numLevels (int)> : Print the tree of directories to a file for the first <numLevels> levels" << std::endl;
+              << "    -lts <numLevels (int)> : Print the tree of directories to a file for the first <numLevels> levels" << std::endl
+              << "    -top  <numEntries (int)> : Print the largest files and directories" << std::endl
+              << "    -tops <numEntries (int)> : Print the largest files and directories to a file" << std::endl
+              << "    -tS   <numEntries (int)> : Print the tree with each directory's <numEntries> largest files and directories first" << std::endl
+              << "    -tSs  <numEntries (int)> : Print the tree with the largest entries first to a file" << std::endl
+              << "    -ltS  <numLevels (int)> <numEntries (int)> : Print the tree with the largest entries first for the first <numLevels> levels" << std::endl
+              << "    -ltSs <numLevels (int)> <numEntries (int)> : Print the tree with the largest entries first to a file for the first <numLevels> levels" << std::endl
+              << "    -j:     Prints the information about every directory as NDJSON, one object per line" << std::endl
+              << "    -js:    Prints the information about every directory as NDJSON to a file" << std::endl
+              << "Scan options:" << std::endl
+              << "    --async-stat: Stat entries and open directories in batches through io_uring (for NFS, FUSE and other slow filesystems)" << std::endl
+              << "    --threads <numThreads (int)> : Use a fixed number of threads instead of sizing the pool while scanning" << std::endl
+              << "    --save-snapshot <file> : Save the scan to a snapshot file that reports can be generated from later" << std::endl
+              << "    --incremental <file>   : Only read directories that changed since the scan saved in a snapshot file" << std::endl
+              << "    --watch: Keep watching the root after the scan and write the reports and snapshot again on every change" << std::endl
+              << "    --stream: Write a -p, -ps, -i, -is, -j or -js report while scanning, deepest directories first, keeping no files in memory" << std::endl
+              << "    --direct-io: Write the report files with O_DIRECT, so a large report doesn't fill the page cache" << std::endl
+              << "    --exclude <glob> : Leave out directories and files matching the glob, can be given more than once" << std::endl
+              << "    --include <glob> : Only keep files matching the glob or below a directory matching it, can be given more than once" << std::endl
+              << "    -x:     Stay on the filesystem the root is on" << std::endl
+              << "Reporting from a snapshot:" << std::endl
+              << "    ./main --load-snapshot <file> <output_file> [other_args...]" << std::endl
+              << "Comparing two snapshots:" << std::endl
+              << "    ./main diff <old_snapshot> <new_snapshot> [numEntries (int)] : List what was added, removed or changed size, the largest changes first" << std::endl;
+}
+
+/******************************************************************************
+ * reportFromSnapshot:  Generates the requested reports from a saved snapshot
+ *                      instead of scanning the filesystem.
+ * 
+ * @param snapshotFile: The snapshot to load
+ * @param outputFile: The file reports are written to
+ * @param args: The report arguments
+ * @param directOutput: Whether to write the report files without going through the page cache
+ * @return The exit code of the program
+ ******************************************************************************/
+int reportFromSnapshot(const std::string& snapshotFile, const std::string& outputFile,
+                       const std::vector<std::string>& args, bool directOutput) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    Snapshot snapshot;
+    if (!snapshot.open(snapshotFile)) {
+        return 1;
+    }
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+    std::cout << "\033[32mLoaded snapshot " << snapshotFile << " in " << duration << " ms.\033[0m" << std::endl;
+
+    std::cout << "\033[32mGenerating report...\033[0m" << std::endl;
+
+    // One pool for every report, the trees are rendered on it
+    ThreadPool pool;
+    ReportGenerator report(snapshot);
+    report.setDirectOutput(directOutput);
+    report.setThreadPool(&pool);
+    if (report.generateReport(outputFile, Snapshot::ROOT, args) != 0) {
+        std::cerr << "\033[31mFailed to generate report.\033[0m" << std::endl;
+        return 1;
+    }
+
+    std::cout << "\033[32mReport successfully generated.\033[0m" << std::endl;
+    return 0;
+}
+
+/******************************************************************************
+ * diffSnapshots:   Compares two snapshots and prints what changed between
+ *                  them to the console, the largest changes first.
+ * 
+ * @param args: The old snapshot, the new snapshot and optionally the number
+ *              of directories and files to list
+ * @return The exit code of the program
+ ******************************************************************************/
+int diffSnapshots(const std::vector<std::string>& args) {
+    if (args.size() < 2 || args.size() > 3) {
+        std::cerr << "Usage: ./LFSA diff <old_snapshot> <new_snapshot> [numEntries]" << std::endl;
+        return 1;
+    }
+
+    size_t limit = SnapshotDiff::DEFAULT_LIMIT;
+    if (args.size() == 3) {
+        try {
+            limit = std::stoul(args[2]);
+        } catch (const std::exception&) {
+            std::cerr << "\033[31mInvalid number of entries: " << args[2] << "\033[0m" << std::endl;
+            return 1;
+        }
+    }
+
+    Snapshot oldSnapshot;
+    Snapshot newSnapshot;
+    if (!oldSnapshot.open(args[0]) || !newSnapshot.open(args[1])) {
+        return 1;
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    SnapshotDiff diff(oldSnapshot, newSnapshot, limit);
+    diff.compare();
+    auto end_time = std::chrono::high_resolution_clock::now();
+
+    diff.print(std::cout);
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
+    std::cout << "\033[32mCompared in " << duration << " ms.\033[0m" << std::endl;
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -42,133 +586,262 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    // Comparing snapshots doesn't scan anything
+    if (argc >= 2 && std::string(argv[1]) == "diff") {
+        return diffSnapshots(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    // Pull the options out first, they may appear anywhere on the command line
+    std::vector<std::string> args(argv + 1, argv + argc);
+    RunOptions options;
+    if (!parseScanArguments(args, options)) {
+        return 1;
+    }
+
+    // A streamed scan keeps nothing once a directory is written, so there is nothing to save or watch
+    if (options.stream && (options.watch || !options.saveSnapshot.empty() || !options.loadSnapshot.empty())) {
+        std::cerr << "\033[31m--stream can't be combined with --watch, --save-snapshot or --load-snapshot\033[0m" << std::endl;
+        return 1;
+    }
+
+    // A snapshot replaces the scan, so there's no root directory
+    if (!options.loadSnapshot.empty()) {
+        if (args.empty()) {
+            std::cerr << "Usage: " << argv[0] << " --load-snapshot <file> <output_file> [other_args...]" << std::endl;
+            return 1;
+        }
+        if (args.size() == 1) {
+            std::cerr << "No arguments specified. For a list of arguments, run " << argv[0] << " --help" << std::endl;
+            return 1;
+        }
+        return reportFromSnapshot(options.loadSnapshot, args[0], std::vector<std::string>(args.begin() + 1, args.end()),
+                                  options.directOutput);
+    }
+
     // Validate command-line arguments
-    if (argc < 3) {
+    if (args.size() < 2) {
         std::cerr << "Usage: " << argv[0] << " <root_directory> <output_file> [other_args...]" << std::endl
                   << "For a list of arguments, run " << argv[0] << " --help" << std::endl;
         return 1;
     }
 
-    // Check if no arguments were specified
-    if (argc == 3) {
+    // Check if no arguments were specified, saving a snapshot is enough on its own
+    if (args.size() == 2 && options.saveSnapshot.empty()) {
         std::cerr << "No arguments specified. For a list of arguments, run " << argv[0] << " --help" << std::endl;
         return 1;
     }
 
     // Initialize the root directory path
-    std::string root = argv[1];
-    std::string outputFile = argv[2];
+    std::string root = args[0];
+    std::string outputFile = args[1];
+
+    // Whatever is left is for the report
+    args.erase(args.begin(), args.begin() + 2);
+
+    // Every directory found by the scan gets a node in this arena, starting with the root
+    PathArena arena;
+    uint32_t rootNode = arena.addNode(PathArena::NO_PARENT, root);
 
     // Verify that the root directory is readable
-    DirectoryReader tempDirChecker(root);
+    DirectoryReader tempDirChecker(arena, rootNode);
     if (!tempDirChecker.canReadDirectory()) {
         std::cerr << "\033[31mCannot read directory: " << root << "\033[0m" <<std::endl;
         return 1;
     }
 
-    // Convert the remaining command-line arguments to a vector of strings
-    std::vector<std::string> args(argv + 3, argv + argc);
+    ScanOptions& scanOptions = options.scan;
 
-    // Initialize data structures for tracking directories
-    std::vector<DirectoryReader> directoriesLeft = { DirectoryReader(root) };
-    std::unordered_map<std::string, DirectoryReader> completedDirectories;
-    std::unordered_map<std::string, double> deferredUpdates;
-    std::atomic<int> exitCode = 0;  // To store the exit code in a thread-safe manner
+    // Only collect the file information the requested reports actually use, a snapshot keeps all of it
+    scanOptions.statxMask = ReportGenerator::requiredStatxMask(args);
+    if (!options.saveSnapshot.empty()) {
+        scanOptions.statxMask |= STATX_MODE | STATX_SIZE | STATX_BLOCKS | STATX_NLINK | STATX_INO;
+    }
 
-    // Create a thread pool with 200 threads
-    ThreadPool pool(200);
+    // Compare every directory with a previous scan of the same root, if there is one
+    Snapshot baseline;
+    uint32_t rootBaseline = PathArena::NO_PARENT;
+    if (!options.baselineSnapshot.empty()) {
+        if (!baseline.open(options.baselineSnapshot)) {
+            return 1;
+        }
+        if (baseline.getPath(Snapshot::ROOT) == arena.getPath(rootNode)) {
+            scanOptions.baseline = &baseline;
+            rootBaseline = Snapshot::ROOT;
+        } else {
+            std::cerr << "\033[33m" << options.baselineSnapshot << " is a scan of " << baseline.getPath(Snapshot::ROOT)
+                      << ", not " << root << ". Scanning everything.\033[0m" << std::endl;
+        }
+    }
+    scanOptions.recordStamps = !options.saveSnapshot.empty() || scanOptions.baseline != nullptr || options.watch;
 
-    // Mutex for thread-safe directory manipulation
-    std::mutex dirMutex;
+    // Count files with several links once, whenever sizes are collected. A streamed report can't wait for
+    // every link to be read, so there the first directory read with a link counts the file.
+    HardLinkSet hardLinks(options.stream);
+    if (scanOptions.statxMask & STATX_NLINK) {
+        scanOptions.hardLinks = &hardLinks;
+    }
 
-    DirectoryReader currentDir;
+    // Keep the largest files and directories while scanning if a report asks for them
+    std::unique_ptr<LargestEntries> largest;
+    size_t largestLimit = ReportGenerator::largestLimit(args);
+    if (largestLimit > 0) {
+        largest.reset(new LargestEntries(largestLimit));
+        scanOptions.largest = largest.get();
+    }
 
-    auto start_time = std::chrono::high_resolution_clock::now();  // Time measurement
+    // Reports that only rank the largest entries don't need a row for every file, a snapshot and the watch mode do
+    scanOptions.listFiles = ReportGenerator::listsFiles(args) || !options.saveSnapshot.empty() || options.watch;
 
-    // Main processing loop
-    while (true) {
-        {
-            // Lock scope for thread-safe manipulation of shared resources
-            std::unique_lock<std::mutex> lock(dirMutex);
-
-            // Check if there are any directories left to process
-            if (directoriesLeft.empty()) {
-                if (pool.activeJobs == 0) {
-                    break;
-                } else {
-                    continue;
-                }
-            }
+    // A streamed report is written from each directory's totals, it only needs the rows while a directory is read
+    ScanStream stream;
+    if (options.stream) {
+        if (!stream.configure(args)) {
+            return 1;
+        }
+        scanOptions.listFiles = stream.needsFiles();
+    }
+
+    // If no report needs more than the file type, classify entries without stat-ing them
+    scanOptions.lazyStat = (scanOptions.statxMask == STATX_TYPE);
 
-            // Retrieve the next directory to process
-            currentDir = directoriesLeft.back();
-            directoriesLeft.pop_back();
+    // Directories opened ahead of time may use up to half of the descriptors we are allowed
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur != RLIM_INFINITY) {
+        scanOptions.maxOpenDirectories = static_cast<unsigned int>(fileLimit.rlim_cur / 2);
+    } else {
+        scanOptions.maxOpenDirectories = 4096;
+    }
+
+    // Compile the globs once, every reader then only checks entry names against them
+    PathFilter filter;
+    char* realRoot = realpath(root.c_str(), nullptr);
+    std::string rootPath = (realRoot != nullptr) ? realRoot : root;
+    free(realRoot);
+    for (const std::string& glob : PathFilter::DEFAULT_EXCLUDES) {
+        filter.addExclude(glob, rootPath);
+    }
+    for (const std::string& glob : options.excludes) {
+        filter.addExclude(glob, rootPath);
+    }
+    for (const std::string& glob : options.includes) {
+        filter.addInclude(glob, rootPath);
+    }
+    uint32_t rootFilterState = filter.rootState(rootPath);
+    scanOptions.filter = &filter;
+
+    // Find the mounts below the root, so pseudo filesystems are skipped and each mount is read its own way
+    MountTable mounts;
+    uint32_t rootMount = MountTable::NO_MOUNT;
+    if (mounts.load(root, rootPath)) {
+        scanOptions.mounts = &mounts;
+        rootMount = mounts.getRootMount();
+    } else {
+        std::cerr << "\033[33mCannot read the mount table, pseudo filesystems won't be skipped.\033[0m" << std::endl;
+    }
+
+    // Stay on the root's device if asked to
+    if (scanOptions.oneFileSystem) {
+        struct statx rootInfo;
+        if (statx(AT_FDCWD, root.c_str(), 0, 0, &rootInfo) != 0) {
+            std::cerr << "\033[31mCannot stat directory: " << root << "\033[0m" << std::endl;
+            return 1;
         }
+        scanOptions.device = makedev(rootInfo.stx_dev_major, rootInfo.stx_dev_minor);
+    }
+    DirectoryReader::setScanOptions(scanOptions);
 
-        // Enqueue a job in the thread pool to read and process the directory
-        pool.enqueue([currentDir, &dirMutex, &completedDirectories, &directoriesLeft, &deferredUpdates, &exitCode]() mutable {
-            // Attempt to read the directory; skip if failed
-            if (!currentDir.readDirectory()) {
-                std::cerr << "\033[33mFailed to read directory: " << currentDir.getPath() << "\033[0m"<< std::endl;
-                exitCode = 1;  // Setting exit code to indicate failure
-                return;  // Exit this lambda early if readDirectory() fails
-            }
+    // Initialize data structures for tracking directories
+    DirectoryRegistry completedDirectories(arena);
+    completedDirectories.setLargestEntries(largest.get());
+    if (options.stream) {
+        if (!stream.open(outputFile, completedDirectories, options.directOutput)) {
+            return 1;
+        }
+        completedDirectories.setStream(&stream);
+    } else if (scanOptions.hardLinks != nullptr) {
+        completedDirectories.setHardLinks(&hardLinks);
+    }
+    std::atomic<int> exitCode = 0;  // To store the exit code in a thread-safe manner
+    std::atomic<uint64_t> reusedDirectories = 0;
+    std::atomic<uint64_t> rescannedDirectories = 0;
 
-            // Lock scope for thread-safe manipulation of shared resources
-            std::unique_lock<std::mutex> lock(dirMutex);
+    // Size the pool from the CPUs and descriptors we may use, unless the user picked a number of threads
+    // A root on a network or FUSE mount is read through io_uring, so size the pool for that
+    bool rootAsync = scanOptions.mounts != nullptr && mounts.getStrategy(rootMount).asyncStat;
+    ConcurrencyLimits limits = ConcurrencyController::detectLimits(scanOptions.asyncStat || rootAsync);
+    if (options.threads > 0) {
+        limits.minThreads = limits.maxThreads = limits.startThreads = options.threads;
+    }
 
-            // Handle any deferred updates for this directory
-            if (deferredUpdates.find(currentDir.getPath()) != deferredUpdates.end()) {
-                currentDir.addToSubDirTotalSize(deferredUpdates[currentDir.getPath()]);
-                deferredUpdates.erase(currentDir.getPath());
-            }
+    ThreadPool pool(limits.maxThreads);
+    ConcurrencyController controller(pool, limits);
 
-            // Enqueue any subdirectories for processing
-            if (!currentDir.getDirectories().empty()) {
-                for (const auto& dir : currentDir.getDirectories()) {
-                    std::cout << "Adding directory: " << dir << std::endl;
-                    directoriesLeft.push_back(DirectoryReader(dir, currentDir.getPath()));
-                }
-            }
+    // Records streamed to the console would get lost between the directories being added
+    bool announce = !(options.stream && stream.writesToConsole());
+    ScanState state = { arena, pool, completedDirectories, exitCode, controller, reusedDirectories, rescannedDirectories,
+                        announce };
 
-            // Update the parent directory's total size, if applicable
-            std::string parentPath = currentDir.getParentPath();
-            if (!parentPath.empty()) {
-                if (completedDirectories.find(parentPath) != completedDirectories.end()) {
-                    completedDirectories[parentPath].addToTotalSize(currentDir.getTotalSize());
-                } else {
-                    deferredUpdates[parentPath] += currentDir.getTotalSize();
-                }
-            }
+    auto start_time = std::chrono::high_resolution_clock::now();  // Time measurement
 
-            // Mark this directory as completed
-            completedDirectories[currentDir.getPath()] = currentDir;
-        });
+    // With a fixed number of threads there's nothing to adjust
+    if (options.threads == 0) {
+        controller.start();
     }
 
-    // Wait for all thread pool jobs to complete
+    // Start at the root, every worker then submits the sub-directories it finds itself
+    ChildDirectory rootDirectory{rootNode, -1, rootBaseline, rootFilterState, rootMount};
+    pool.enqueue([&state, rootDirectory]() {
+        scanDirectory(state, rootDirectory);
+    });
+
+    // Wait for all thread pool jobs to complete, the pool's job counter only reaches zero once
+    // every directory has been read since each task submits its children before it finishes
     std::cout << "\033[32mWaiting for all thread pool jobs to complete...\033[0m" << std::endl;
     pool.waitForCompletion();
+    controller.stop();
+
+    // Every link has been read, so each file with several links can be counted where it belongs
+    completedDirectories.chargeHardLinks();
 
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time).count();
     std::cout << "\033[32mTotal time taken: " << duration << " seconds.\033[0m" << std::endl;
+    controller.printSummary();
+
+    if (hardLinks.size() > 0) {
+        std::cout << "\033[32mHard links: " << hardLinks.size() << " files with more than one link, each counted once.\033[0m"
+                  << std::endl;
+    }
+
+    if (scanOptions.baseline != nullptr) {
+        std::cout << "\033[32mIncremental scan: " << reusedDirectories << " directories reused from "
+                  << options.baselineSnapshot << ", " << rescannedDirectories << " rescanned.\033[0m" << std::endl;
+    }
 
     if (exitCode.load() != 0) { // Check if any lambda function failed
         std::cerr << "\033[33mOne or more directory reads failed.\033[0m" << std::endl;
     }
 
-    std::cout << "\033[32mGenerating report...\033[0m" << std::endl;
+    // Everything was written while scanning, all that's left is waiting for the writer
+    if (options.stream) {
+        if (!stream.close()) {
+            std::cerr << "\033[31mFailed to write the report.\033[0m" << std::endl;
+            return 1;
+        }
+        std::cout << "\033[32mStreamed " << stream.getRecordCount() << " directories.\033[0m" << std::endl;
+        return 0;
+    }
 
-    // Generate a report based on the processed directories
-    ReportGenerator report(completedDirectories);
-    
-    if (report.generateReport(outputFile, root, args) != 0) { // Check if the report generation failed
-        std::cerr << "\033[31mFailed to generate report.\033[0m" << std::endl;
-        return 1;
+    int result = writeResults(completedDirectories, arena, rootNode, options, outputFile, args, largest.get(), pool);
+    if (result != 0 || !options.watch) {
+        return result;
     }
 
-    std::cout << "\033[32mReport successfully generated.\033[0m" << std::endl;
+    // The largest entries only describe the first scan, from here on the reports look through the tree
+    scanOptions.largest = nullptr;
+    DirectoryReader::setScanOptions(scanOptions);
+    completedDirectories.setLargestEntries(nullptr);
 
-    return 0;  // Success
+    // Keep the results current until we're told to stop
+    return watchTree(state, rootNode, options, outputFile, args);
 }